@@ -21,183 +21,568 @@
  * THE SOFTWARE.
  */
 #include "ESP8266.h"
-
-#define LOG_OUTPUT_DEBUG            (1)
-#define LOG_OUTPUT_DEBUG_PREFIX     (1)
-
-#define logDebug(arg)\
-    do {\
-        if (LOG_OUTPUT_DEBUG)\
-        {\
-            if (LOG_OUTPUT_DEBUG_PREFIX)\
-            {\
-                Serial.print("[LOG Debug: ");\
-                Serial.print((const char*)__FILE__);\
-                Serial.print(",");\
-                Serial.print((unsigned int)__LINE__);\
-                Serial.print(",");\
-                Serial.print((const char*)__FUNCTION__);\
-                Serial.print("] ");\
-            }\
-            Serial.print(arg);\
-        }\
-    } while(0)
-
-#ifdef ESP8266_USE_SOFTWARE_SERIAL
-ESP8266::ESP8266(SoftwareSerial &uart, uint32_t baud): m_puart(&uart)
-{
-    m_puart->begin(baud);
-    rx_empty();
+#include "ESP8266Mail.h"
+
+/* What rx_process() does with data for a full link queue */
+#define HOLD_NONE   (-1)                    /* drop it */
+#define HOLD_ALL    (ESP8266_MAX_LINKS)     /* keep it in the RX buffer */
+
+/* Command table */
+
+static const char t_ok[] PROGMEM = "OK";
+static const char t_error[] PROGMEM = "ERROR";
+static const char t_no_change[] PROGMEM = "no change";
+static const char t_connected[] PROGMEM = "CONNECTED";
+static const char t_fail[] PROGMEM = "FAIL";
+static const char t_already[] PROGMEM = "ALREADY CONNECT";
+static const char t_link_not[] PROGMEM = "link is not";
+static const char t_link_builded[] PROGMEM = "Link is builded";
+static const char t_echo_end[] PROGMEM = "\r\r\n";
+static const char t_prompt[] PROGMEM = ">";
+static const char t_send_ok[] PROGMEM = "SEND OK";
+static const char t_send_fail[] PROGMEM = "SEND FAIL";
+
+/* The first ok_count targets of each set mean success */
+static const char * const ok_only[] PROGMEM = {t_ok};
+static const char * const ok_error[] PROGMEM = {t_ok, t_error};
+static const char * const ok_no_change[] PROGMEM = {t_ok, t_no_change};
+static const char * const join_result[] PROGMEM = {t_ok, t_connected, t_fail};
+static const char * const start_result[] PROGMEM = {t_ok, t_already, t_error};
+static const char * const close_result[] PROGMEM = {t_ok, t_link_not};
+static const char * const mux_result[] PROGMEM = {t_ok, t_link_builded};
+static const char * const echo_end[] PROGMEM = {t_echo_end};
+static const char * const send_prompt[] PROGMEM = {t_prompt, t_error};
+static const char * const send_result[] PROGMEM = {t_send_ok, t_send_fail, t_error};
+
+/* Where the answer of a query starts and ends */
+static const char q_cwmode[] PROGMEM = "+CWMODE:";
+static const char q_cipdomain[] PROGMEM = "+CIPDOMAIN:";
+static const char q_end[] PROGMEM = "\r\n\r\nOK";
+
+/* "%" takes the next argument */
+static const char f_at[] PROGMEM = "AT";
+static const char f_rst[] PROGMEM = "AT+RST";
+static const char f_gmr[] PROGMEM = "AT+GMR";
+static const char f_cwmode_q[] PROGMEM = "AT+CWMODE?";
+static const char f_cwmode[] PROGMEM = "AT+CWMODE=%";
+static const char f_cwmode_cur[] PROGMEM = "AT+CWMODE_CUR=%";
+static const char f_cwjap[] PROGMEM = "AT+CWJAP=\"%\",\"%\"";
+static const char f_cwjap_q[] PROGMEM = "AT+CWJAP?";
+static const char f_cwlap[] PROGMEM = "AT+CWLAP";
+static const char f_cwlapopt[] PROGMEM = "AT+CWLAPOPT=%,%";
+static const char f_cwqap[] PROGMEM = "AT+CWQAP";
+static const char f_cwsap[] PROGMEM = "AT+CWSAP=\"%\",\"%\",%,%";
+static const char f_cwlif[] PROGMEM = "AT+CWLIF";
+static const char f_cipstatus[] PROGMEM = "AT+CIPSTATUS";
+static const char f_cipdomain[] PROGMEM = "AT+CIPDOMAIN=\"%\"";
+static const char f_cipstart_single[] PROGMEM = "AT+CIPSTART=\"%\",\"%\",%";
+static const char f_cipstart_multiple[] PROGMEM = "AT+CIPSTART=%,\"%\",\"%\",%";
+static const char f_cipsend_single[] PROGMEM = "AT+CIPSEND=%";
+static const char f_cipsend_multiple[] PROGMEM = "AT+CIPSEND=%,%";
+static const char f_cipsend[] PROGMEM = "AT+CIPSEND";
+static const char f_cipsendex_single[] PROGMEM = "AT+CIPSENDEX=%";
+static const char f_cipsendex_multiple[] PROGMEM = "AT+CIPSENDEX=%,%";
+static const char f_cipclose_single[] PROGMEM = "AT+CIPCLOSE";
+static const char f_cipclose_multiple[] PROGMEM = "AT+CIPCLOSE=%";
+static const char f_cifsr[] PROGMEM = "AT+CIFSR";
+static const char f_cipmux[] PROGMEM = "AT+CIPMUX=%";
+static const char f_cipserver_on[] PROGMEM = "AT+CIPSERVER=1,%";
+static const char f_cipserver_off[] PROGMEM = "AT+CIPSERVER=0";
+static const char f_cipsto[] PROGMEM = "AT+CIPSTO=%";
+static const char f_cipmode[] PROGMEM = "AT+CIPMODE=%";
+static const char f_uart_cur[] PROGMEM = "AT+UART_CUR=%,8,1,0,0";
+
+/* The rows of cmd_table, in the same order */
+enum {
+    ROW_AT,
+    ROW_AT_PROBE,
+    ROW_RST,
+    ROW_GMR,
+    ROW_CWMODE_Q,
+    ROW_CWMODE,
+    ROW_CWMODE_CUR,
+    ROW_CWJAP,
+    ROW_CWJAP_Q,
+    ROW_CWLAP,
+    ROW_CWLAPOPT,
+    ROW_CWQAP,
+    ROW_CWSAP,
+    ROW_CWLIF,
+    ROW_CIPSTATUS,
+    ROW_CIPDOMAIN,
+    ROW_CIPSTART_SINGLE,
+    ROW_CIPSTART_MULTIPLE,
+    ROW_CIPSEND_SINGLE,
+    ROW_CIPSEND_MULTIPLE,
+    ROW_CIPSEND_PASSTHROUGH,
+    ROW_CIPSENDEX_SINGLE,
+    ROW_CIPSENDEX_MULTIPLE,
+    ROW_CIPCLOSE_SINGLE,
+    ROW_CIPCLOSE_MULTIPLE,
+    ROW_CIFSR,
+    ROW_CIPMUX,
+    ROW_CIPSERVER_ON,
+    ROW_CIPSERVER_OFF,
+    ROW_CIPSTO,
+    ROW_CIPMODE,
+    ROW_UART_CUR,
+    ROW_COUNT
+};
+
+struct ESP8266CmdRow {
+    const char *format;
+    const char * const *targets;
+    uint8_t count;
+    uint8_t ok_count;
+    uint16_t timeout;               /* milliseconds */
+    uint8_t cmd;                    /* ESP8266Cmd, for the statistics */
+    const char *filter;             /* where the answer of a query starts, NULL if none */
+};
+
+#define TARGETS(set)    set, sizeof(set) / sizeof(set[0])
+
+static const ESP8266CmdRow cmd_table[] PROGMEM = {
+    {f_at,                  TARGETS(ok_only),       1, 1000,  ESP8266_CMD_AT,         NULL},
+    {f_at,                  TARGETS(ok_only),       1, ESP8266_BAUD_PROBE_TIMEOUT, ESP8266_CMD_AT, NULL},
+    {f_rst,                 TARGETS(ok_only),       1, 1000,  ESP8266_CMD_RST,        NULL},
+    {f_gmr,                 TARGETS(ok_only),       1, 1000,  ESP8266_CMD_GMR,        t_echo_end},
+    {f_cwmode_q,            TARGETS(ok_only),       1, 1000,  ESP8266_CMD_CWMODE,     q_cwmode},
+    {f_cwmode,              TARGETS(ok_no_change),  2, 1000,  ESP8266_CMD_CWMODE,     NULL},
+    {f_cwmode_cur,          TARGETS(ok_error),      1, 1000,  ESP8266_CMD_CWMODE,     NULL},
+    {f_cwjap,               TARGETS(join_result),   2, 10000, ESP8266_CMD_CWJAP,      NULL},
+    {f_cwjap_q,             TARGETS(join_result),   2, 10000, ESP8266_CMD_CWJAP,      NULL},
+    {f_cwlap,               TARGETS(ok_only),       1, 10000, ESP8266_CMD_CWLAP,      t_echo_end},
+    {f_cwlapopt,            TARGETS(ok_error),      1, 1000,  ESP8266_CMD_CWLAPOPT,   NULL},
+    {f_cwqap,               TARGETS(ok_only),       1, 1000,  ESP8266_CMD_CWQAP,      NULL},
+    {f_cwsap,               TARGETS(ok_error),      1, 5000,  ESP8266_CMD_CWSAP,      NULL},
+    {f_cwlif,               TARGETS(ok_only),       1, 1000,  ESP8266_CMD_CWLIF,      t_echo_end},
+    {f_cipstatus,           TARGETS(ok_only),       1, 1000,  ESP8266_CMD_CIPSTATUS,  t_echo_end},
+    {f_cipdomain,           TARGETS(ok_error),      1, 10000, ESP8266_CMD_CIPDOMAIN,  q_cipdomain},
+    {f_cipstart_single,     TARGETS(start_result),  2, 10000, ESP8266_CMD_CIPSTART,   NULL},
+    {f_cipstart_multiple,   TARGETS(start_result),  2, 10000, ESP8266_CMD_CIPSTART,   NULL},
+    {f_cipsend_single,      TARGETS(send_prompt),   1, 5000,  ESP8266_CMD_CIPSEND,    NULL},
+    {f_cipsend_multiple,    TARGETS(send_prompt),   1, 5000,  ESP8266_CMD_CIPSEND,    NULL},
+    {f_cipsend,             TARGETS(send_prompt),   1, 5000,  ESP8266_CMD_CIPSEND,    NULL},
+    {f_cipsendex_single,    TARGETS(send_prompt),   1, 5000,  ESP8266_CMD_CIPSEND,    NULL},
+    {f_cipsendex_multiple,  TARGETS(send_prompt),   1, 5000,  ESP8266_CMD_CIPSEND,    NULL},
+    {f_cipclose_single,     TARGETS(ok_only),       1, 5000,  ESP8266_CMD_CIPCLOSE,   NULL},
+    {f_cipclose_multiple,   TARGETS(close_result),  2, 5000,  ESP8266_CMD_CIPCLOSE,   NULL},
+    {f_cifsr,               TARGETS(ok_only),       1, 1000,  ESP8266_CMD_CIFSR,      t_echo_end},
+    {f_cipmux,              TARGETS(mux_result),    1, 1000,  ESP8266_CMD_CIPMUX,     NULL},
+    {f_cipserver_on,        TARGETS(ok_no_change),  2, 1000,  ESP8266_CMD_CIPSERVER,  NULL},
+    {f_cipserver_off,       TARGETS(echo_end),      1, 1000,  ESP8266_CMD_CIPSERVER,  NULL},
+    {f_cipsto,              TARGETS(ok_only),       1, 1000,  ESP8266_CMD_CIPSTO,     NULL},
+    {f_cipmode,             TARGETS(ok_error),      1, 1000,  ESP8266_CMD_CIPMODE,    NULL},
+    {f_uart_cur,            TARGETS(ok_error),      1, 1000,  ESP8266_CMD_UART,       NULL},
+};
+
+static_assert(sizeof(cmd_table) / sizeof(cmd_table[0]) == ROW_COUNT, "a row of cmd_table is missing");
+
+static void read_row(uint8_t id, ESP8266CmdRow &row)
+{
+    memcpy_P(&row, &cmd_table[id], sizeof(row));
 }
-#else
-ESP8266::ESP8266(HardwareSerial &uart, uint32_t baud): m_puart(&uart)
+
+/*----------------------------------------------------------------------------*/
+
+ESP8266::ESP8266(Stream &uart, ESP8266UartBegin begin, UartFill fill, UartWrite write, 
+    uint32_t baud_max, uint32_t baud): 
+    m_puart(&uart), m_uart(&uart), m_uart_begin(begin), m_uart_fill(fill), m_uart_write(write), 
+    m_rx_full(false), m_rx_fills(0),
+    m_cmd_handle(0), m_cmd_last(0), m_cmd_done(0), m_cmd_result(ESP8266_UNKNOWN),
+    m_cmd_payload(NULL), m_cmd_notify(false), m_cmd_notify_pending(false), m_capture_filter(NULL),
+    m_capture_data(NULL),
+    m_ap_parser(NULL), m_ap_mask(ESP8266_AP_ALL),
+    m_callback(NULL), m_callback_arg(NULL),
+    m_ipd_link(-1), m_ipd_remain(0), m_line_len(0), m_line_ipd(0), m_line_long(false), m_link_next(0),
+    m_link_pending(-1), m_server_port(0), m_link_parser(NULL),
+    m_event_handler(NULL), m_event_arg(NULL),
+    m_passthrough(false), m_passthrough_prompt(false), m_passthrough_tx(0),
+    m_baud(baud), m_baud_max(baud_max), m_baud_default(0), m_baud_errors(0),
+    m_ready(false), m_boot_time(0), m_no_cwmode_cur(false)
+#if ESP8266_STATS
+    , m_stats_uart(uart), m_stats_cmd(-1)
+#endif
+#if ESP8266_TRACE_SIZE
+    , m_trace_uart(uart)
+#endif
 {
-    m_puart->begin(baud);
+#if ESP8266_STATS
+    m_puart = &m_stats_uart;
+    resetStats();
+#endif
+#if ESP8266_TRACE_SIZE
+    /* Outermost, so that it sees bytes when they are written or read */
+    m_trace_uart.attach(*m_puart);
+    m_puart = &m_trace_uart;
+#endif
+    if (m_puart != m_uart) {
+        /* The wrappers are known as Stream only */
+        m_uart_fill = uart_fill_as<Stream>;
+        m_uart_write = uart_write_as<Stream>;
+    }
+    links_clear();
+    clearDNSCache();
+    uart_baud(baud);
     rx_empty();
 }
-#endif
 
 bool ESP8266::kick(void)
 {
-    return eAT();
+    return wait(eAT()) == ESP8266_OK;
 }
 
 void ESP8266::forceBaudrate() {
 
-  // Serial.println(F("ESP8266::Forcing Baud Rate ..."));
-  m_puart->begin(115200);
+  logInfo("forcing the baud rate");
+  uart_baud(115200);
   m_puart->println(F("AT+RST"));
   delay(500);
 
   m_puart->println(F("AT+CIOBAUD=9600"));
   delay(500);
-  m_puart->begin(9600); // 9600
+  uart_baud(9600); // 9600
+  m_baud = 9600;
 
 }
 
-bool ESP8266::restart(void)
+static const uint32_t baud_rates[] = {9600, 19200, 38400, 57600, 115200, 230400, 460800};
+#define BAUD_RATE_COUNT     (sizeof(baud_rates) / sizeof(baud_rates[0]))
+
+uint32_t ESP8266::detectBaudrate(void)
 {
-    Serial.println("ESP8266: Restarting");
-    // added by Etienne
-    forceBaudrate();
+    uint8_t i;
 
-    unsigned long start;
-    if (eATRST()) {
-        delay(2000);
+    if (!baud_probe(m_baud)) {
+        for (i = 0; i < BAUD_RATE_COUNT; i++) {
+            if (baud_rates[i] != m_baud && baud_probe(baud_rates[i])) {
+                break;
+            }
+        }
+        if (i == BAUD_RATE_COUNT) {
+            return 0;
+        }
+    }
+    if (!m_baud_default) {
+        m_baud_default = m_baud;
+    }
+    m_baud_errors = 0;
+    return m_baud;
+}
 
-        // added by Etienne
-        // need to call this again because we have reset the WIFI chip
-        // so its default rate has kicked back in
-        forceBaudrate();
+uint32_t ESP8266::negotiateBaudrate(uint32_t max)
+{
+    uint32_t from;
+    uint8_t i;
 
-        start = millis();
-        while (millis() - start < 3000) {
-            if (eAT()) {
-                delay(1500); /* Waiting for stable */
+    if (max == 0) {
+        max = m_baud_max;
+    }
+    if (!detectBaudrate()) {
+        return 0;
+    }
+    from = m_baud;
+    for (i = BAUD_RATE_COUNT; i > 0 && baud_rates[i - 1] > from; i--) {
+        if (baud_rates[i - 1] > max) {
+            continue;
+        }
+        if (baud_switch(baud_rates[i - 1])) {
+            break;
+        }
+        if (m_baud != from && !detectBaudrate()) {
+            return 0;
+        }
+        from = m_baud;
+    }
+    m_baud_errors = 0;
+    return m_baud;
+}
+
+bool ESP8266::checkBaudrate(void)
+{
+    uint8_t i;
+
+    if (m_baud_errors < ESP8266_BAUD_MAX_ERRORS) {
+        return true;
+    }
+    m_baud_errors = 0;
+    for (i = 1; i < BAUD_RATE_COUNT; i++) {
+        if (baud_rates[i] == m_baud) {
+            if (baud_switch(baud_rates[i - 1])) {
                 return true;
             }
-            delay(100);
+            break;
         }
     }
-    Serial.println(F("ESP8266::restart not working"));
-    return false;
+    return detectBaudrate() != 0;
 }
 
-String ESP8266::getVersion(void)
+uint32_t ESP8266::getBaudrate(void)
 {
-    String version;
-    eATGMR(version);
-    return version;
+    return m_baud;
 }
 
-bool ESP8266::setOprToStation(void)
+bool ESP8266::baud_probe(uint32_t baud)
 {
-    uint8_t mode;
-    if (!qATCWMODE(&mode)) {
-        // Serial.println("...is this where it falters?");
-        return false;
+    uint8_t ok = 0;
+    uint8_t tries;
+
+    uart_baud(baud);
+    m_baud = baud;
+    /* The first "AT" may come after noise sent at another rate */
+    for (tries = 0; tries <= ESP8266_BAUD_PROBES && ok < ESP8266_BAUD_PROBES; tries++) {
+        if (wait(cmd_exec(ROW_AT_PROBE)) == ESP8266_OK) {
+            ok++;
+        } else if (ok > 0) {
+            return false;
+        }
     }
-    if (mode == 1) {
-        return true;
-    } else {
-        if (sATCWMODE(1) && restart()) {
-            // Serial.println("... have called restart ...");
+    return ok == ESP8266_BAUD_PROBES;
+}
+
+uint32_t ESP8266::getBootTime(void)
+{
+    return m_boot_time;
+}
+
+bool ESP8266::boot_wait(unsigned long start, uint32_t timeout)
+{
+    unsigned long probe = millis();
+
+    m_boot_time = 0;
+    while (millis() - start < timeout) {
+        rx_process(HOLD_NONE);
+        if (!m_ready && millis() - probe < ESP8266_BOOT_PROBE_INTERVAL) {
+            continue;
+        }
+        /* Some firmware prints "ready" at another baud rate, so ask anyway */
+        if (wait(cmd_exec(ROW_AT_PROBE)) == ESP8266_OK) {
+            m_boot_time = millis() - start;
+            if (m_boot_time == 0) {
+                m_boot_time = 1;
+            }
             return true;
-        } else {
-            // Serial.println("... or here?");
-            return false;
         }
+        probe = millis();
     }
+    return false;
 }
 
-bool ESP8266::setOprToSoftAP(void)
+bool ESP8266::baud_switch(uint32_t baud)
 {
-    uint8_t mode;
-    if (!qATCWMODE(&mode)) {
+    uint32_t from = m_baud;
+    uint8_t tries;
+
+    if (wait(sATUARTCUR(baud)) != ESP8266_OK) {
         return false;
     }
-    if (mode == 2) {
+    /* "OK" came at the old rate, ESP8266 uses the new one from now on */
+    m_puart->flush();
+    if (baud_probe(baud)) {
         return true;
-    } else {
-        if (sATCWMODE(2) && restart()) {
+    }
+
+    /* Too fast for the link, but asking to go back may still get through */
+    for (tries = 0; tries < ESP8266_BAUD_PROBES; tries++) {
+        wait(sATUARTCUR(from));
+        m_puart->flush();
+        if (baud_probe(from)) {
+            break;
+        }
+        uart_baud(baud);
+        m_baud = baud;
+    }
+    return false;
+}
+
+bool ESP8266::restart(uint32_t timeout)
+{
+    uint32_t baud = m_baud;
+    unsigned long start;
+
+    logInfo("restarting");
+    if (!m_baud_default && !kick()) {
+        // added by Etienne
+        forceBaudrate();
+    }
+
+    if (wait(eATRST()) == ESP8266_OK) {
+        start = millis();
+        m_ready = false;
+        links_clear();
+        if (m_baud_default) {
+            /* Back at the rate of reset, the negotiated one is set again below */
+            uart_baud(m_baud_default);
+            m_baud = m_baud_default;
+        }
+
+        if (!boot_wait(start, timeout) && !m_baud_default) {
+            // added by Etienne
+            // the default rate of the WIFI chip may have kicked back in
+            forceBaudrate();
+            boot_wait(millis(), timeout);
+        }
+        if (m_boot_time) {
+            if (m_baud_default && baud != m_baud && !baud_switch(baud)) {
+                negotiateBaudrate(baud);
+            }
             return true;
-        } else {
-            return false;
         }
     }
+    logError("restart failed");
+    return false;
+}
+
+#if !ESP8266_NO_STRING
+String ESP8266::getVersion(void)
+{
+    String version;
+    eATGMR(version);
+    return version;
+}
+#endif
+
+bool ESP8266::getVersion(char *buffer, size_t size)
+{
+    return eATGMR(buffer, size);
+}
+
+bool ESP8266::setOprToStation(void)
+{
+    return set_mode(1);
+}
+
+bool ESP8266::setOprToSoftAP(void)
+{
+    return set_mode(2);
 }
 
 bool ESP8266::setOprToStationSoftAP(void)
 {
-    // Serial.println("+++++++++++++++++");
-    uint8_t mode;
-    if (!qATCWMODE(&mode)) {
-        // Serial.println("could not query!");
+    return set_mode(3);
+}
+
+bool ESP8266::set_mode(uint8_t mode)
+{
+    uint8_t current;
+    if (!qATCWMODE(&current)) {
         return false;
     }
-    if (mode == 3) {
-        // Serial.println("+++++++++++++++++ its 3 already");
+    if (current == mode) {
         return true;
-    } else {
-        if (sATCWMODE(3) && restart()) {
-            // Serial.println("+++++++++++++++++ set to 3 and restart");
-            return true;
-        } else {
-            // Serial.println("+++++++++++++++++ couldn't set to 3");
+    }
+    if (!m_no_cwmode_cur) {
+        switch (wait(sATCWMODECUR(mode))) {
+        case ESP8266_OK:
+            return qATCWMODE(&current) && current == mode;
+        case ESP8266_ERROR:
+            /* Old firmware, which needs a restart */
+            m_no_cwmode_cur = true;
+            break;
+        default:
             return false;
-
         }
     }
+    return wait(sATCWMODE(mode)) == ESP8266_OK && restart();
 }
 
+#if !ESP8266_NO_STRING
 String ESP8266::getAPList(void)
 {
     String list;
     eATCWLAP(list);
     return list;
 }
+#endif
+
+bool ESP8266::getAPList(char *buffer, size_t size)
+{
+    return eATCWLAP(buffer, size);
+}
+
+bool ESP8266::scanAP(ESP8266APHandler handler, void *arg)
+{
+    ESP8266APParser parser(m_ap_mask);
+    ESP8266Handle handle = cmd_exec(ROW_CWLAP);
+    bool ok;
+
+    /* Each line is parsed as it comes, nothing of the list is kept */
+    m_ap_parser = &parser;
+    m_ap_handler = handler;
+    m_ap_arg = arg;
+    ok = wait(handle) == ESP8266_OK;
+    m_ap_parser = NULL;
+    return ok;
+}
+
+/* The strongest APs found so far, see scanAP(aps, count) */
+struct APTop {
+    ESP8266AP *aps;
+    uint8_t count;
+    uint8_t len;
+};
+
+static void ap_top(const ESP8266AP &ap, void *arg)
+{
+    APTop *top = (APTop *)arg;
+    uint8_t i;
+
+    for (i = top->len; i > 0 && top->aps[i - 1].rssi < ap.rssi; i--) {
+        if (i < top->count) {
+            top->aps[i] = top->aps[i - 1];
+        }
+    }
+    if (i < top->count) {
+        top->aps[i] = ap;
+        if (top->len < top->count) {
+            top->len++;
+        }
+    }
+}
+
+uint8_t ESP8266::scanAP(ESP8266AP *aps, uint8_t count)
+{
+    APTop top = {aps, count, 0};
+
+    if (!scanAP(ap_top, &top)) {
+        return 0;
+    }
+    return top.len;
+}
+
+bool ESP8266::setAPListOptions(bool sort, uint16_t mask)
+{
+    CmdArg args[] = {(uint32_t)sort, mask};
+
+    if (wait(cmd_exec(ROW_CWLAPOPT, args, 2)) != ESP8266_OK) {
+        return false;
+    }
+    m_ap_mask = mask;
+    return true;
+}
 
-bool ESP8266::joinAP(String ssid, String pwd)
+bool ESP8266::joinAP(const ESP8266Segment &ssid, const ESP8266Segment &pwd)
 {
-    return sATCWJAP(ssid, pwd);
+    return wait(sATCWJAP(ssid, pwd)) == ESP8266_OK;
 }
 
 // Added by Etienne
 bool ESP8266::checkAP()
 {
-    return qATCWJAP();   
+    return wait(qATCWJAP()) == ESP8266_OK;
 }
 
 bool ESP8266::leaveAP(void)
 {
-    return eATCWQAP();
+    return wait(eATCWQAP()) == ESP8266_OK;
 }
 
-bool ESP8266::setSoftAPParam(String ssid, String pwd, uint8_t chl, uint8_t ecn)
+bool ESP8266::setSoftAPParam(const ESP8266Segment &ssid, const ESP8266Segment &pwd, uint8_t chl, uint8_t ecn)
 {
-    return sATCWSAP(ssid, pwd, chl, ecn);
+    return wait(sATCWSAP(ssid, pwd, chl, ecn)) == ESP8266_OK;
 }
 
+#if !ESP8266_NO_STRING
 String ESP8266::getJoinedDeviceIP(void)
 {
     String list;
@@ -218,65 +603,135 @@ String ESP8266::getLocalIP(void)
     eATCIFSR(list);
     return list;
 }
+#endif
+
+bool ESP8266::getJoinedDeviceIP(char *buffer, size_t size)
+{
+    return eATCWLIF(buffer, size);
+}
+
+bool ESP8266::getIPStatus(char *buffer, size_t size)
+{
+    return eATCIPSTATUS(buffer, size);
+}
+
+bool ESP8266::getLocalIP(char *buffer, size_t size)
+{
+    return eATCIFSR(buffer, size);
+}
+
+bool ESP8266::getLinkInfo(uint8_t mux_id, ESP8266LinkInfo &info)
+{
+    if (mux_id >= ESP8266_MAX_LINKS) {
+        memset(&info, 0, sizeof(info));
+        return false;
+    }
+    info = m_link_info[mux_id];
+    return info.state == ESP8266_LINK_CONNECTED;
+}
+
+bool ESP8266::isConnected(uint8_t mux_id)
+{
+    return mux_id < ESP8266_MAX_LINKS && m_link_info[mux_id].state == ESP8266_LINK_CONNECTED;
+}
+
+uint8_t ESP8266::getConnectedLinks(void)
+{
+    uint8_t links = 0;
+    uint8_t i;
+
+    for (i = 0; i < ESP8266_MAX_LINKS; i++) {
+        if (m_link_info[i].state == ESP8266_LINK_CONNECTED) {
+            links |= 1 << i;
+        }
+    }
+    return links;
+}
+
+bool ESP8266::syncLinks(void)
+{
+    ESP8266LinkParser parser;
+    ESP8266Handle handle = cmd_exec(ROW_CIPSTATUS);
+    uint8_t i;
+
+    /* Each line goes into the table as it comes, see cmd_feed() */
+    m_link_parser = &parser;
+    m_link_seen = 0;
+    if (wait(handle) != ESP8266_OK) {
+        m_link_parser = NULL;
+        return false;
+    }
+    m_link_parser = NULL;
+    for (i = 0; i < ESP8266_MAX_LINKS; i++) {
+        if (!(m_link_seen & (1 << i))) {
+            m_link_info[i].state = ESP8266_LINK_CLOSED;
+        }
+    }
+    return true;
+}
 
 bool ESP8266::enableMUX(void)
 {
-    return sATCIPMUX(1);
+    return wait(sATCIPMUX(1)) == ESP8266_OK;
 }
 
 bool ESP8266::disableMUX(void)
 {
-    return sATCIPMUX(0);
+    return wait(sATCIPMUX(0)) == ESP8266_OK;
 }
 
-bool ESP8266::createTCP(String addr, uint32_t port)
+bool ESP8266::createTCP(const ESP8266Segment &addr, uint32_t port)
 {
-    return sATCIPSTARTSingle("TCP", addr, port);
+    dns_resolve(addr);
+    return wait(sATCIPSTARTSingle("TCP", addr, port)) == ESP8266_OK;
 }
 
 bool ESP8266::releaseTCP(void)
 {
-    return eATCIPCLOSESingle();
+    return wait(eATCIPCLOSESingle()) == ESP8266_OK;
 }
 
-bool ESP8266::registerUDP(String addr, uint32_t port)
+bool ESP8266::registerUDP(const ESP8266Segment &addr, uint32_t port)
 {
-    return sATCIPSTARTSingle("UDP", addr, port);
+    dns_resolve(addr);
+    return wait(sATCIPSTARTSingle("UDP", addr, port)) == ESP8266_OK;
 }
 
 bool ESP8266::unregisterUDP(void)
 {
-    return eATCIPCLOSESingle();
+    return wait(eATCIPCLOSESingle()) == ESP8266_OK;
 }
 
-bool ESP8266::createTCP(uint8_t mux_id, String addr, uint32_t port)
+bool ESP8266::createTCP(uint8_t mux_id, const ESP8266Segment &addr, uint32_t port)
 {
-    return sATCIPSTARTMultiple(mux_id, "TCP", addr, port);
+    dns_resolve(addr);
+    return wait(sATCIPSTARTMultiple(mux_id, "TCP", addr, port)) == ESP8266_OK;
 }
 
 bool ESP8266::releaseTCP(uint8_t mux_id)
 {
-    return sATCIPCLOSEMulitple(mux_id);
+    return wait(sATCIPCLOSEMulitple(mux_id)) == ESP8266_OK;
 }
 
-bool ESP8266::registerUDP(uint8_t mux_id, String addr, uint32_t port)
+bool ESP8266::registerUDP(uint8_t mux_id, const ESP8266Segment &addr, uint32_t port)
 {
-    return sATCIPSTARTMultiple(mux_id, "UDP", addr, port);
+    dns_resolve(addr);
+    return wait(sATCIPSTARTMultiple(mux_id, "UDP", addr, port)) == ESP8266_OK;
 }
 
 bool ESP8266::unregisterUDP(uint8_t mux_id)
 {
-    return sATCIPCLOSEMulitple(mux_id);
+    return wait(sATCIPCLOSEMulitple(mux_id)) == ESP8266_OK;
 }
 
 bool ESP8266::setTCPServerTimeout(uint32_t timeout)
 {
-    return sATCIPSTO(timeout);
+    return wait(sATCIPSTO(timeout)) == ESP8266_OK;
 }
 
 bool ESP8266::startTCPServer(uint32_t port)
 {
-    if (sATCIPSERVER(1, port)) {
+    if (wait(sATCIPSERVER(1, port)) == ESP8266_OK) {
         return true;
     }
     return false;
@@ -284,7 +739,7 @@ bool ESP8266::startTCPServer(uint32_t port)
 
 bool ESP8266::stopTCPServer(void)
 {
-    sATCIPSERVER(0);
+    wait(sATCIPSERVER(0));
     restart();
     return false;
 }
@@ -299,9 +754,67 @@ bool ESP8266::stopServer(void)
     return stopTCPServer();
 }
 
+static uint32_t segments_length(const ESP8266Segment *segments, uint8_t count)
+{
+    uint32_t len = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        len += segments[i].len;
+    }
+    return len;
+}
+
+/* Where send() is in segments too long for one AT+CIPSEND */
+struct SegmentCursor {
+    const ESP8266Segment *segments;
+    uint8_t count;
+    uint8_t index;
+    uint32_t offset;
+
+    SegmentCursor(const ESP8266Segment *s, uint8_t c): segments(s), count(c), index(0), offset(0) {}
+};
+
+static uint32_t segments_produce(uint8_t *buffer, uint32_t size, void *arg)
+{
+    SegmentCursor *cursor = (SegmentCursor *)arg;
+    const ESP8266Segment *segment;
+    uint32_t n;
+
+    while (cursor->index < cursor->count) {
+        segment = &cursor->segments[cursor->index];
+        n = segment->len - cursor->offset;
+        if (n == 0) {
+            cursor->index++;
+            cursor->offset = 0;
+            continue;
+        }
+        if (n > size) {
+            n = size;
+        }
+        if (segment->progmem) {
+            memcpy_P(buffer, segment->data + cursor->offset, n);
+        } else {
+            memcpy(buffer, segment->data + cursor->offset, n);
+        }
+        cursor->offset += n;
+        return n;
+    }
+    return 0;
+}
+
 bool ESP8266::send(const uint8_t *buffer, uint32_t len)
 {
-    return sATCIPSENDSingle(buffer, len);
+    ESP8266Segment segment(buffer, len);
+    return send(&segment, 1);
+}
+
+bool ESP8266::send(const ESP8266Segment *segments, uint8_t count)
+{
+    uint32_t len = segments_length(segments, count);
+    if (len > ESP8266_SEND_CHUNK_SIZE) {
+        SegmentCursor cursor(segments, count);
+        return sendStream(segments_produce, &cursor, len);
+    }
+    return wait(sATCIPSENDSingle(segments, count)) == ESP8266_OK;
 }
 /*
 // by me Etienne ... for sending SMTP emails
@@ -311,35 +824,45 @@ bool ESP8266::sendAndCheck(String message)
 }
 */
 
+#if !ESP8266_NO_STRING
 bool ESP8266::sendAndCheck(String message, String target)
 {
-    const char* buffer = message.c_str();
-    uint32_t len = strlen(buffer);
+    return sendAndCheck(message.c_str(), target.c_str());
+}
+#endif
+
+bool ESP8266::sendAndCheck(const char *message, const char *target)
+{
+    ESP8266Segment segment(message);
+
+    if (sendAndCheck(&segment, 1, target)) {
+        return true;
+    }
+    logWarn("the command was: ", message);
+    return false;
+}
 
+bool ESP8266::sendAndCheck(const ESP8266Segment *segments, uint8_t count, const char *target)
+{
     // send command
-    sATCIPSENDSingleNoRcv( (uint8_t*)buffer, len);
+    sATCIPSENDSingleNoRcv(segments, count);
 
     // now wait for the right contents
     if ( recvFind(target, 10000) ) {
-        // Serial.println(F("GOOD!"));
         // if we get here then we found the appropriate contents
         return true;
     } else {
-        Serial.println(F("ESP8266:: Sending was fine but response was not right to the command:"));
-        Serial.println(message);
+        logWarn("sent, but the reply has no ", target);
     }
 
 
     return false;
 }
 
-uint32_t ESP8266::sendAndReceive(uint8_t *inputBuffer, uint32_t buffer_size, String message)
+uint32_t ESP8266::sendAndReceive(uint8_t *inputBuffer, uint32_t buffer_size, const ESP8266Segment &message)
 {
-    const char* buffer = message.c_str();
-    uint32_t len = strlen(buffer);
-
     // send command
-    sATCIPSENDSingleNoRcv( (uint8_t*)buffer, len);
+    sATCIPSENDSingleNoRcv(&message, 1);
 
     // now read the result and place into buffer
     return recv(inputBuffer, buffer_size, 10000);
@@ -347,669 +870,1685 @@ uint32_t ESP8266::sendAndReceive(uint8_t *inputBuffer, uint32_t buffer_size, Str
 
 bool ESP8266::send(uint8_t mux_id, const uint8_t *buffer, uint32_t len)
 {
-    return sATCIPSENDMultiple(mux_id, buffer, len);
+    ESP8266Segment segment(buffer, len);
+    return send(mux_id, &segment, 1);
 }
 
-uint32_t ESP8266::recv(uint8_t *buffer, uint32_t buffer_size, uint32_t timeout)
+bool ESP8266::send(uint8_t mux_id, const ESP8266Segment *segments, uint8_t count)
 {
-    return recvPkg(buffer, buffer_size, NULL, timeout, NULL);
+    uint32_t len = segments_length(segments, count);
+    if (len > ESP8266_SEND_CHUNK_SIZE) {
+        SegmentCursor cursor(segments, count);
+        return sendStream(mux_id, segments_produce, &cursor, len);
+    }
+    return wait(sATCIPSENDMultiple(mux_id, segments, count)) == ESP8266_OK;
 }
 
-uint32_t ESP8266::recv(uint8_t mux_id, uint8_t *buffer, uint32_t buffer_size, uint32_t timeout)
+bool ESP8266::sendStream(ESP8266Producer producer, void *arg, uint32_t total, uint32_t *sent)
 {
-    uint8_t id;
-    uint32_t ret;
-    ret = recvPkg(buffer, buffer_size, NULL, timeout, &id);
-    if (ret > 0 && id == mux_id) {
-        return ret;
-    }
-    return 0;
+    return send_stream(-1, producer, arg, total, sent);
 }
 
-uint32_t ESP8266::recv(uint8_t *coming_mux_id, uint8_t *buffer, uint32_t buffer_size, uint32_t timeout)
+bool ESP8266::sendStream(uint8_t mux_id, ESP8266Producer producer, void *arg, uint32_t total, uint32_t *sent)
 {
-    return recvPkg(buffer, buffer_size, NULL, timeout, coming_mux_id);
+    return send_stream(mux_id, producer, arg, total, sent);
 }
 
-/*----------------------------------------------------------------------------*/
-/* +IPD,<id>,<len>:<data> */
-/* +IPD,<len>:<data> */
-
-uint32_t ESP8266::recvPkg(uint8_t *buffer, uint32_t buffer_size, uint32_t *data_len, uint32_t timeout, uint8_t *coming_mux_id)
+bool ESP8266::enterPassthrough(void)
 {
-    String data;
-    char a;
-    int32_t index_PIPDcomma = -1;
-    int32_t index_colon = -1; /* : */
-    int32_t index_comma = -1; /* , */
-    int32_t len = -1;
-    int8_t id = -1;
-    bool has_data = false;
-    uint32_t ret;
-    unsigned long start;
-    uint32_t i;
-    
-    if (buffer == NULL) {
-        return 0;
+    if (m_passthrough) {
+        return true;
     }
-    
-    start = millis();
-    while (millis() - start < timeout) {
-        if(m_puart->available() > 0) {
-            a = m_puart->read();
-            data += a;
-        }
-        
-        index_PIPDcomma = data.indexOf("+IPD,");
-        if (index_PIPDcomma != -1) {
-            index_colon = data.indexOf(':', index_PIPDcomma + 5);
-            if (index_colon != -1) {
-                index_comma = data.indexOf(',', index_PIPDcomma + 5);
-                /* +IPD,id,len:data */
-                if (index_comma != -1 && index_comma < index_colon) { 
-                    id = data.substring(index_PIPDcomma + 5, index_comma).toInt();
-                    if (id < 0 || id > 4) {
-                        return 0;
-                    }
-                    len = data.substring(index_comma + 1, index_colon).toInt();
-                    if (len <= 0) {
-                        return 0;
-                    }
-                } else { /* +IPD,len:data */
-                    len = data.substring(index_PIPDcomma + 5, index_colon).toInt();
-                    if (len <= 0) {
-                        return 0;
-                    }
-                }
-                has_data = true;
-                break;
-            }
-        }
+    if (wait(sATCIPMODE(1)) != ESP8266_OK) {
+        return false;
     }
-    
-    if (has_data) {
-        i = 0;
-        ret = len > buffer_size ? buffer_size : len;
-        start = millis();
-        while (millis() - start < 3000) {
-            while(m_puart->available() > 0 && i < ret) {
-                a = m_puart->read();
-                buffer[i++] = a;
-            }
-            if (i == ret) {
-                rx_empty();
-                if (data_len) {
-                    *data_len = len;    
-                }
-                if (index_comma != -1 && coming_mux_id) {
-                    *coming_mux_id = id;
-                }
-                return ret;
-            }
-        }
+    if (wait(eATCIPSENDPassthrough()) != ESP8266_OK) {
+        wait(sATCIPMODE(0));
+        return false;
     }
-    return 0;
+    return true;
 }
 
-/*
-* Written by Etienne to parse out unwanted text when receiving an email
-*
-* All I want is the sender and the email body.
-*/
-uint32_t ESP8266::sendAndReceiveEmail(char* email_contents[], size_t content_sizes[], String message)
+bool ESP8266::exitPassthrough(void)
 {
-    const char* buffer = message.c_str();
-    uint32_t length = strlen(buffer);
+    if (!m_passthrough) {
+        return true;
+    }
+    passthrough_guard();
+    m_puart->print("+++");
+    m_passthrough_tx = millis();
+    passthrough_guard();
+    m_passthrough = false;
+    return wait(sATCIPMODE(0)) == ESP8266_OK;
+}
 
-    // send command to retrieve email
-    sATCIPSENDSingleNoRcv( (uint8_t*)buffer, length);
+bool ESP8266::isPassthrough(void)
+{
+    return m_passthrough;
+}
 
-    // now read the result and place into buffers
-    String data;
-    char a;
-    int32_t index_PIPDcomma = -1;
-    int32_t index_colon = -1; /* : */
-    int32_t index_comma = -1; /* , */
-    int32_t len = -1;
-    int8_t id = -1;
-    bool has_data = false;
-    uint32_t ret;
+uint32_t ESP8266::recv(uint8_t *buffer, uint32_t buffer_size, uint32_t timeout)
+{
+    return recvPkg(ESP8266_SINGLE_LINK, buffer, buffer_size, timeout, NULL);
+}
+
+uint32_t ESP8266::recv(uint8_t mux_id, uint8_t *buffer, uint32_t buffer_size, uint32_t timeout)
+{
+    if (mux_id >= ESP8266_MAX_LINKS) {
+        return 0;
+    }
+    return recvPkg(mux_id, buffer, buffer_size, timeout, NULL);
+}
+
+uint32_t ESP8266::recv(uint8_t *coming_mux_id, uint8_t *buffer, uint32_t buffer_size, uint32_t timeout)
+{
+    return recvPkg(-1, buffer, buffer_size, timeout, coming_mux_id);
+}
+
+ESP8266Handle ESP8266::beginKick(void)
+{
+    if (busy()) {
+        return 0;
+    }
+    return cmd_notify(eAT());
+}
+
+ESP8266Handle ESP8266::beginJoinAP(const ESP8266Segment &ssid, const ESP8266Segment &pwd)
+{
+    if (busy()) {
+        return 0;
+    }
+    return cmd_notify(sATCWJAP(ssid, pwd));
+}
+
+ESP8266Handle ESP8266::beginLeaveAP(void)
+{
+    if (busy()) {
+        return 0;
+    }
+    return cmd_notify(eATCWQAP());
+}
+
+ESP8266Handle ESP8266::beginEnableMUX(void)
+{
+    if (busy()) {
+        return 0;
+    }
+    return cmd_notify(sATCIPMUX(1));
+}
+
+ESP8266Handle ESP8266::beginDisableMUX(void)
+{
+    if (busy()) {
+        return 0;
+    }
+    return cmd_notify(sATCIPMUX(0));
+}
+
+ESP8266Handle ESP8266::beginCreateTCP(const ESP8266Segment &addr, uint32_t port)
+{
+    if (busy()) {
+        return 0;
+    }
+    return cmd_notify(sATCIPSTARTSingle("TCP", addr, port));
+}
+
+ESP8266Handle ESP8266::beginReleaseTCP(void)
+{
+    if (busy()) {
+        return 0;
+    }
+    return cmd_notify(eATCIPCLOSESingle());
+}
+
+ESP8266Handle ESP8266::beginRegisterUDP(const ESP8266Segment &addr, uint32_t port)
+{
+    if (busy()) {
+        return 0;
+    }
+    return cmd_notify(sATCIPSTARTSingle("UDP", addr, port));
+}
+
+ESP8266Handle ESP8266::beginUnregisterUDP(void)
+{
+    return beginReleaseTCP();
+}
+
+ESP8266Handle ESP8266::beginCreateTCP(uint8_t mux_id, const ESP8266Segment &addr, uint32_t port)
+{
+    if (busy()) {
+        return 0;
+    }
+    return cmd_notify(sATCIPSTARTMultiple(mux_id, "TCP", addr, port));
+}
+
+ESP8266Handle ESP8266::beginReleaseTCP(uint8_t mux_id)
+{
+    if (busy()) {
+        return 0;
+    }
+    return cmd_notify(sATCIPCLOSEMulitple(mux_id));
+}
+
+ESP8266Handle ESP8266::beginRegisterUDP(uint8_t mux_id, const ESP8266Segment &addr, uint32_t port)
+{
+    if (busy()) {
+        return 0;
+    }
+    return cmd_notify(sATCIPSTARTMultiple(mux_id, "UDP", addr, port));
+}
+
+ESP8266Handle ESP8266::beginUnregisterUDP(uint8_t mux_id)
+{
+    return beginReleaseTCP(mux_id);
+}
+
+ESP8266Handle ESP8266::beginStartTCPServer(uint32_t port)
+{
+    if (busy()) {
+        return 0;
+    }
+    return cmd_notify(sATCIPSERVER(1, port));
+}
+
+ESP8266Handle ESP8266::beginSend(const uint8_t *buffer, uint32_t len)
+{
+    if (busy()) {
+        return 0;
+    }
+    m_cmd_segment = ESP8266Segment(buffer, len);
+    return cmd_notify(sATCIPSENDSingle(&m_cmd_segment, 1));
+}
+
+ESP8266Handle ESP8266::beginSend(uint8_t mux_id, const uint8_t *buffer, uint32_t len)
+{
+    if (busy()) {
+        return 0;
+    }
+    m_cmd_segment = ESP8266Segment(buffer, len);
+    return cmd_notify(sATCIPSENDMultiple(mux_id, &m_cmd_segment, 1));
+}
+
+ESP8266Handle ESP8266::beginSend(const ESP8266Segment *segments, uint8_t count)
+{
+    if (busy()) {
+        return 0;
+    }
+    return cmd_notify(sATCIPSENDSingle(segments, count));
+}
+
+ESP8266Handle ESP8266::beginSend(uint8_t mux_id, const ESP8266Segment *segments, uint8_t count)
+{
+    if (busy()) {
+        return 0;
+    }
+    return cmd_notify(sATCIPSENDMultiple(mux_id, segments, count));
+}
+
+uint32_t ESP8266::available(uint8_t mux_id)
+{
+    if (mux_id >= ESP8266_MAX_LINKS) {
+        return 0;
+    }
+    rx_process(mux_id);
+    return m_link[mux_id].available();
+}
+
+uint32_t ESP8266::getLinkDropCount(uint8_t mux_id)
+{
+    if (mux_id >= ESP8266_MAX_LINKS) {
+        return 0;
+    }
+    return m_link[mux_id].overflowCount();
+}
+
+uint16_t ESP8266::getRxHighWaterMark(void)
+{
+    return m_rx.highWaterMark();
+}
+
+uint32_t ESP8266::getRxOverflowCount(void)
+{
+    return m_rx_fills;
+}
+
+void ESP8266::resetRxStats(void)
+{
+    m_rx.resetStats();
+    m_rx_fills = 0;
+}
+
+#if ESP8266_STATS
+/* The names of ESP8266Cmd, one after another */
+static const char cmd_names[] PROGMEM = 
+    "AT\0RST\0GMR\0CWMODE\0CWJAP\0CWLAP\0CWLAPOPT\0CWQAP\0CWSAP\0CWLIF\0CIPSTATUS\0CIPDOMAIN\0"
+    "CIPSTART\0CIPSEND\0CIPSEND data\0CIPCLOSE\0CIFSR\0CIPMUX\0CIPSERVER\0CIPSTO\0CIPMODE\0UART_CUR";
+
+void ESP8266::getStats(ESP8266Stats &stats)
+{
+    uint8_t i;
+
+    stats = m_stats;
+    stats.tx = m_stats_uart.tx();
+    stats.rx = m_stats_uart.rx();
+    stats.rx_overflows = m_rx_fills;
+    stats.link_drops = 0;
+    for (i = 0; i < ESP8266_MAX_LINKS; i++) {
+        stats.link_drops += m_link[i].overflowCount();
+    }
+}
+
+void ESP8266::resetStats(void)
+{
+    uint8_t i;
+
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_stats_uart.reset();
+    resetRxStats();
+    for (i = 0; i < ESP8266_MAX_LINKS; i++) {
+        m_link[i].resetStats();
+    }
+    m_stats_cmd = -1;
+}
+
+const __FlashStringHelper *ESP8266::getCmdName(ESP8266Cmd cmd)
+{
+    PGM_P name = cmd_names;
+    uint8_t i;
+
+    if (cmd >= ESP8266_CMD_COUNT) {
+        return NULL;
+    }
+    for (i = 0; i < cmd; i++) {
+        name += strlen_P(name) + 1;
+    }
+    return (const __FlashStringHelper *)name;
+}
+
+void ESP8266::stats_begin(ESP8266Cmd cmd)
+{
+    m_stats_cmd = cmd;
+    m_stats_start = millis();
+    m_stats_tx = m_stats_uart.tx();
+    m_stats_rx = m_stats_uart.rx();
+}
+
+void ESP8266::stats_finish(ESP8266Status status)
+{
+    ESP8266CmdStats *stats;
+    uint32_t ms;
+
+    if (m_stats_cmd < 0) {
+        /* Not started by cmd_begin() */
+        return;
+    }
+    stats = &m_stats.cmd[m_stats_cmd];
+    m_stats_cmd = -1;
+    ms = millis() - m_stats_start;
+
+    stats->calls++;
+    if (status == ESP8266_OK) {
+        stats->ok++;
+    } else if (status == ESP8266_TIMEOUT) {
+        stats->timeouts++;
+    } else {
+        stats->errors++;
+    }
+    stats->time += ms;
+    stats->latency[ESP8266StatsBucket(ms)]++;
+    stats->tx += m_stats_uart.tx() - m_stats_tx;
+    stats->rx += m_stats_uart.rx() - m_stats_rx;
+}
+#endif /* #if ESP8266_STATS */
+
+#if ESP8266_TRACE_SIZE
+void ESP8266::dumpTrace(Print &out)
+{
+    uint16_t i;
+    bool bol = true;
+
+    for (i = 0; i < m_trace_uart.count(); i++) {
+        const ESP8266TraceEntry &e = m_trace_uart.entry(i);
+
+        if (i > 0 && e.tx != m_trace_uart.entry(i - 1).tx && !bol) {
+            out.println();
+            bol = true;
+        }
+        if (bol) {
+            out.print(e.time);
+            out.print(e.tx ? F(" > ") : F(" < "));
+            bol = false;
+        }
+        if (e.c == '\r') {
+            out.print(F("\\r"));
+        } else if (e.c == '\n') {
+            out.println(F("\\n"));
+            bol = true;
+        } else if (e.c >= ' ' && e.c < 0x7F) {
+            out.print((char)e.c);
+        } else {
+            out.print(F("\\x"));
+            if (e.c < 0x10) {
+                out.print('0');
+            }
+            out.print(e.c, HEX);
+        }
+    }
+    if (!bol) {
+        out.println();
+    }
+}
+
+void ESP8266::clearTrace(void)
+{
+    m_trace_uart.clear();
+}
+#endif /* #if ESP8266_TRACE_SIZE */
+
+/*----------------------------------------------------------------------------*/
+/* +IPD,<id>,<len>:<data> */
+/* +IPD,<len>:<data> */
+
+uint32_t ESP8266::recvPkg(int8_t mux_id, uint8_t *buffer, uint32_t buffer_size, uint32_t timeout, uint8_t *coming_mux_id)
+{
+    int8_t link = -1;
+    uint32_t i = 0;
     unsigned long start;
-    uint32_t timeout = 10000;
-    uint8_t *coming_mux_id = NULL;
-    uint8_t *data_len = NULL;
+    uint8_t k, n;
     
-    if (buffer == NULL) {
+    if (buffer == NULL || mux_id < -1 || mux_id >= ESP8266_MAX_LINKS) {
         return 0;
     }
     
     start = millis();
+    while (link == -1) {
+        if (mux_id != -1) {
+            if (m_link[mux_id].available() > 0) {
+                link = mux_id;
+            }
+        } else {
+            for (n = 0, k = m_link_next; n < ESP8266_MAX_LINKS; n++, k = (k + 1) % ESP8266_MAX_LINKS) {
+                if (m_link[k].available() > 0) {
+                    link = k;
+                    m_link_next = (k + 1) % ESP8266_MAX_LINKS;
+                    break;
+                }
+            }
+        }
+        if (link == -1) {
+            if (millis() - start >= timeout) {
+                return 0;
+            }
+            rx_process(mux_id == -1 ? HOLD_ALL : mux_id);
+        }
+    }
     
+    /* Read until buffer is full or the package being received is over */
+    start = millis();
+    while (i < buffer_size && millis() - start < 3000) {
+        if (buffer_size - i < m_link[link].available()) {
+            i += m_link[link].read(buffer + i, buffer_size - i);
+        } else {
+            i += m_link[link].read(buffer + i, m_link[link].available());
+        }
+        if (m_link[link].available() == 0 && !(m_ipd_remain > 0 && m_ipd_link == link)) {
+            break;
+        }
+        rx_process(mux_id == -1 ? HOLD_ALL : link);
+    }
+    if (coming_mux_id) {
+        *coming_mux_id = link;
+    }
+    return i;
+}
+
+/*
+* Written by Etienne to parse out unwanted text when receiving an email
+*
+* All I want is the sender and the email body.
+*/
+/* Fills the buffers of sendAndReceiveEmail(): From, Subject and the first body */
+class EmailBuffers : public ESP8266MailSink {
+ public:
+    EmailBuffers(char *contents[], size_t sizes[]): m_contents(contents), m_sizes(sizes), m_len(0), m_part(-1), m_ok(false)
+    {
+        for (uint8_t i = 0; i < 3; i++) {
+            if (m_sizes[i] > 0) {
+                m_contents[i][0] = '\0';
+            }
+        }
+    }
+
+    virtual void header(uint8_t part, const char *name, const char *value)
+    {
+        if (part != 0) {
+            return;
+        }
+        if (strcasecmp(name, "From") == 0) {
+            copy(0, value);
+        } else if (strcasecmp(name, "Subject") == 0) {
+            copy(1, value);
+        }
+    }
+
+    virtual void body(uint8_t part, const uint8_t *data, uint16_t len)
+    {
+        /* Only the first part with a body, the plain text in most mails */
+        if (m_part < 0) {
+            m_part = part;
+        }
+        if (part != m_part || m_sizes[2] == 0) {
+            return;
+        }
+        for (; len > 0; data++, len--) {
+            if (*data != '\r' && m_len + 1 < m_sizes[2]) {
+                m_contents[2][m_len++] = *data;
+            }
+        }
+        m_contents[2][m_len] = '\0';
+    }
+
+    virtual void end(bool ok)
+    {
+        m_ok = ok;
+    }
+
+    bool ok(void) const { return m_ok; }
+
+ private:
+    void copy(uint8_t i, const char *value)
+    {
+        if (m_sizes[i] > 0) {
+            strncpy(m_contents[i], value, m_sizes[i] - 1);
+            m_contents[i][m_sizes[i] - 1] = '\0';
+        }
+    }
+
+    char **m_contents;
+    size_t *m_sizes;
+    size_t m_len;
+    int16_t m_part;
+    bool m_ok;
+};
+
+uint32_t ESP8266::sendAndReceiveEmail(char* email_contents[], size_t content_sizes[], const ESP8266Segment &message)
+{
+    ESP8266MailParser parser;
+    EmailBuffers buffers(email_contents, content_sizes);
+    uint8_t chunk[16];
+    uint16_t n;
+    unsigned long start;
+    uint32_t timeout = 10000;
+
+    // send command to retrieve email
+    sATCIPSENDSingleNoRcv(&message, 1);
+
+    logDebug("receiving email");
+
+    // the data may come in several +IPD, it ends with the "." line
+    parser.begin(buffers);
+    start = millis();
+    while (!parser.done() && millis() - start < timeout) {
+        rx_process(ESP8266_SINGLE_LINK);
+        n = m_link[ESP8266_SINGLE_LINK].read(chunk, sizeof(chunk));
+        if (n > 0) {
+            parser.feed(chunk, n);
+            start = millis();
+        }
+    }
+
+    return buffers.ok() ? 1 : 0;
+}
+
+uint16_t ESP8266::rx_available(void)
+{
+    rx_fill();
+    return m_rx.available();
+}
+
+void ESP8266::rx_empty(void)
+{
+    rx_process(HOLD_NONE);
+    /* What is left of a line now is a stale response */
+    m_line_len = 0;
+    m_line_long = false;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Unsolicited result codes and +IPD */
+
+void ESP8266::rx_process(int8_t hold)
+{
+    ESP8266RingBuffer<ESP8266_LINK_BUFFER_SIZE> *queue;
+
+    while (rx_available() > 0) {
+        if (m_passthrough) {
+            /* Nothing but data, so never drop it */
+            queue = &m_link[ESP8266_SINGLE_LINK];
+            if (queue->space() == 0) {
+                return;
+            }
+            queue->write(m_rx.read());
+            continue;
+        }
+        if (m_ipd_remain == 0) {
+            rx_byte(m_rx.read());
+            continue;
+        }
+
+        /* Data of +IPD goes to the queue of its link */
+        queue = &m_link[m_ipd_link];
+        if (queue->space() == 0 && !m_cmd_handle && (hold == HOLD_ALL || hold == m_ipd_link)) {
+            /* Leave it until the reader has made room */
+            return;
+        }
+        /* Dropped if still full, counted in getLinkDropCount() */
+        queue->write(m_rx.read());
+        if (--m_ipd_remain == 0) {
+            m_ipd_link = -1;
+        }
+    }
+}
+
+void ESP8266::passthrough_guard(void)
+{
+    while (millis() - m_passthrough_tx < ESP8266_PASSTHROUGH_GUARD_TIME) {
+        rx_process(HOLD_NONE);
+    }
+}
+
+void ESP8266::rx_byte(char c)
+{
+    if (c == '\0') {
+        return;
+    }
+
+    if (c == '+') {
+        /* "+IPD," may start here */
+        m_line_ipd = m_line_len;
+    }
+    if (m_ipd.feed(c)) {
+        /* Anything before "+IPD," on this line is still a response */
+        line_flush(m_line_ipd < m_line_len ? m_line_ipd : m_line_len);
+        m_line_len = 0;
+        m_line_long = false;
+        m_ipd_link = m_ipd.id() == -1 ? ESP8266_SINGLE_LINK : m_ipd.id();
+        m_ipd_remain = m_ipd.length();
+        return;
+    }
+
+    if (c == '>' && m_line_len == 0 && !m_line_long) {
+        /* The prompt of AT+CIPSEND comes without line end */
+        cmd_feed(c);
+        return;
+    }
+
+    if (m_line_long) {
+        cmd_feed(c);
+    } else if (m_line_len < ESP8266_LINE_SIZE) {
+        m_line[m_line_len++] = c;
+    } else {
+        /* Too long for an unsolicited result code, pass it on as it comes */
+        line_flush(m_line_len);
+        m_line_len = 0;
+        m_line_long = true;
+        cmd_feed(c);
+    }
+
+    if (c == '\n') {
+        if (m_line_long || !line_event()) {
+            line_flush(m_line_len);
+        }
+        m_line_len = 0;
+        m_line_long = false;
+    }
+}
+
+void ESP8266::line_flush(uint8_t len)
+{
+    for (uint8_t i = 0; i < len; i++) {
+        cmd_feed(m_line[i]);
+    }
+}
+
+static bool line_is(const char *line, uint8_t len, const char *text)
+{
+    return len == strlen(text) && memcmp(line, text, len) == 0;
+}
+
+bool ESP8266::line_event(void)
+{
+    const char *line = m_line;
+    uint8_t len = m_line_len;
+    uint8_t link = ESP8266_SINGLE_LINK;
+
+    while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == '\n')) {
+        len--;
+    }
+
+    /* <id>,CONNECT and <id>,CLOSED in multiple mode */
+    if (len > 2 && line[0] >= '0' && line[0] < '0' + ESP8266_MAX_LINKS && line[1] == ',') {
+        link = line[0] - '0';
+        line += 2;
+        len -= 2;
+    }
+    if (line_is(line, len, "CONNECT")) {
+        /* Whatever is left belongs to the previous connection */
+        m_link[link].resetStats();
+        m_link[link].discard();
+        if (m_link_pending != link || m_link_closing) {
+            /* Accepted by the server */
+            memset(&m_link_info[link], 0, sizeof(m_link_info[link]));
+            m_link_info[link].server = true;
+            m_link_info[link].local_port = m_server_port;
+        }
+        m_link_info[link].state = ESP8266_LINK_CONNECTED;
+        raise(ESP8266_EVENT_CONNECT, link);
+    } else if (line_is(line, len, "CLOSED")) {
+        m_link_info[link].state = ESP8266_LINK_CLOSED;
+        raise(ESP8266_EVENT_CLOSED, link);
+    } else if (line != m_line) {
+        return false;
+    } else if (line_is(line, len, "WIFI CONNECTED")) {
+        raise(ESP8266_EVENT_WIFI_CONNECTED, 0);
+    } else if (line_is(line, len, "WIFI GOT IP")) {
+        raise(ESP8266_EVENT_WIFI_GOT_IP, 0);
+    } else if (line_is(line, len, "WIFI DISCONNECT")) {
+        raise(ESP8266_EVENT_WIFI_DISCONNECT, 0);
+    } else if (len >= 5 && memcmp(line, "busy ", 5) == 0) {
+        raise(ESP8266_EVENT_BUSY, 0);
+    } else if (line_is(line, len, "ready")) {
+        m_ready = true;
+        raise(ESP8266_EVENT_READY, 0);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void ESP8266::raise(ESP8266Event event, uint8_t mux_id)
+{
+    if (m_event_handler) {
+        m_event_handler(event, mux_id, m_event_arg);
+    }
+}
+
+void ESP8266::setEventHandler(ESP8266EventHandler handler, void *arg)
+{
+    m_event_handler = handler;
+    m_event_arg = arg;
+}
+
+/*----------------------------------------------------------------------------*/
+
+int8_t ESP8266::recvString(ESP8266Matcher &matcher, String *data, uint32_t timeout)
+{
+    ESP8266RingBuffer<ESP8266_LINK_BUFFER_SIZE> &queue = m_link[ESP8266_SINGLE_LINK];
+    char a;
+    int8_t found;
+    unsigned long start = millis();
     while (millis() - start < timeout) {
-        if(m_puart->available() > 0) {
-            a = m_puart->read();
-            data += a;
-        }
-        
-        index_PIPDcomma = data.indexOf("+IPD,");
-        if (index_PIPDcomma != -1) {
-            index_colon = data.indexOf(':', index_PIPDcomma + 5);
-            if (index_colon != -1) {
-                index_comma = data.indexOf(',', index_PIPDcomma + 5);
-                /* +IPD,id,len:data */
-                if (index_comma != -1 && index_comma < index_colon) { 
-                    id = data.substring(index_PIPDcomma + 5, index_comma).toInt();
-                    if (id < 0 || id > 4) {
-                        return 0;
-                    }
-                    len = data.substring(index_comma + 1, index_colon).toInt();
-                    if (len <= 0) {
-                        return 0;
-                    }
-                } else { /* +IPD,len:data */
-                    len = data.substring(index_PIPDcomma + 5, index_colon).toInt();
-                    if (len <= 0) {
-                        return 0;
-                    }
-                }
-                has_data = true;
+        rx_process(ESP8266_SINGLE_LINK);
+        while(queue.available() > 0) {
+            a = queue.read();
+			if(a == '\0') continue;
+            if (data) {
+                *data += a;
+            }
+            found = matcher.feed(a);
+            if (found != -1) {
+                return found;
+            }
+        }
+    }
+    return -1;
+}
+
+bool ESP8266::recvFind(const char *target, uint32_t timeout)
+{
+    ESP8266Matcher matcher;
+    matcher.begin(target);
+    if (recvString(matcher, NULL, timeout) == -1) {
+#if ESP8266_STATS
+        m_stats.find_timeouts++;
+#endif
+        return false;
+    }
+    return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Command executor */
+
+void ESP8266::cmd_write(uint8_t id, const CmdArg *args, uint8_t count)
+{
+    ESP8266CmdRow row;
+    uint8_t chunk[16];
+    uint8_t len = 0;
+    char c;
+
+    read_row(id, row);
+    cmd_begin((ESP8266Cmd)row.cmd);
+    for (const char *p = row.format; (c = pgm_read_byte(p)) != '\0'; p++) {
+        if (c != '%') {
+            chunk[len++] = c;
+            if (len == sizeof(chunk)) {
+                tx_data(chunk, len);
+                len = 0;
+            }
+            continue;
+        }
+        tx_data(chunk, len);
+        len = 0;
+        if (count == 0) {
+            continue;
+        }
+        if (args->text.data) {
+            tx_write(&args->text, 1);
+        } else {
+            m_puart->print(args->num);
+        }
+        args++;
+        count--;
+    }
+    tx_data(chunk, len);
+    m_puart->println();
+}
+
+ESP8266Handle ESP8266::cmd_exec(uint8_t id, const CmdArg *args, uint8_t count)
+{
+    ESP8266CmdRow row;
+
+    cmd_write(id, args, count);
+    read_row(id, row);
+    return cmd_expect(row.targets, row.count, row.ok_count, row.timeout);
+}
+
+ESP8266Handle ESP8266::cmd_send(uint8_t id, const CmdArg *args, uint8_t count, const ESP8266Segment *segments, uint8_t segments_count)
+{
+    ESP8266CmdRow row;
+
+    cmd_write(id, args, count);
+    read_row(id, row);
+    m_cmd_payload = segments;
+    m_cmd_payload_count = segments_count;
+    return cmd_expect(row.targets, row.count, row.ok_count, row.timeout);
+}
+
+bool ESP8266::cmd_query(uint8_t id, char *buffer, size_t size, const CmdArg *args, uint8_t count)
+{
+    ESP8266Handle handle = cmd_exec(id, args, count);
+    capture_begin(id, buffer, size);
+    return capture_end(wait(handle) == ESP8266_OK);
+}
+
+#if !ESP8266_NO_STRING
+bool ESP8266::cmd_query(uint8_t id, String &data)
+{
+    ESP8266Handle handle = cmd_exec(id);
+    data = "";
+    capture_begin(id, NULL, 0);
+    m_capture_data = &data;
+    return capture_end(wait(handle) == ESP8266_OK);
+}
+#endif
+
+/* m_capture_state once the whole filter has been seen */
+#define CAPTURE_ON  (0xFF)
+
+/* 
+ * How many chars of text(PROGMEM) are matched after c, q of them were before: 
+ * the longest prefix of text which ends text[0 .. q - 1] + c. 
+ */
+static uint8_t text_next(const char *text, uint8_t q, char c)
+{
+    uint8_t k, i;
+
+    for (k = q + 1; k > 0; k--) {
+        if ((char)pgm_read_byte(text + k - 1) != c) {
+            continue;
+        }
+        for (i = 0; i + 1 < k && pgm_read_byte(text + i) == pgm_read_byte(text + q + 1 - k + i); i++) {
+        }
+        if (i + 1 == k) {
+            return k;
+        }
+    }
+    return 0;
+}
+
+void ESP8266::capture_begin(uint8_t id, char *buffer, size_t size)
+{
+    ESP8266CmdRow row;
+
+    read_row(id, row);
+    m_capture_filter = row.filter;
+    m_capture_state = 0;
+    m_capture_tail = 0;
+    m_capture_buffer = buffer;
+    m_capture_size = size;
+    m_capture_len = 0;
+    m_capture_data = NULL;
+}
+
+void ESP8266::capture(char c)
+{
+    if (m_capture_state != CAPTURE_ON) {
+        m_capture_state = text_next(m_capture_filter, m_capture_state, c);
+        if (pgm_read_byte(m_capture_filter + m_capture_state) == '\0') {
+            m_capture_state = CAPTURE_ON;
+        }
+        return;
+    }
+
+    /* Where "\r\n\r\nOK" is, it is cut off at the end */
+    if (m_capture_tail == sizeof(q_end) - 1) {
+        m_capture_tail = 0;
+    }
+    m_capture_tail = text_next(q_end, m_capture_tail, c);
+#if !ESP8266_NO_STRING
+    if (m_capture_data) {
+        *m_capture_data += c;
+        return;
+    }
+#endif
+    if (m_capture_len + 1 < m_capture_size) {
+        m_capture_buffer[m_capture_len] = c;
+    }
+    m_capture_len++;
+}
+
+bool ESP8266::capture_end(bool ok)
+{
+    size_t len;
+
+    ok = ok && m_capture_state == CAPTURE_ON && m_capture_tail == sizeof(q_end) - 1;
+    m_capture_filter = NULL;
+#if !ESP8266_NO_STRING
+    if (m_capture_data) {
+        if (ok) {
+            m_capture_data->remove(m_capture_data->length() - (sizeof(q_end) - 1));
+        } else {
+            *m_capture_data = "";
+        }
+        m_capture_data = NULL;
+        return ok;
+    }
+#endif
+    if (m_capture_size == 0) {
+        return false;
+    }
+    len = ok ? m_capture_len - (sizeof(q_end) - 1) : 0;
+    if (len + 1 > m_capture_size) {
+        m_capture_buffer[m_capture_size - 1] = '\0';
+        return false;
+    }
+    m_capture_buffer[len] = '\0';
+    return ok;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Command engine */
+
+void ESP8266::cmd_begin(ESP8266Cmd cmd)
+{
+    /* Only the blocking API gets here with a command in flight */
+    while (m_cmd_handle) {
+        poll();
+    }
+    if (m_passthrough) {
+        /* The command would go out as data of the link */
+        logWarn("leaving passthrough for a command");
+        exitPassthrough();
+    }
+    rx_empty();
+    stats_begin(cmd);
+}
+
+void ESP8266::cmd_arm(uint8_t ok_count, uint32_t timeout)
+{
+    m_cmd_ok_count = ok_count;
+    m_cmd_timeout = timeout;
+    m_cmd_start = millis();
+}
+
+ESP8266Handle ESP8266::cmd_expect(const char * const targets[], uint8_t count, uint8_t ok_count, uint32_t timeout)
+{
+    m_cmd_matcher.begin_P(targets, count);
+    cmd_arm(ok_count, timeout);
+    if (++m_cmd_last == 0) {
+        m_cmd_last = 1;
+    }
+    m_cmd_handle = m_cmd_last;
+    m_cmd_notify = false;
+    return m_cmd_handle;
+}
+
+void ESP8266::tx_write(const ESP8266Segment *segments, uint8_t count)
+{
+    uint8_t chunk[16];
+    uint32_t done, n;
+
+    for (uint8_t i = 0; i < count; i++) {
+        if (!segments[i].progmem) {
+            tx_data(segments[i].data, segments[i].len);
+            continue;
+        }
+        for (done = 0; done < segments[i].len; done += n) {
+            n = segments[i].len - done;
+            if (n > sizeof(chunk)) {
+                n = sizeof(chunk);
+            }
+            memcpy_P(chunk, segments[i].data + done, n);
+            tx_data(chunk, n);
+        }
+    }
+}
+
+bool ESP8266::send_chunk(int8_t mux_id, uint32_t len, bool ex)
+{
+    CmdArg args[] = {(uint32_t)mux_id, len};
+
+    if (mux_id >= 0) {
+        return wait(cmd_exec(ex ? ROW_CIPSENDEX_MULTIPLE : ROW_CIPSEND_MULTIPLE, args, 2)) == ESP8266_OK;
+    }
+    return wait(cmd_exec(ex ? ROW_CIPSENDEX_SINGLE : ROW_CIPSEND_SINGLE, args + 1, 1)) == ESP8266_OK;
+}
+
+bool ESP8266::send_stream(int8_t mux_id, ESP8266Producer producer, void *arg, uint32_t total, uint32_t *sent)
+{
+    uint8_t buffer[ESP8266_SEND_BUFFER_SIZE];
+    uint32_t done = 0;
+    uint32_t len, n, got;
+    bool ok = true;
+
+    if (total == 0) {
+        return send_stream_ex(mux_id, producer, arg, sent);
+    }
+    if (sent) {
+        *sent = 0;
+    }
+    while (ok && done < total) {
+        len = total - done;
+        if (len > ESP8266_SEND_CHUNK_SIZE) {
+            len = ESP8266_SEND_CHUNK_SIZE;
+        }
+        if (!send_chunk(mux_id, len)) {
+            return false;
+        }
+        stats_begin(ESP8266_CMD_CIPSEND_DATA);
+        for (got = 0; got < len; got += n) {
+            n = len - got;
+            if (n > sizeof(buffer)) {
+                n = sizeof(buffer);
+            }
+            n = producer(buffer, n, arg);
+            if (n == 0) {
                 break;
             }
+            tx_data(buffer, n);
+        }
+        if (got < len) {
+            /* ESP8266 waits for all it was told, pad it and give up */
+            ok = false;
+            memset(buffer, 0, sizeof(buffer));
+            for (n = got; n < len; n += sizeof(buffer)) {
+                tx_data(buffer, len - n < sizeof(buffer) ? len - n : sizeof(buffer));
+            }
+        }
+        if (wait(cmd_expect(send_result, 3, 1, 10000)) != ESP8266_OK) {
+            return false;
+        }
+        done += got;
+        if (sent) {
+            *sent = done;
+        }
+    }
+    return ok;
+}
+
+bool ESP8266::send_stream_ex(int8_t mux_id, ESP8266Producer producer, void *arg, uint32_t *sent)
+{
+    uint8_t buffer[ESP8266_SEND_BUFFER_SIZE];
+    uint32_t done = 0, got = 0;
+    uint32_t len = 0, pos = 0, n;
+    bool more = true, open = false;
+
+    if (sent) {
+        *sent = 0;
+    }
+    for (;;) {
+        if (pos == len) {
+            len = more ? producer(buffer, sizeof(buffer), arg) : 0;
+            pos = 0;
+            more = (len > 0);
+        }
+        if (open && (pos == len || buffer[pos] == '\\' || got == ESP8266_SEND_CHUNK_SIZE - 4)) {
+            /* "\0" sends what came so far */
+            tx_data((const uint8_t *)"\\0", 2);
+            open = false;
+            if (wait(cmd_expect(send_result, 3, 1, 10000)) != ESP8266_OK) {
+                return false;
+            }
+            done += got;
+            if (sent) {
+                *sent = done;
+            }
+        }
+        if (pos == len) {
+            return true;
+        }
+
+        if (buffer[pos] == '\\') {
+            /* From the backslash on, up to a buffer of data goes by its length */
+            memmove(buffer, buffer + pos, len - pos);
+            len -= pos;
+            pos = 0;
+            while (more && len < sizeof(buffer)) {
+                n = producer(buffer + len, sizeof(buffer) - len, arg);
+                more = (n > 0);
+                len += n;
+            }
+            if (!send_chunk(mux_id, len)) {
+                return false;
+            }
+            stats_begin(ESP8266_CMD_CIPSEND_DATA);
+            tx_data(buffer, len);
+            if (wait(cmd_expect(send_result, 3, 1, 10000)) != ESP8266_OK) {
+                return false;
+            }
+            done += len;
+            if (sent) {
+                *sent = done;
+            }
+            pos = len;
+            continue;
         }
-    }
 
-    bool haveCR = false;
-    bool haveCRLF = false;
-    bool inBody = false;
+        if (!open) {
+            if (!send_chunk(mux_id, ESP8266_SEND_CHUNK_SIZE, true)) {
+                return false;
+            }
+            stats_begin(ESP8266_CMD_CIPSEND_DATA);
+            open = true;
+            got = 0;
+        }
+        n = pos;
+        while (n < len && buffer[n] != '\\' && got + (n - pos) < ESP8266_SEND_CHUNK_SIZE - 4) {
+            n++;
+        }
+        tx_data(buffer + pos, n - pos);
+        got += n - pos;
+        pos = n;
+    }
+}
 
-    uint8_t email_body_size = content_sizes[2] - 1;
+ESP8266Handle ESP8266::cmd_notify(ESP8266Handle handle)
+{
+    m_cmd_notify = (handle != 0);
+    return handle;
+}
 
-    // incrementor for putting characters in buffers 
-    uint32_t i;
+void ESP8266::cmd_feed(char c)
+{
+    int8_t found;
 
-    data = "";
+    if (!m_cmd_handle) {
+        return;
+    }
+    if (m_capture_filter) {
+        capture(c);
+    }
+    if (m_ap_parser && m_ap_parser->feed(c) && m_ap_handler) {
+        m_ap_handler(m_ap_parser->ap(), m_ap_arg);
+    }
+    if (m_link_parser && m_link_parser->feed(c) && m_link_parser->id() < ESP8266_MAX_LINKS) {
+        m_link_info[m_link_parser->id()] = m_link_parser->info();
+        m_link_seen |= 1 << m_link_parser->id();
+    }
+    found = m_cmd_matcher.feed(c);
+    if (found != -1) {
+        cmd_found(found);
+    }
+}
 
-    Serial.println("ESP8266:: receiving email");
+void ESP8266::cmd_found(int8_t found)
+{
+    if (m_cmd_payload && found == 0) {
+        /* Got ">", now the data and then wait for the result */
+        tx_write(m_cmd_payload, m_cmd_payload_count);
+        m_cmd_payload = NULL;
+        m_cmd_matcher.begin_P(send_result, 3);
+        cmd_arm(1, 10000);
+        return;
+    }
+    cmd_finish(found < m_cmd_ok_count ? ESP8266_OK : ESP8266_ERROR);
+}
 
-    if (has_data) {
-        i = 0;
+void ESP8266::cmd_finish(ESP8266Status status)
+{
+    ESP8266Handle handle = m_cmd_handle;
+    bool notify = m_cmd_notify;
 
-        // The send command has been successfull
-        // Now we can wait for the email message to come in.
+    m_cmd_done = handle;
+    m_cmd_result = status;
+    m_cmd_handle = 0;
+    m_cmd_payload = NULL;
+    m_cmd_notify = false;
+    stats_finish(status);
+    if (m_link_pending >= 0) {
+        link_result(status);
+    }
+    if (status == ESP8266_TIMEOUT) {
+        /* Runs from poll(), so no printing above debug; stats and trace have it */
+        logDebug("timeout");
+    }
+    if (status == ESP8266_TIMEOUT && m_baud_errors < 255) {
+        m_baud_errors++;
+    }
+    if (m_passthrough_prompt) {
+        /* The bytes right after ">" are already data */
+        m_passthrough_prompt = false;
+        m_passthrough = (status == ESP8266_OK);
+        m_passthrough_tx = millis();
+        m_line_len = 0;
+        m_line_long = false;
+    }
+    /* Called from poll(), not from the middle of rx_process() */
+    m_cmd_notify_pending = notify;
+}
 
-        // ret = len > bufferBody_size ? bufferBody_size : len;
-        start = millis();
-        while (millis() - start < 5000) {
-            while( m_puart->available() ) {
-                // wait and see if what we read is a /n
-                a = m_puart->read();
-
-                // looks for CRLF string (which terminates the header field)
-                if (a == '\r') {
-                    haveCR = true;
-                } else if (a == '\n') {
-                    if (haveCR) haveCRLF = true;
-                } else {
-                    haveCR = false;
-                    haveCRLF = false;
-
-                    if (inBody) {
-
-                        // we know we are in the body, so no need to save data to string, 
-                        email_contents[2][i++] = a;
-                        // stop if the email body buffer is full!
-                        if ( i >= email_body_size) {
-
-                            break;
-                        }
-
-                    } else {
-                       //save character to the String
-                        data += a;
-                    }
-                    
-                }
+/* Parse a dotted IP address, false for a host name */
+static bool parse_ip(const ESP8266Segment &addr, uint8_t *ip)
+{
+    uint8_t octet = 0;
+    uint16_t num = 0;
+    uint8_t digits = 0;
+    uint32_t i;
+    char c;
+
+    for (i = 0; i < addr.len; i++) {
+        c = addr.progmem ? pgm_read_byte(addr.data + i) : addr.data[i];
+        if (c >= '0' && c <= '9' && digits < 3) {
+            num = num * 10 + (c - '0');
+            digits++;
+        } else if (c == '.' && digits > 0 && octet < 3 && num < 256) {
+            ip[octet++] = num;
+            num = 0;
+            digits = 0;
+        } else {
+            return false;
+        }
+    }
+    if (octet != 3 || digits == 0 || num > 255) {
+        return false;
+    }
+    ip[3] = num;
+    return true;
+}
 
-                if (haveCRLF) {
-                    // we have a full header, parse it for necessary variables
-                    //Serial.println("------------");
-                    if (data == "" && !inBody) {
-                        inBody = true;
-                    } else if ( data.startsWith("From: ")) {
+void ESP8266::link_open(uint8_t mux_id, const char *type, const ESP8266Segment &addr, uint32_t port)
+{
+    ESP8266LinkInfo *info;
 
-                        // Serial.println("From:");
-                        data.substring(6).toCharArray(email_contents[0], 128);
+    if (mux_id >= ESP8266_MAX_LINKS) {
+        return;
+    }
+    info = &m_link_info[mux_id];
+    if (info->state == ESP8266_LINK_CONNECTED) {
+        /* "ALREADY CONNECT", the link stays as it is */
+        return;
+    }
+    memset(info, 0, sizeof(*info));
+    info->state = ESP8266_LINK_CONNECTING;
+    info->type = (type[0] == 'U') ? ESP8266_LINK_UDP : (type[0] == 'S') ? ESP8266_LINK_SSL : ESP8266_LINK_TCP;
+    info->remote_port = port;
+    if (!parse_ip(addr, info->ip)) {
+        memset(info->ip, 0, sizeof(info->ip));
+    }
+    m_link_pending = mux_id;
+    m_link_closing = false;
+}
 
-                    } else if ( data.startsWith("Subject: ")) {
+void ESP8266::link_close(uint8_t mux_id)
+{
+    if (mux_id < ESP8266_MAX_LINKS) {
+        m_link_pending = mux_id;
+        m_link_closing = true;
+    }
+}
 
-                        // Serial.println("Subject:");
-                        data.substring(9).toCharArray(email_contents[1], 128);
+void ESP8266::link_result(ESP8266Status status)
+{
+    ESP8266LinkInfo &info = m_link_info[m_link_pending];
 
-                    }
-                    
-                    // reset our variables
-                    data = "";
-                    haveCRLF = false;
-                }
-            }
+    m_link_pending = -1;
+    if (m_link_closing) {
+        /* "link is not" counts as OK */
+        if (status == ESP8266_OK) {
+            info.state = ESP8266_LINK_CLOSED;
         }
-        // if we get here then we have finished waiting
-
-        // no more data available
-        // make sure we terminate the body string
-        // use i-1 to lose trailing 'period' character that gmail
-        // places on end of email body
-        email_contents[2][i-1] = '\0';
-        return 1;
+    } else if (status == ESP8266_OK) {
+        info.state = ESP8266_LINK_CONNECTED;
+    } else if (info.state == ESP8266_LINK_CONNECTING) {
+        info.state = ESP8266_LINK_CLOSED;
+        /* The host may have moved */
+        dns_forget(info.ip);
     }
+}
 
-    return 0;
+void ESP8266::links_clear(void)
+{
+    memset(m_link_info, 0, sizeof(m_link_info));
+    m_link_pending = -1;
+    m_link_closing = false;
+    m_server_port = 0;
 }
 
-void ESP8266::rx_empty(void)
+uint32_t ESP8266Hash(const ESP8266Segment &segment)
 {
-    while(m_puart->available() > 0) {
-        char( m_puart->read() ) ;
+    uint32_t h = 2166136261UL;
+    uint32_t i;
+
+    for (i = 0; i < segment.len; i++) {
+        h ^= segment.progmem ? pgm_read_byte(segment.data + i) : segment.data[i];
+        h *= 16777619UL;
     }
+    return h ? h : 1;
 }
 
-String ESP8266::recvString(String target, uint32_t timeout)
+ESP8266HostKey::ESP8266HostKey(const ESP8266Segment &host): 
+    hash(ESP8266Hash(host)), check(0), len(host.len)
 {
+    uint32_t i;
 
-    String data;
-    char a;
-    unsigned long start = millis();
-    //Serial.print(F("___________looking for: "));
-    //Serial.print( target );
-    //Serial.println(F(" ___________"));
-    while (millis() - start < timeout) {
+    for (i = 0; i < host.len; i++) {
+        check = (host.progmem ? pgm_read_byte(host.data + i) : host.data[i])
+            + (check << 6) + (check << 16) - check;
+    }
+}
 
-        while(m_puart->available() ) {
+bool ESP8266::resolveHost(const ESP8266Segment &host, uint8_t *ip)
+{
+    CmdArg args[] = {host};
+    char answer[20];
+    char *p = answer;
+    size_t len;
+#if ESP8266_DNS_CACHE_SIZE
+    ESP8266HostKey key(host);
+    DNSEntry *entry = &m_dns[0];
+    uint8_t i;
+#endif
 
-            a = m_puart->read();
-            // UNcomment this line to debug
-            // Serial.print(a);
-			if(a == '\0') continue;
-            data += a;
+    if (parse_ip(host, ip)) {
+        return true;
+    }
+#if ESP8266_DNS_CACHE_SIZE
+    for (i = 0; i < ESP8266_DNS_CACHE_SIZE; i++) {
+        if (m_dns[i].key.len && millis() - m_dns[i].time >= ESP8266_DNS_TTL) {
+            m_dns[i].key = ESP8266HostKey();
         }
-        if (data.indexOf(target) != -1) {
-            break;
-        }   
+        if (m_dns[i].key == key) {
+            memcpy(ip, m_dns[i].ip, 4);
+            return true;
+        }
+        /* Otherwise a free entry, or the one resolved longest ago */
+        if (entry->key.len && (!m_dns[i].key.len || (long)(m_dns[i].time - entry->time) < 0)) {
+            entry = &m_dns[i];
+        }
+    }
+#endif
+
+    if (!cmd_query(ROW_CIPDOMAIN, answer, sizeof(answer), args, 1)) {
+        logWarn("cannot resolve host");
+        return false;
     }
-    //Serial.println(F("_________________________________"));
-    return data;
+    /* Newer firmware quotes the address */
+    len = strlen(answer);
+    if (len >= 2 && answer[0] == '"' && answer[len - 1] == '"') {
+        p++;
+        len -= 2;
+    }
+    if (!parse_ip(ESP8266Segment((const uint8_t *)p, len), ip)) {
+        return false;
+    }
+#if ESP8266_DNS_CACHE_SIZE
+    entry->key = key;
+    memcpy(entry->ip, ip, 4);
+    entry->time = millis();
+#endif
+    return true;
 }
 
-String ESP8266::recvString(String target1, String target2, uint32_t timeout)
+void ESP8266::clearDNSCache(void)
 {
-    String data;
-    char a;
-    unsigned long start = millis();
-    while (millis() - start < timeout) {
-        while(m_puart->available() > 0) {
-            a = m_puart->read();
-            // UNcomment these lines to debug
-            // Serial.print(a);
-            // Serial.print(".");
-			if(a == '\0') continue;
-            data += a;
-        }
-        if (data.indexOf(target1) != -1) {
-            break;
-        } else if (data.indexOf(target2) != -1) {
-            break;
-        }
+#if ESP8266_DNS_CACHE_SIZE
+    uint8_t i;
+
+    for (i = 0; i < ESP8266_DNS_CACHE_SIZE; i++) {
+        m_dns[i].key = ESP8266HostKey();
     }
-    return data;
+#endif
 }
 
-String ESP8266::recvString(String target1, String target2, String target3, uint32_t timeout)
+void ESP8266::dns_resolve(const ESP8266Segment &addr)
 {
-    String data;
-    char a;
-    unsigned long start = millis();
-    while (millis() - start < timeout) {
-        while(m_puart->available() > 0) {
-            a = m_puart->read();
-            // Serial.print(a);
-            // Serial.print(".");
-			if(a == '\0') continue;
-            data += a;
+#if ESP8266_DNS_CACHE_SIZE
+    uint8_t ip[4];
+
+    /* On failure, AT+CIPSTART is given the name and resolves it itself */
+    resolveHost(addr, ip);
+#else
+    (void)addr;
+#endif
+}
+
+ESP8266Segment ESP8266::dns_addr(const ESP8266Segment &addr, char *ip)
+{
+#if ESP8266_DNS_CACHE_SIZE
+    ESP8266HostKey key;
+    uint8_t i, k;
+    char *p = ip;
+
+    if (parse_ip(addr, (uint8_t *)ip)) {
+        return addr;
+    }
+    key = ESP8266HostKey(addr);
+    for (i = 0; i < ESP8266_DNS_CACHE_SIZE; i++) {
+        if (m_dns[i].key != key || millis() - m_dns[i].time >= ESP8266_DNS_TTL) {
+            continue;
         }
-        if (data.indexOf(target1) != -1) {
-            break;
-        } else if (data.indexOf(target2) != -1) {
-            break;
-        } else if (data.indexOf(target3) != -1) {
-            break;
+        for (k = 0; k < 4; k++) {
+            if (k > 0) {
+                *p++ = '.';
+            }
+            if (m_dns[i].ip[k] >= 100) {
+                *p++ = '0' + m_dns[i].ip[k] / 100;
+            }
+            if (m_dns[i].ip[k] >= 10) {
+                *p++ = '0' + m_dns[i].ip[k] / 10 % 10;
+            }
+            *p++ = '0' + m_dns[i].ip[k] % 10;
         }
+        *p = '\0';
+        return ESP8266Segment(ip);
     }
-    return data;
+#else
+    (void)ip;
+#endif
+    return addr;
 }
 
-bool ESP8266::recvFind(String target, uint32_t timeout)
+void ESP8266::dns_forget(const uint8_t *ip)
 {
-    String data_tmp;
-    data_tmp = recvString(target, timeout);
-    //Serial.println("////////");
-    // Serial.println(data_tmp);
-    //Serial.println("////////");
-    if (data_tmp.indexOf(target) != -1) {
-        return true;
+#if ESP8266_DNS_CACHE_SIZE
+    uint8_t i;
+
+    for (i = 0; i < ESP8266_DNS_CACHE_SIZE; i++) {
+        if (m_dns[i].key.len && memcmp(m_dns[i].ip, ip, 4) == 0) {
+            m_dns[i].key = ESP8266HostKey();
+        }
     }
-    return false;
+#else
+    (void)ip;
+#endif
 }
 
-bool ESP8266::recvFindAndFilter(String target, String begin, String end, String &data, uint32_t timeout)
+bool ESP8266::poll(void)
 {
+    rx_process(HOLD_NONE);
+    if (m_cmd_handle && millis() - m_cmd_start >= m_cmd_timeout) {
+        cmd_finish(ESP8266_TIMEOUT);
+    }
+    if (m_cmd_notify_pending) {
+        m_cmd_notify_pending = false;
+        if (m_callback) {
+            m_callback(m_cmd_done, m_cmd_result, m_callback_arg);
+        }
+    }
+    return m_cmd_handle != 0;
+}
 
-    String data_tmp;
-    data_tmp = recvString(target, timeout);
-    if (data_tmp.indexOf(target) != -1) {
-        int32_t index1 = data_tmp.indexOf(begin);
-        int32_t index2 = data_tmp.indexOf(end);
-        if (index1 != -1 && index2 != -1) {
-            index1 += begin.length();
-            data = data_tmp.substring(index1, index2);
+bool ESP8266::busy(void)
+{
+    return m_cmd_handle != 0 || m_passthrough;
+}
 
-            return true;
+ESP8266Status ESP8266::status(ESP8266Handle handle)
+{
+    if (handle != 0) {
+        if (handle == m_cmd_handle) {
+            return ESP8266_PENDING;
+        }
+        if (handle == m_cmd_done) {
+            return m_cmd_result;
         }
     }
-    data = "";
-    return false;
+    return ESP8266_UNKNOWN;
 }
 
-bool ESP8266::eAT(void)
+ESP8266Status ESP8266::wait(ESP8266Handle handle)
 {
-    rx_empty();
-    m_puart->println("AT");
-    return recvFind("OK");
+    while (handle != 0 && handle == m_cmd_handle) {
+        poll();
+    }
+    return status(handle);
 }
 
-bool ESP8266::eATRST(void) 
+void ESP8266::setCallback(ESP8266Callback callback, void *arg)
 {
-    rx_empty();
-    m_puart->println("AT+RST");
-    return recvFind("OK");
+    m_callback = callback;
+    m_callback_arg = arg;
 }
 
-bool ESP8266::eATGMR(String &version)
+/*----------------------------------------------------------------------------*/
+
+ESP8266Handle ESP8266::eAT(void)
 {
-    rx_empty();
-    m_puart->println("AT+GMR");
-    return recvFindAndFilter("OK", "\r\r\n", "\r\n\r\nOK", version);
+    return cmd_exec(ROW_AT);
 }
 
-bool ESP8266::qATCWMODE(uint8_t *mode) 
+ESP8266Handle ESP8266::eATRST(void) 
 {
-    String str_mode;
-    bool ret;
-    if (!mode) {
-        return false;
-    }
-    rx_empty();
-    m_puart->println("AT+CWMODE?");
-    ret = recvFindAndFilter("OK", "+CWMODE:", "\r\n\r\nOK", str_mode);
-    if (ret) {
-        *mode = (uint8_t)str_mode.toInt();
-        return true;
-    } else {
-        return false;
-    }
+    return cmd_exec(ROW_RST);
 }
 
-bool ESP8266::sATCWMODE(uint8_t mode)
+bool ESP8266::eATGMR(char *version, size_t size)
 {
-    // Serial.println(mode);
-    String data;
-    rx_empty();
-    m_puart->print("AT+CWMODE=");
-    m_puart->println(mode);
-    data = recvString("OK", "no change");
-    // Serial.println(data);
-    if (data.indexOf("OK") != -1 || data.indexOf("no change") != -1) {
-        // Serial.println("thinks its OK");
-        return true;
-    }
-    // Serial.println("Could not find OK or 'no change'");
-    return false;
+    return cmd_query(ROW_GMR, version, size);
 }
 
-bool ESP8266::sATCWJAP(String ssid, String pwd)
+bool ESP8266::eATCWLAP(char *list, size_t size)
 {
-    String data;
-    rx_empty();
-    m_puart->print("AT+CWJAP=\"");
-    m_puart->print(ssid);
-    m_puart->print("\",\"");
-    m_puart->print(pwd);
-    m_puart->println("\"");
-    
-    data = recvString("OK", "FAIL", "CONNECTED", 10000);
-    if (data.indexOf("OK") != -1 || data.indexOf("CONNECTED") != -1) {
-        return true;
-    }
-    return false;
+    return cmd_query(ROW_CWLAP, list, size);
 }
 
-bool ESP8266::qATCWJAP()
+bool ESP8266::eATCWLIF(char *list, size_t size)
 {
-    String data;
-    rx_empty();
-    m_puart->println("AT+CWJAP?");
-
-    data = recvString("OK", "FAIL", "CONNECTED", 10000);
-    if (data.indexOf("OK") != -1 || data.indexOf("CONNECTED") != -1) {
-        return true;
-    }
+    return cmd_query(ROW_CWLIF, list, size);
+}
 
-    return false;
+bool ESP8266::eATCIPSTATUS(char *list, size_t size)
+{
+    delay(100);
+    return cmd_query(ROW_CIPSTATUS, list, size);
 }
 
-bool ESP8266::eATCWLAP(String &list)
+bool ESP8266::eATCIFSR(char *list, size_t size)
 {
-    String data;
-    rx_empty();
-    m_puart->println("AT+CWLAP");
-    return recvFindAndFilter("OK", "\r\r\n", "\r\n\r\nOK", list, 10000);
+    return cmd_query(ROW_CIFSR, list, size);
 }
 
-bool ESP8266::eATCWQAP(void)
+#if !ESP8266_NO_STRING
+bool ESP8266::eATGMR(String &version)
 {
-    String data;
-    rx_empty();
-    m_puart->println("AT+CWQAP");
-    return recvFind("OK");
+    return cmd_query(ROW_GMR, version);
 }
 
-bool ESP8266::sATCWSAP(String ssid, String pwd, uint8_t chl, uint8_t ecn)
+bool ESP8266::eATCWLAP(String &list)
 {
-    String data;
-    rx_empty();
-    m_puart->print("AT+CWSAP=\"");
-    m_puart->print(ssid);
-    m_puart->print("\",\"");
-    m_puart->print(pwd);
-    m_puart->print("\",");
-    m_puart->print(chl);
-    m_puart->print(",");
-    m_puart->println(ecn);
-    
-    data = recvString("OK", "ERROR", 5000);
-    if (data.indexOf("OK") != -1) {
-        return true;
-    }
-    return false;
+    return cmd_query(ROW_CWLAP, list);
 }
 
 bool ESP8266::eATCWLIF(String &list)
 {
-    rx_empty();
-    m_puart->println("AT+CWLIF");
-    return recvFindAndFilter("OK", "\r\r\n", "\r\n\r\nOK", list);
+    return cmd_query(ROW_CWLIF, list);
 }
+
 bool ESP8266::eATCIPSTATUS(String &list)
 {
     delay(100);
-    rx_empty();
-    m_puart->println("AT+CIPSTATUS");
-    return recvFindAndFilter("OK", "\r\r\n", "\r\n\r\nOK", list);
+    return cmd_query(ROW_CIPSTATUS, list);
 }
-bool ESP8266::sATCIPSTARTSingle(String type, String addr, uint32_t port)
+
+bool ESP8266::eATCIFSR(String &list)
 {
-    String data;
-    rx_empty();
-    m_puart->print("AT+CIPSTART=\"");
-    m_puart->print(type);
-    m_puart->print("\",\"");
-    m_puart->print(addr);
-    m_puart->print("\",");
-    m_puart->println(port);
-    
-    data = recvString("OK", "ERROR", "ALREADY CONNECT", 10000);
-    // Serial.println(data);
-    if (data.indexOf("OK") != -1 || data.indexOf("ALREADY CONNECT") != -1) {
-        return true;
-    }
-    return false;
+    return cmd_query(ROW_CIFSR, list);
 }
-bool ESP8266::sATCIPSTARTMultiple(uint8_t mux_id, String type, String addr, uint32_t port)
+#endif
+
+bool ESP8266::qATCWMODE(uint8_t *mode) 
 {
-    String data;
-    rx_empty();
-    m_puart->print("AT+CIPSTART=");
-    m_puart->print(mux_id);
-    m_puart->print(",\"");
-    m_puart->print(type);
-    m_puart->print("\",\"");
-    m_puart->print(addr);
-    m_puart->print("\",");
-    m_puart->println(port);
-    
-    data = recvString("OK", "ERROR", "ALREADY CONNECT", 10000);
-    if (data.indexOf("OK") != -1 || data.indexOf("ALREADY CONNECT") != -1) {
+    char str_mode[4];
+    if (!mode) {
+        return false;
+    }
+    if (cmd_query(ROW_CWMODE_Q, str_mode, sizeof(str_mode))) {
+        *mode = (uint8_t)atoi(str_mode);
         return true;
+    } else {
+        return false;
     }
-    return false;
 }
 
-bool ESP8266::sATCIPSENDSingle(const uint8_t *buffer, uint32_t len)
+ESP8266Handle ESP8266::sATCWMODE(uint8_t mode)
 {
-    rx_empty();
-    m_puart->print("AT+CIPSEND=");
-    m_puart->println(len);
-    if (recvFind(">", 5000)) {
-        rx_empty();
-        //Serial.println(F("This is what is getting printed:"));
+    CmdArg args[] = {mode};
+    return cmd_exec(ROW_CWMODE, args, 1);
+}
 
-        for (uint32_t i = 0; i < len; i++) {
-            m_puart->write(buffer[i]);
-            //Serial.print( &buffer[i]);
-        }
+ESP8266Handle ESP8266::sATCWMODECUR(uint8_t mode)
+{
+    CmdArg args[] = {mode};
+    return cmd_exec(ROW_CWMODE_CUR, args, 1);
+}
 
-        return recvFind("SEND OK", 10000);
-    }
-    return false;
+ESP8266Handle ESP8266::sATCWJAP(const ESP8266Segment &ssid, const ESP8266Segment &pwd)
+{
+    CmdArg args[] = {ssid, pwd};
+    return cmd_exec(ROW_CWJAP, args, 2);
 }
 
-const char *lineReturn = "\r\n";
+ESP8266Handle ESP8266::qATCWJAP()
+{
+    return cmd_exec(ROW_CWJAP_Q);
+}
 
-/* Written by Etienne */
-void ESP8266::sATCIPSENDSingleNoRcv(const uint8_t *buffer, uint32_t len)
+ESP8266Handle ESP8266::eATCWQAP(void)
 {
-    rx_empty();
-    m_puart->print("AT+CIPSEND=");
-    m_puart->println(len + 2); // include the 2 line return characters
-    if (recvFind(">", 5000)) {
-        rx_empty();
-        //Serial.println(F("This is what is getting printed:"));
+    return cmd_exec(ROW_CWQAP);
+}
 
-        for (uint32_t i = 0; i < len; i++) {
-            m_puart->write(buffer[i]);
-            //Serial.print( &buffer[i]);
-        }
-        m_puart->write(lineReturn);
-    }
+ESP8266Handle ESP8266::sATCWSAP(const ESP8266Segment &ssid, const ESP8266Segment &pwd, uint8_t chl, uint8_t ecn)
+{
+    CmdArg args[] = {ssid, pwd, chl, ecn};
+    return cmd_exec(ROW_CWSAP, args, 4);
 }
 
-bool ESP8266::sATCIPSENDMultiple(uint8_t mux_id, const uint8_t *buffer, uint32_t len)
+ESP8266Handle ESP8266::sATCIPSTARTSingle(const char *type, const ESP8266Segment &addr, uint32_t port)
 {
-    rx_empty();
-    m_puart->print("AT+CIPSEND=");
-    m_puart->print(mux_id);
-    m_puart->print(",");
-    m_puart->println(len);
-    if (recvFind(">", 5000)) {
+    char ip[16];
+    ESP8266Segment target = dns_addr(addr, ip);
+    CmdArg args[] = {type, target, port};
+    ESP8266Handle handle = cmd_exec(ROW_CIPSTART_SINGLE, args, 3);
+    link_open(ESP8266_SINGLE_LINK, type, target, port);
+    return handle;
+}
+ESP8266Handle ESP8266::sATCIPSTARTMultiple(uint8_t mux_id, const char *type, const ESP8266Segment &addr, uint32_t port)
+{
+    char ip[16];
+    ESP8266Segment target = dns_addr(addr, ip);
+    CmdArg args[] = {mux_id, type, target, port};
+    ESP8266Handle handle = cmd_exec(ROW_CIPSTART_MULTIPLE, args, 4);
+    link_open(mux_id, type, target, port);
+    return handle;
+}
+
+ESP8266Handle ESP8266::sATCIPSENDSingle(const ESP8266Segment *segments, uint8_t count)
+{
+    CmdArg args[] = {segments_length(segments, count)};
+    return cmd_send(ROW_CIPSEND_SINGLE, args, 1, segments, count);
+}
+
+const char *lineReturn = "\r\n";
+
+/* Written by Etienne */
+void ESP8266::sATCIPSENDSingleNoRcv(const ESP8266Segment *segments, uint8_t count)
+{
+    ESP8266Segment line_end(lineReturn);
+    CmdArg args[] = {segments_length(segments, count) + 2}; // include the 2 line return characters
+
+    if (wait(cmd_exec(ROW_CIPSEND_SINGLE, args, 1)) == ESP8266_OK) {
         rx_empty();
-        for (uint32_t i = 0; i < len; i++) {
-            m_puart->write(buffer[i]);
-        }
-        return recvFind("SEND OK", 10000);
+
+        tx_write(segments, count);
+        tx_write(&line_end, 1);
     }
-    return false;
 }
-bool ESP8266::sATCIPCLOSEMulitple(uint8_t mux_id)
+
+ESP8266Handle ESP8266::sATCIPSENDMultiple(uint8_t mux_id, const ESP8266Segment *segments, uint8_t count)
 {
-    String data;
-    rx_empty();
-    m_puart->print("AT+CIPCLOSE=");
-    m_puart->println(mux_id);
-    
-    data = recvString("OK", "link is not", 5000);
-    if (data.indexOf("OK") != -1 || data.indexOf("link is not") != -1) {
-        return true;
-    }
-    return false;
+    CmdArg args[] = {mux_id, segments_length(segments, count)};
+    return cmd_send(ROW_CIPSEND_MULTIPLE, args, 2, segments, count);
 }
-bool ESP8266::eATCIPCLOSESingle(void)
+ESP8266Handle ESP8266::sATCIPCLOSEMulitple(uint8_t mux_id)
 {
-    rx_empty();
-    m_puart->println("AT+CIPCLOSE");
-    return recvFind("OK", 5000);
+    CmdArg args[] = {mux_id};
+    ESP8266Handle handle = cmd_exec(ROW_CIPCLOSE_MULTIPLE, args, 1);
+    link_close(mux_id);
+    return handle;
 }
-bool ESP8266::eATCIFSR(String &list)
+ESP8266Handle ESP8266::eATCIPCLOSESingle(void)
 {
-    rx_empty();
-    m_puart->println("AT+CIFSR");
-    return recvFindAndFilter("OK", "\r\r\n", "\r\n\r\nOK", list);
+    ESP8266Handle handle = cmd_exec(ROW_CIPCLOSE_SINGLE);
+    link_close(ESP8266_SINGLE_LINK);
+    return handle;
 }
-bool ESP8266::sATCIPMUX(uint8_t mode)
+ESP8266Handle ESP8266::sATCIPMUX(uint8_t mode)
 {
-    String data;
-    rx_empty();
-    m_puart->print("AT+CIPMUX=");
-    m_puart->println(mode);
-    
-    data = recvString("OK", "Link is builded");
-    if (data.indexOf("OK") != -1) {
-        return true;
-    }
-    return false;
+    CmdArg args[] = {mode};
+    return cmd_exec(ROW_CIPMUX, args, 1);
 }
-bool ESP8266::sATCIPSERVER(uint8_t mode, uint32_t port)
+ESP8266Handle ESP8266::sATCIPSERVER(uint8_t mode, uint32_t port)
 {
-    String data;
+    CmdArg args[] = {port};
     if (mode) {
-        rx_empty();
-        m_puart->print("AT+CIPSERVER=1,");
-        m_puart->println(port);
-        
-        data = recvString("OK", "no change");
-        if (data.indexOf("OK") != -1 || data.indexOf("no change") != -1) {
-            return true;
-        }
-        return false;
+        m_server_port = port;
+        return cmd_exec(ROW_CIPSERVER_ON, args, 1);
     } else {
-        rx_empty();
-        m_puart->println("AT+CIPSERVER=0");
-        return recvFind("\r\r\n");
+        return cmd_exec(ROW_CIPSERVER_OFF);
     }
 }
-bool ESP8266::sATCIPSTO(uint32_t timeout)
+ESP8266Handle ESP8266::sATCIPSTO(uint32_t timeout)
 {
-    rx_empty();
-    m_puart->print("AT+CIPSTO=");
-    m_puart->println(timeout);
-    return recvFind("OK");
+    CmdArg args[] = {timeout};
+    return cmd_exec(ROW_CIPSTO, args, 1);
 }
 
+ESP8266Handle ESP8266::sATCIPMODE(uint8_t mode)
+{
+    CmdArg args[] = {mode};
+    return cmd_exec(ROW_CIPMODE, args, 1);
+}
+ESP8266Handle ESP8266::eATCIPSENDPassthrough(void)
+{
+    ESP8266Handle handle;
+    handle = cmd_exec(ROW_CIPSEND_PASSTHROUGH);
+    m_passthrough_prompt = true;
+    return handle;
+}
+ESP8266Handle ESP8266::sATUARTCUR(uint32_t baud)
+{
+    CmdArg args[] = {baud};
+    return cmd_exec(ROW_UART_CUR, args, 1);
+}
@@ -23,43 +23,294 @@
 
 #include "Arduino.h"
 
+#include "ESP8266Parser.h"
+#include "ESP8266RingBuffer.h"
+#include "ESP8266Stats.h"
+#include "ESP8266Log.h"
 
-#define ESP8266_USE_SOFTWARE_SERIAL
+/*
+ * The capacity of the buffer between the UART and all parsers. 
+ */
+#ifndef ESP8266_RX_BUFFER_SIZE
+#define ESP8266_RX_BUFFER_SIZE      (64)
+#endif
+
+/*
+ * The capacity of the receive queue of each link. While a command waits for 
+ * its answer, data of +IPD for a full queue is dropped, see getLinkDropCount(). 
+ * Make it as big as the largest +IPD expected to lose none. 
+ */
+#ifndef ESP8266_LINK_BUFFER_SIZE
+#define ESP8266_LINK_BUFFER_SIZE    (32)
+#endif
+
+/*
+ * The longest line which is checked for unsolicited result codes. 
+ */
+#ifndef ESP8266_LINE_SIZE
+#define ESP8266_LINE_SIZE           (32)
+#endif
+
+/*
+ * The most data AT+CIPSEND accepts at once. 
+ */
+#ifndef ESP8266_SEND_CHUNK_SIZE
+#define ESP8266_SEND_CHUNK_SIZE     (2048)
+#endif
+
+/*
+ * The buffer data of sendStream() goes through. Without the total length, 
+ * data from a backslash on is sent by AT+CIPSEND of no more than this. 
+ */
+#ifndef ESP8266_SEND_BUFFER_SIZE
+#define ESP8266_SEND_BUFFER_SIZE    (64)
+#endif
+
+/*
+ * The silence in milliseconds needed around "+++" to leave transparent transmission. 
+ */
+#ifndef ESP8266_PASSTHROUGH_GUARD_TIME
+#define ESP8266_PASSTHROUGH_GUARD_TIME  (1000)
+#endif
+
+/*
+ * The highest baud rate negotiateBaudrate() tries by default. 0 stands for 
+ * 115200 with HardwareSerial and 57600 with any other transport, e.g. SoftwareSerial. 
+ */
+#ifndef ESP8266_BAUD_MAX
+#define ESP8266_BAUD_MAX            (0)
+#endif
+
+/*
+ * How many "AT" in a row must succeed before a baud rate is taken, and how 
+ * long(milliseconds) each may take. 
+ */
+#ifndef ESP8266_BAUD_PROBES
+#define ESP8266_BAUD_PROBES         (3)
+#endif
+#ifndef ESP8266_BAUD_PROBE_TIMEOUT
+#define ESP8266_BAUD_PROBE_TIMEOUT  (200)
+#endif
+
+/*
+ * How many commands may time out before checkBaudrate() steps the rate down. 
+ */
+#ifndef ESP8266_BAUD_MAX_ERRORS
+#define ESP8266_BAUD_MAX_ERRORS     (3)
+#endif
+
+/*
+ * The longest restart() waits for ESP8266 to boot, in milliseconds. 
+ */
+#ifndef ESP8266_RESTART_TIMEOUT
+#define ESP8266_RESTART_TIMEOUT     (5000)
+#endif
 
+/*
+ * How often restart() tries "AT" while no "ready" has come, in milliseconds. 
+ */
+#ifndef ESP8266_BOOT_PROBE_INTERVAL
+#define ESP8266_BOOT_PROBE_INTERVAL (250)
+#endif
 
-#ifdef ESP8266_USE_SOFTWARE_SERIAL
-#include "SoftwareSerial.h"
+/*
+ * 1 leaves out every method which takes or returns String, so that nothing 
+ * the library does allocates memory. It must be the same for the library and 
+ * the sketch, so change it here rather than in the sketch. 
+ */
+#ifndef ESP8266_NO_STRING
+#define ESP8266_NO_STRING           (0)
 #endif
 
+/*
+ * The number of host names whose address is kept, 0 for none. Host names 
+ * given to createTCP() and registerUDP() are then resolved by AT+CIPDOMAIN 
+ * once, and later connections go to the address. 
+ */
+#ifndef ESP8266_DNS_CACHE_SIZE
+#define ESP8266_DNS_CACHE_SIZE      (0)
+#endif
+
+/*
+ * How long(milliseconds) an address stays in the DNS cache. 
+ */
+#ifndef ESP8266_DNS_TTL
+#define ESP8266_DNS_TTL             (300000)
+#endif
+
+#define ESP8266_MAX_LINKS           (5) /* mux_id 0 - 4 */
+#define ESP8266_SINGLE_LINK         (0) /* the link used in single mode */
+
+
+/**
+ * The identifier of a command started by one of the begin...() methods. 
+ * 0 is never a valid handle. 
+ */
+typedef uint8_t ESP8266Handle;
+
+/**
+ * The status of a command. 
+ */
+enum ESP8266Status {
+    ESP8266_PENDING,    /**< Waiting for the response. */
+    ESP8266_OK,         /**< Finished successfully. */
+    ESP8266_ERROR,      /**< ESP8266 replied with a failure. */
+    ESP8266_TIMEOUT,    /**< No response in time. */
+    ESP8266_UNKNOWN     /**< Not the handle of the last command. */
+};
+
+/**
+ * Called when a command started by one of the begin...() methods finishes. 
+ *
+ * @param handle - the handle returned by begin...(). 
+ * @param status - ESP8266_OK, ESP8266_ERROR or ESP8266_TIMEOUT. 
+ * @param arg - the argument given to setCallback. 
+ */
+typedef void (*ESP8266Callback)(ESP8266Handle handle, ESP8266Status status, void *arg);
+
+/**
+ * Set the baud rate of the transport ESP8266 was created with. 
+ */
+typedef void (*ESP8266UartBegin)(Stream *uart, uint32_t baud);
+
+/**
+ * Give the next data to sendStream(). 
+ *
+ * @param buffer - where to put the data. 
+ * @param size - the most data buffer can take. 
+ * @param arg - the argument given to sendStream(). 
+ * @return the length of data put in buffer, 0 when there is no more. 
+ */
+typedef uint32_t (*ESP8266Producer)(uint8_t *buffer, uint32_t size, void *arg);
+
+/**
+ * A piece of data to send, in RAM or in flash. 
+ *
+ * Several segments are sent as one message by a single AT+CIPSEND, without 
+ * assembling them first: 
+ *
+ *     ESP8266Segment segments[] = {F("MAIL FROM:<"), from, F(">\r\n")};
+ *     wifi.send(segments, 3);
+ *
+ * A segment only points to the data, which must stay untouched until sent. 
+ *
+ * Text parameters such as SSIDs and host names are segments too, so they can 
+ * be given as char *, F(), String or a pointer and a length, without a copy. 
+ */
+struct ESP8266Segment {
+    const uint8_t *data;
+    uint32_t len;
+    bool progmem;   /* data is in flash(PROGMEM) */
+
+    ESP8266Segment(void): data(NULL), len(0), progmem(false) {}
+    ESP8266Segment(const uint8_t *buffer, uint32_t length): data(buffer), len(length), progmem(false) {}
+    ESP8266Segment(const char *str): data((const uint8_t *)str), len(strlen(str)), progmem(false) {}
+#if !ESP8266_NO_STRING
+    ESP8266Segment(const String &str): data((const uint8_t *)str.c_str()), len(str.length()), progmem(false) {}
+#endif
+    ESP8266Segment(const __FlashStringHelper *str): 
+        data((const uint8_t *)str), len(strlen_P((PGM_P)str)), progmem(true) {}
+};
+
+/**
+ * FNV-1a hash of a segment, never 0. Tells host names apart without keeping 
+ * them. 
+ */
+uint32_t ESP8266Hash(const ESP8266Segment &segment);
+
+/**
+ * What tells a host name apart without keeping it: its length and two 
+ * unrelated hashes of it, so that two names taken for one another would 
+ * have to collide in both. 
+ */
+struct ESP8266HostKey {
+    uint32_t hash;                  /* ESP8266Hash() */
+    uint32_t check;                 /* sdbm hash */
+    uint16_t len;                   /* 0 if none */
+
+    ESP8266HostKey(): hash(0), check(0), len(0) {}
+    explicit ESP8266HostKey(const ESP8266Segment &host);
+    bool operator==(const ESP8266HostKey &other) const {
+        return len == other.len && hash == other.hash && check == other.check;
+    }
+    bool operator!=(const ESP8266HostKey &other) const {
+        return !(*this == other);
+    }
+};
+
+/**
+ * Called for each AP found by ESP8266::scanAP(), as its line comes. 
+ *
+ * @param ap - the AP, only valid during the call. 
+ * @param arg - the argument given to scanAP(). 
+ */
+typedef void (*ESP8266APHandler)(const ESP8266AP &ap, void *arg);
+
+/**
+ * Unsolicited result codes of ESP8266. 
+ */
+enum ESP8266Event {
+    ESP8266_EVENT_CONNECT,          /**< [<id>,]CONNECT: a link is connected. */
+    ESP8266_EVENT_CLOSED,           /**< [<id>,]CLOSED: a link is closed. */
+    ESP8266_EVENT_WIFI_CONNECTED,   /**< WIFI CONNECTED: joined an AP. */
+    ESP8266_EVENT_WIFI_GOT_IP,      /**< WIFI GOT IP: got an IP address from the AP. */
+    ESP8266_EVENT_WIFI_DISCONNECT,  /**< WIFI DISCONNECT: left the AP. */
+    ESP8266_EVENT_BUSY,             /**< busy p... / busy s...: the last command was not taken. */
+    ESP8266_EVENT_READY             /**< ready: the firmware has booted. */
+};
+
+/**
+ * Called when an unsolicited result code is received. 
+ *
+ * @param event - what happened. 
+ * @param mux_id - the link concerned(ESP8266_SINGLE_LINK in single mode), 0 for Wi-Fi events. 
+ * @param arg - the argument given to setEventHandler. 
+ * @note Called while ESP8266 is parsing, so it must not call methods of ESP8266. 
+ */
+typedef void (*ESP8266EventHandler)(ESP8266Event event, uint8_t mux_id, void *arg);
 
 /**
  * Provide an easy-to-use way to manipulate ESP8266. 
+ *
+ * Every method is also available without blocking: begin...() starts the command 
+ * and returns its handle(0 if another command is in flight), after which poll() 
+ * must be called from the main loop until status(handle) is not ESP8266_PENDING 
+ * or the callback has been called. The blocking methods are begin...() followed 
+ * by wait(). 
  */
 class ESP8266 {
+    friend class ESP8266Passthrough;
+
  public:
 
-#ifdef ESP8266_USE_SOFTWARE_SERIAL
     /*
      * Constuctor. 
      *
-     * @param uart - an reference of SoftwareSerial object. 
+     * @param uart - an reference of the serial port connected to ESP8266: HardwareSerial, 
+     *  SoftwareSerial or any other Stream which has begin(baud). 
      * @param baud - the buad rate to communicate with ESP8266(default:9600). 
      *
      * @warning parameter baud depends on the AT firmware. 9600 is an common value. 
+     * @note The RX and TX loops call uart as the type it is given as, without 
+     *  virtual calls. Give it as its own type(e.g. Serial1, not a reference to 
+     *  a base of it). 
      */
-    // ESP8266(SoftwareSerial &uart, uint32_t baud = 9600);
-    ESP8266(SoftwareSerial &uart, uint32_t baud = 9600);
-#else /* HardwareSerial */
+    template <class Transport>
+    ESP8266(Transport &uart, uint32_t baud = 9600): 
+        ESP8266(uart, uart_begin<Transport>, uart_fill_as<Transport>, uart_write_as<Transport>, 
+            baud_max(&uart), baud) {}
+
     /*
-     * Constuctor. 
+     * Constuctor for a transport known only as Stream, every call going 
+     * through Stream. 
      *
-     * @param uart - an reference of HardwareSerial object. 
+     * @param uart - an reference of the serial port connected to ESP8266. 
+     * @param begin - the function which sets the baud rate of uart, not NULL. 
      * @param baud - the buad rate to communicate with ESP8266(default:9600). 
-     *
-     * @warning parameter baud depends on the AT firmware. 9600 is an common value. 
      */
-    ESP8266(HardwareSerial &uart, uint32_t baud = 9600);
-#endif
+    ESP8266(Stream &uart, ESP8266UartBegin begin, uint32_t baud = 9600): 
+        ESP8266(uart, begin, uart_fill_as<Stream>, uart_write_as<Stream>, 
+            baud_max(&uart), baud) {}
     
     
     /** 
@@ -82,26 +333,88 @@ class ESP8266 {
      */
     void forceBaudrate();
 
+    /**
+     * Find the baud rate ESP8266 is using by probing with "AT". 
+     *
+     * The rate given to the constructor is tried first. The first rate found is 
+     * remembered as the one ESP8266 comes back to after a reset. 
+     *
+     * @return the baud rate, 0 if ESP8266 does not answer at any. 
+     */
+    uint32_t detectBaudrate(void);
+
+    /**
+     * Detect the baud rate, then step up to the highest one that works. 
+     *
+     * Each rate is set with "AT+UART_CUR", which is not saved in flash, and 
+     * kept only if ESP8266_BAUD_PROBES "AT" in a row succeed at it. restart() 
+     * goes back to the rate found here without probing again. 
+     *
+     * @param max - the highest baud rate to try, 0 for the most the transport takes. 
+     * @return the baud rate in use, 0 if ESP8266 does not answer. 
+     */
+    uint32_t negotiateBaudrate(uint32_t max = ESP8266_BAUD_MAX);
+
+    /**
+     * Step the baud rate down if ESP8266_BAUD_MAX_ERRORS commands have timed out 
+     * since the last check. Call it from time to time, e.g. after a failure. 
+     *
+     * @retval true - the link works, at the same or a lower rate. 
+     * @retval false - ESP8266 does not answer any more. 
+     */
+    bool checkBaudrate(void);
+
+    /**
+     * Get the baud rate in use. 
+     */
+    uint32_t getBaudrate(void);
+
     /**
      * Restart ESP8266 by "AT+RST". 
      *
-     * This method will take 3 seconds or more. 
+     * Returns as soon as ESP8266 has printed "ready" and answers "AT", which 
+     * usually takes less than a second. 
      *
+     * @param timeout - the longest to wait for the boot, in milliseconds. 
      * @retval true - success.
      * @retval false - failure.
      */
-    bool restart(void);
+    bool restart(uint32_t timeout = ESP8266_RESTART_TIMEOUT);
+
+    /**
+     * Get how long the last successful restart() took from "AT+RST" to the first 
+     * "AT" answered. 
+     *
+     * @return the time in milliseconds, 0 if not restarted yet. 
+     */
+    uint32_t getBootTime(void);
     
+#if !ESP8266_NO_STRING
     /**
      * Get the version of AT Command Set. 
      * 
      * @return the string of version. 
      */
     String getVersion(void);
+#endif
+
+    /**
+     * Get the version of AT Command Set into buffer. 
+     *
+     * @param buffer - where to put the version, always terminated by '\0'. 
+     * @param size - the size of buffer. 
+     * @retval true - success.
+     * @retval false - failure, or the version did not fit in buffer. 
+     */
+    bool getVersion(char *buffer, size_t size);
     
     /**
      * Set operation mode to staion. 
      * 
+     * The mode is switched by "AT+CWMODE_CUR" when the firmware has it, which takes 
+     * effect at once, keeps the links and is not saved in flash. Older firmware 
+     * gets "AT+CWMODE" and restart() instead. 
+     *
      * @retval true - success.
      * @retval false - failure.
      */
@@ -110,6 +423,7 @@ class ESP8266 {
     /**
      * Set operation mode to softap. 
      * 
+     * @see bool setOprToStation(void);
      * @retval true - success.
      * @retval false - failure.
      */
@@ -118,6 +432,7 @@ class ESP8266 {
     /**
      * Set operation mode to station + softap. 
      * 
+     * @see bool setOprToStation(void);
      * @retval true - success.
      * @retval false - failure.
      */
@@ -129,8 +444,51 @@ class ESP8266 {
      * @return the list of available APs. 
      * @note This method will occupy a lot of memeory(hundreds of Bytes to a couple of KBytes). 
      *  Do not call this method unless you must and ensure that your board has enough memery left.
+     *  scanAP() needs none. 
      */
+#if !ESP8266_NO_STRING
     String getAPList(void);
+#endif
+
+    /**
+     * Search available AP list and put it in buffer. 
+     *
+     * @see bool getVersion(char *buffer, size_t size);
+     */
+    bool getAPList(char *buffer, size_t size);
+
+    /**
+     * Search available APs and pass each one to handler as its line comes, 
+     * without keeping the list. 
+     *
+     * @param handler - the function called for each AP. 
+     * @param arg - passed to handler as it is. 
+     * @retval true - success.
+     * @retval false - failure.
+     */
+    bool scanAP(ESP8266APHandler handler, void *arg = NULL);
+
+    /**
+     * Search available APs and keep the strongest ones. 
+     *
+     * @param aps - where to put them, strongest first. 
+     * @param count - the most APs aps can take. 
+     * @return the number of APs put in aps, 0 on failure. 
+     */
+    uint8_t scanAP(ESP8266AP *aps, uint8_t count);
+
+    /**
+     * Choose what the AP list gives(AT+CWLAPOPT, firmware 1.5 and later). 
+     *
+     * Asking only for the fields needed cuts the bytes on the UART and so 
+     * the time of a search. 
+     *
+     * @param sort - true to have the list sorted by RSSI, strongest first. 
+     * @param mask - the fields wanted, ESP8266_AP_SSID | ESP8266_AP_RSSI for instance. 
+     * @retval true - success.
+     * @retval false - failure, the firmware may be too old. 
+     */
+    bool setAPListOptions(bool sort, uint16_t mask = ESP8266_AP_ALL);
     
     /**
      * Join in AP. 
@@ -141,7 +499,7 @@ class ESP8266 {
      * @retval false - failure.
      * @note This method will take a couple of seconds. 
      */
-    bool joinAP(String ssid, String pwd);
+    bool joinAP(const ESP8266Segment &ssid, const ESP8266Segment &pwd);
 
     /**
      *
@@ -167,8 +525,9 @@ class ESP8266 {
      *  2 - WPA_PSK, 3 - WPA2_PSK, 4 - WPA_WPA2_PSK, default: 4). 
      * @note This method should not be called when station mode. 
      */
-    bool setSoftAPParam(String ssid, String pwd, uint8_t chl = 7, uint8_t ecn = 4);
+    bool setSoftAPParam(const ESP8266Segment &ssid, const ESP8266Segment &pwd, uint8_t chl = 7, uint8_t ecn = 4);
     
+#if !ESP8266_NO_STRING
     /**
      * Get the IP list of devices connected to SoftAP. 
      * 
@@ -190,6 +549,83 @@ class ESP8266 {
      * @return the IP list. 
      */
     String getLocalIP(void);
+#endif
+
+    /**
+     * Get the IP list of devices connected to SoftAP into buffer. 
+     *
+     * @see bool getVersion(char *buffer, size_t size);
+     */
+    bool getJoinedDeviceIP(char *buffer, size_t size);
+
+    /**
+     * Get the current status of connection(UDP and TCP) into buffer. 
+     *
+     * @see bool getVersion(char *buffer, size_t size);
+     */
+    bool getIPStatus(char *buffer, size_t size);
+
+    /**
+     * Get the IP address of ESP8266 into buffer. 
+     *
+     * @see bool getVersion(char *buffer, size_t size);
+     */
+    bool getLocalIP(char *buffer, size_t size);
+
+    /**
+     * Get what is known of a link, without a word to ESP8266. 
+     *
+     * The table follows CONNECT and CLOSED from ESP8266 and the results of 
+     * createTCP(), registerUDP(), releaseTCP(), unregisterUDP() and their begin 
+     * forms. The remote IP address of a link created with a host name, and the 
+     * remote end of a link accepted by the server, are only known after 
+     * syncLinks(). 
+     *
+     * @param mux_id - the identifier of the link(ESP8266_SINGLE_LINK in single mode). 
+     * @param info - where to put it. 
+     * @retval true - the link is connected. 
+     * @retval false - it is not, or mux_id is out of range. 
+     */
+    bool getLinkInfo(uint8_t mux_id, ESP8266LinkInfo &info);
+
+    /**
+     * Check whether a link is connected, without a word to ESP8266. 
+     *
+     * @see bool getLinkInfo(uint8_t mux_id, ESP8266LinkInfo &info);
+     */
+    bool isConnected(uint8_t mux_id = ESP8266_SINGLE_LINK);
+
+    /**
+     * Get the links connected, without a word to ESP8266. 
+     *
+     * @return bit mux_id set for each link connected. 
+     */
+    uint8_t getConnectedLinks(void);
+
+    /**
+     * Read the links from AT+CIPSTATUS into the table of getLinkInfo(). Those 
+     * it does not list are closed. 
+     *
+     * @retval true - success.
+     * @retval false - failure, only the links listed before it are updated.
+     */
+    bool syncLinks(void);
+
+    /**
+     * Get the IP address of a host(AT+CIPDOMAIN), from the DNS cache if it 
+     * is there. 
+     *
+     * @param host - the name or IP address of the host. 
+     * @param ip - where to put the address, 4 bytes. 
+     * @retval true - success.
+     * @retval false - failure.
+     */
+    bool resolveHost(const ESP8266Segment &host, uint8_t *ip);
+
+    /**
+     * Forget all addresses of the DNS cache. 
+     */
+    void clearDNSCache(void);
     
     /**
      * Enable IP MUX(multiple connection mode). 
@@ -221,7 +657,7 @@ class ESP8266 {
      * @retval true - success.
      * @retval false - failure.
      */
-    bool createTCP(String addr, uint32_t port);
+    bool createTCP(const ESP8266Segment &addr, uint32_t port);
     
     /**
      * Release TCP connection in single mode. 
@@ -239,7 +675,7 @@ class ESP8266 {
      * @retval true - success.
      * @retval false - failure.
      */
-    bool registerUDP(String addr, uint32_t port);
+    bool registerUDP(const ESP8266Segment &addr, uint32_t port);
     
     /**
      * Unregister UDP port number in single mode. 
@@ -258,7 +694,7 @@ class ESP8266 {
      * @retval true - success.
      * @retval false - failure.
      */
-    bool createTCP(uint8_t mux_id, String addr, uint32_t port);
+    bool createTCP(uint8_t mux_id, const ESP8266Segment &addr, uint32_t port);
     
     /**
      * Release TCP connection in multiple mode. 
@@ -278,7 +714,7 @@ class ESP8266 {
      * @retval true - success.
      * @retval false - failure.
      */
-    bool registerUDP(uint8_t mux_id, String addr, uint32_t port);
+    bool registerUDP(uint8_t mux_id, const ESP8266Segment &addr, uint32_t port);
     
     /**
      * Unregister UDP port number in multiple mode. 
@@ -302,7 +738,7 @@ class ESP8266 {
     /**
      * Start TCP Server(Only in multiple mode). 
      * 
-     * After started, user should call method: getIPStatus to know the status of TCP connections. 
+     * After started, user should call method: getConnectedLinks to know the status of TCP connections. 
      * The methods of receiving data can be called for user's any purpose. After communication, 
      * release the TCP connection is needed by calling method: releaseTCP with mux_id. 
      *
@@ -310,7 +746,7 @@ class ESP8266 {
      * @retval true - success.
      * @retval false - failure.
      *
-     * @see String getIPStatus(void);
+     * @see uint8_t getConnectedLinks(void);
      * @see uint32_t recv(uint8_t *coming_mux_id, uint8_t *buffer, uint32_t len, uint32_t timeout);
      * @see bool releaseTCP(uint8_t mux_id);
      */
@@ -364,17 +800,118 @@ class ESP8266 {
      * @retval false - failure.
      */
     bool send(uint8_t mux_id, const uint8_t *buffer, uint32_t len);
+
+    /**
+     * Send several segments as one message in single mode. 
+     * 
+     * The total length goes in one AT+CIPSEND and every segment is written as it is, 
+     * from RAM or from flash, so the message never has to be assembled in SRAM. 
+     *
+     * @param segments - the segments of the message. 
+     * @param count - the number of segments. 
+     * @retval true - success.
+     * @retval false - failure.
+     */
+    bool send(const ESP8266Segment *segments, uint8_t count);
+
+    /**
+     * Send several segments as one message in multiple mode. 
+     * 
+     * @param mux_id - the identifier of this TCP(available value: 0 - 4). 
+     * @param segments - the segments of the message. 
+     * @param count - the number of segments. 
+     * @retval true - success.
+     * @retval false - failure.
+     */
+    bool send(uint8_t mux_id, const ESP8266Segment *segments, uint8_t count);
+
+    /**
+     * Send all data given by producer in single mode. 
+     * 
+     * The data is split in as many AT+CIPSEND as needed, so it can be 
+     * much bigger than both the memory and the limit of ESP8266_SEND_CHUNK_SIZE. 
+     * Each AT+CIPSEND carries up to ESP8266_SEND_CHUNK_SIZE bytes. When total is 
+     * unknown, AT+CIPSENDEX is used instead, ended by "\0"; as a backslash in 
+     * the data would be taken for it, data from a backslash on goes by 
+     * AT+CIPSEND of up to ESP8266_SEND_BUFFER_SIZE bytes. 
+     *
+     * @param producer - called for the next data until it returns 0. 
+     * @param arg - passed to producer. 
+     * @param total - the length of all data, 0 if unknown. 
+     * @param sent - if not NULL, the length of data sent. On failure, data from 
+     *  there on may not have been sent. 
+     * @retval true - success.
+     * @retval false - failure, or producer gave less than total. 
+     */
+    bool sendStream(ESP8266Producer producer, void *arg, uint32_t total = 0, uint32_t *sent = NULL);
+
+    /**
+     * Send all data given by producer in multiple mode. 
+     * 
+     * @param mux_id - the identifier of this TCP(available value: 0 - 4). 
+     * @see sendStream(ESP8266Producer, void *, uint32_t, uint32_t *)
+     */
+    bool sendStream(uint8_t mux_id, ESP8266Producer producer, void *arg, uint32_t total = 0, uint32_t *sent = NULL);
+
+    /**
+     * Enter transparent transmission on the TCP or UDP builded already in single mode. 
+     *
+     * From then on everything written to ESP8266 is sent as it is and everything 
+     * received is data of the link, with no AT+CIPSEND nor +IPD. Use ESP8266Passthrough 
+     * to read and write until exitPassthrough(). Any method which sends a command 
+     * calls exitPassthrough() first, and the begin* methods return 0 meanwhile. 
+     *
+     * @retval true - success.
+     * @retval false - failure.
+     */
+    bool enterPassthrough(void);
+
+    /**
+     * Leave transparent transmission and go back to command mode. 
+     *
+     * "+++" is sent with ESP8266_PASSTHROUGH_GUARD_TIME of silence before and after, 
+     * so this blocks for about twice that. The link stays builded. 
+     *
+     * @retval true - success.
+     * @retval false - failure.
+     */
+    bool exitPassthrough(void);
+
+    /**
+     * Check whether transparent transmission is on. 
+     */
+    bool isPassthrough(void);
     
     /**
      * Written by Etienne. 
      */
     // bool sendAndCheck(String message);
+#if !ESP8266_NO_STRING
     bool sendAndCheck(String message, String target);
+#endif
+    bool sendAndCheck(const char *message, const char *target);
+
+    /**
+     * Send a line made of segments in single mode and wait for target in the reply. 
+     *
+     * "\r\n" is appended, like sendAndCheck(message, target) does. 
+     */
+    bool sendAndCheck(const ESP8266Segment *segments, uint8_t count, const char *target);
     
-    uint32_t sendAndReceive(uint8_t *inputBuffer, uint32_t buffer_size, String message);
+    uint32_t sendAndReceive(uint8_t *inputBuffer, uint32_t buffer_size, const ESP8266Segment &message);
 
     // Written by Etienne to save space writing long email messages into buffers
-    uint32_t sendAndReceiveEmail(char* email_contents[], size_t sizes[], String message);
+    /**
+     * Send a POP3 command(RETR or TOP) and parse the message it returns. 
+     *
+     * From and Subject go to email_contents[0] and [1], the first body(with the 
+     * transfer encoding undone and "\n" line ends) to email_contents[2], each 
+     * truncated to fit its size in sizes. Reading stops at the "." line. 
+     *
+     * @return 1 if the whole message was received, 0 otherwise. 
+     * @see ESP8266MailParser to parse messages without such limits. 
+     */
+    uint32_t sendAndReceiveEmail(char* email_contents[], size_t sizes[], const ESP8266Segment &message);
 
     /**
      * Receive data from TCP or UDP builded already in single mode. 
@@ -389,7 +926,12 @@ class ESP8266 {
     /**
      * Receive data from one of TCP or UDP builded already in multiple mode. 
      *
-     * @param mux_id - the identifier of this TCP(available value: 0 - 4). 
+     * Only the data of mux_id is taken, data of the other links stays in their queues. 
+     * Data of another link whose queue is full is dropped meanwhile: read it too, 
+     * or use recv(&coming_mux_id, ...) which takes any link. 
+     *
+     * @param mux_id - the identifier of this TCP(available value: 0 - 4), 0 is 
+     *  returned for any other value. 
      * @param buffer - the buffer for storing data. 
      * @param buffer_size - the length of the buffer. 
      * @param timeout - the time waiting data. 
@@ -402,6 +944,7 @@ class ESP8266 {
      *
      * After return, coming_mux_id store the id of TCP or UDP from which data coming. 
      * User should read the value of coming_mux_id and decide what next to do. 
+     * The links with data are served in turn, so that a busy link cannot starve the others. 
      * 
      * @param coming_mux_id - the identifier of TCP or UDP. 
      * @param buffer - the buffer for storing data. 
@@ -411,87 +954,655 @@ class ESP8266 {
      */
     uint32_t recv(uint8_t *coming_mux_id, uint8_t *buffer, uint32_t buffer_size, uint32_t timeout = 1000);
 
+    /**
+     * Get the number of bytes received and not read yet on a link. 
+     *
+     * Anything pending from ESP8266 is processed first, without blocking. 
+     *
+     * @param mux_id - the identifier of TCP or UDP(default: ESP8266_SINGLE_LINK for single mode). 
+     * @return the number of bytes which recv can return at once. 
+     */
+    uint32_t available(uint8_t mux_id = ESP8266_SINGLE_LINK);
+
+    /**
+     * Get the number of bytes of a link dropped. 
+     *
+     * Data for a full queue, ESP8266_LINK_BUFFER_SIZE bytes, waits in the RX 
+     * buffer only while this link is being read and no command is waiting; 
+     * otherwise it is dropped, so that answers to commands and the data of the 
+     * other links are never held up. Unread bytes of the previous connection 
+     * are dropped too when the link connects again. 
+     *
+     * @param mux_id - the identifier of TCP or UDP. 
+     * @return the number of bytes dropped since the link was connected. 
+     */
+    uint32_t getLinkDropCount(uint8_t mux_id);
+
+    /**
+     * Advance the command in flight without blocking. 
+     *
+     * Call it as often as possible while a command started by begin...() is pending. 
+     * 
+     * @retval true - a command is still in flight. 
+     * @retval false - idle. 
+     */
+    bool poll(void);
+
+    /**
+     * Check whether a command is in flight. 
+     *
+     * @retval true - busy(or in transparent transmission), begin...() will return 0. 
+     * @retval false - idle. 
+     */
+    bool busy(void);
+
+    /**
+     * Get the status of a command. 
+     *
+     * @param handle - the handle returned by begin...(). 
+     * @return the status, ESP8266_UNKNOWN once another command has finished. 
+     */
+    ESP8266Status status(ESP8266Handle handle);
+
+    /**
+     * Block until a command has finished. 
+     *
+     * @param handle - the handle returned by begin...(). 
+     * @return the status of the command. 
+     */
+    ESP8266Status wait(ESP8266Handle handle);
+
+    /**
+     * Set the function called when a command started by begin...() finishes. 
+     *
+     * @param callback - the function, NULL for none. 
+     * @param arg - passed to callback as it is. 
+     */
+    void setCallback(ESP8266Callback callback, void *arg = NULL);
+
+    /**
+     * Set the function called on unsolicited result codes. 
+     *
+     * They are recognised wherever they appear and never mistaken for the response 
+     * to a command. Data of +IPD is kept in the queue of its link until recv. 
+     *
+     * @param handler - the function, NULL for none. 
+     * @param arg - passed to handler as it is. 
+     */
+    void setEventHandler(ESP8266EventHandler handler, void *arg = NULL);
+
+    /** Start kick() without blocking. @return the handle, 0 if busy. */
+    ESP8266Handle beginKick(void);
+
+    /** Start joinAP() without blocking. @return the handle, 0 if busy. */
+    ESP8266Handle beginJoinAP(const ESP8266Segment &ssid, const ESP8266Segment &pwd);
+
+    /** Start leaveAP() without blocking. @return the handle, 0 if busy. */
+    ESP8266Handle beginLeaveAP(void);
+
+    /** Start enableMUX() without blocking. @return the handle, 0 if busy. */
+    ESP8266Handle beginEnableMUX(void);
+
+    /** Start disableMUX() without blocking. @return the handle, 0 if busy. */
+    ESP8266Handle beginDisableMUX(void);
+
+    /** Start createTCP() in single mode without blocking. @return the handle, 0 if busy. */
+    ESP8266Handle beginCreateTCP(const ESP8266Segment &addr, uint32_t port);
+
+    /** Start releaseTCP() in single mode without blocking. @return the handle, 0 if busy. */
+    ESP8266Handle beginReleaseTCP(void);
+
+    /** Start registerUDP() in single mode without blocking. @return the handle, 0 if busy. */
+    ESP8266Handle beginRegisterUDP(const ESP8266Segment &addr, uint32_t port);
+
+    /** Start unregisterUDP() in single mode without blocking. @return the handle, 0 if busy. */
+    ESP8266Handle beginUnregisterUDP(void);
+
+    /** Start createTCP() in multiple mode without blocking. @return the handle, 0 if busy. */
+    ESP8266Handle beginCreateTCP(uint8_t mux_id, const ESP8266Segment &addr, uint32_t port);
+
+    /** Start releaseTCP() in multiple mode without blocking. @return the handle, 0 if busy. */
+    ESP8266Handle beginReleaseTCP(uint8_t mux_id);
+
+    /** Start registerUDP() in multiple mode without blocking. @return the handle, 0 if busy. */
+    ESP8266Handle beginRegisterUDP(uint8_t mux_id, const ESP8266Segment &addr, uint32_t port);
+
+    /** Start unregisterUDP() in multiple mode without blocking. @return the handle, 0 if busy. */
+    ESP8266Handle beginUnregisterUDP(uint8_t mux_id);
+
+    /** Start startTCPServer() without blocking. @return the handle, 0 if busy. */
+    ESP8266Handle beginStartTCPServer(uint32_t port = 333);
+
+    /**
+     * Start send() in single mode without blocking. 
+     *
+     * @return the handle, 0 if busy. 
+     * @note buffer must stay untouched until the command has finished. 
+     */
+    ESP8266Handle beginSend(const uint8_t *buffer, uint32_t len);
+
+    /**
+     * Start send() in multiple mode without blocking. 
+     *
+     * @return the handle, 0 if busy. 
+     * @note buffer must stay untouched until the command has finished. 
+     */
+    ESP8266Handle beginSend(uint8_t mux_id, const uint8_t *buffer, uint32_t len);
+
+    /**
+     * Start send() of segments in single mode without blocking. 
+     *
+     * @return the handle, 0 if busy. 
+     * @note segments and their data must stay untouched until the command has finished. 
+     */
+    ESP8266Handle beginSend(const ESP8266Segment *segments, uint8_t count);
+
+    /**
+     * Start send() of segments in multiple mode without blocking. 
+     *
+     * @return the handle, 0 if busy. 
+     * @note segments and their data must stay untouched until the command has finished. 
+     */
+    ESP8266Handle beginSend(uint8_t mux_id, const ESP8266Segment *segments, uint8_t count);
+
+    /**
+     * Get the highest number of bytes waiting in the RX buffer at once. 
+     *
+     * @return the high-water mark, no more than ESP8266_RX_BUFFER_SIZE. 
+     * @see void resetRxStats(void);
+     */
+    uint16_t getRxHighWaterMark(void);
+
+    /**
+     * Get how many times the RX buffer filled up while the UART had more data. 
+     *
+     * Each time is counted once, however long the bytes then wait in the UART. 
+     * A non-zero value means ESP8266_RX_BUFFER_SIZE is too small for the traffic
+     * and the UART buffer had to hold the data instead. Nothing is lost by the 
+     * library, but the UART buffer may overrun. 
+     *
+     * @return the number of times. 
+     * @see void resetRxStats(void);
+     */
+    uint32_t getRxOverflowCount(void);
+
+    /**
+     * Reset the high-water mark and the overflow count of the RX buffer. 
+     */
+    void resetRxStats(void);
+
+#if ESP8266_STATS
+    /**
+     * Copy the statistics kept since the last resetStats()(ESP8266_STATS must be 1). 
+     *
+     * @param stats - where to copy them. 
+     */
+    void getStats(ESP8266Stats &stats);
+
+    /**
+     * Reset the statistics, including what getRxOverflowCount() and getLinkDropCount() return. 
+     */
+    void resetStats(void);
+
+    /**
+     * Get the name of a kind of command, e.g. "CIPSEND". 
+     */
+    static const __FlashStringHelper *getCmdName(ESP8266Cmd cmd);
+#endif
+
+#if ESP8266_TRACE_SIZE
+    /**
+     * Get the last bytes which went through the UART(ESP8266_TRACE_SIZE must not be 0). 
+     */
+    const ESP8266TraceStream &getTrace(void) const { return m_trace_uart; }
+
+    /**
+     * Print the trace, a line for each run of bytes one way: the time in milliseconds, 
+     * ">" for bytes written or "<" for bytes read, then the bytes, e.g. 
+     * "1234 > AT+CIPSEND=5\r\n". 
+     */
+    void dumpTrace(Print &out);
+
+    /**
+     * Forget the trace. 
+     */
+    void clearTrace(void);
+#endif
+
  private:
 
     /* 
-     * Empty the buffer or UART RX.
+     * Move what the UART has received into the RX buffer, as long as it fits. 
      */
-    void rx_empty(void);
- 
+    void rx_fill(void) { m_uart_fill(this); }
+
     /* 
-     * Recvive data from uart. Return all received data if target found or timeout. 
+     * Fill the RX buffer and return the number of bytes in it. 
      */
-    String recvString(String target, uint32_t timeout = 1000);
-    
+    uint16_t rx_available(void);
+
     /* 
-     * Recvive data from uart. Return all received data if one of target1 and target2 found or timeout. 
+     * Process everything received so far, so that the next response starts clean. 
      */
-    String recvString(String target1, String target2, uint32_t timeout = 1000);
-    
+    void rx_empty(void);
+
     /* 
-     * Recvive data from uart. Return all received data if one of target1, target2 and target3 found or timeout. 
+     * Take bytes from the RX buffer: data of +IPD goes to the queue of its link, 
+     * unsolicited result codes are raised as events and the rest is fed to the 
+     * command in flight. Data for a full queue is dropped unless hold is its link 
+     * or HOLD_ALL and no command is waiting, then processing stops until the 
+     * queue is read. 
      */
-    String recvString(String target1, String target2, String target3, uint32_t timeout = 1000);
-    
+    void rx_process(int8_t hold);
+
+    /*
+     * Keep processing input until ESP8266_PASSTHROUGH_GUARD_TIME has passed 
+     * since the last write. 
+     */
+    void passthrough_guard(void);
+    void rx_byte(char c);
+
     /* 
-     * Recvive data from uart and search first target. Return true if target found, false for timeout.
+     * Feed the first len bytes of the current line to the command in flight. 
      */
-    bool recvFind(String target, uint32_t timeout = 1000);
+    void line_flush(uint8_t len);
 
+    /* 
+     * Raise the current line as an event. Return false if it is not an unsolicited result code. 
+     */
+    bool line_event(void);
 
+    void raise(ESP8266Event event, uint8_t mux_id);
+ 
+    /* 
+     * Recvive data from uart until matcher finds one of its targets or timeout. 
+     * All received data is appended to data unless it is NULL. 
+     * Return the index of the target found, -1 for timeout. 
+     */
+    int8_t recvString(ESP8266Matcher &matcher, String *data, uint32_t timeout = 1000);
+    
     /* 
-     * Recvive data from uart and search first target and cut out the substring between begin and end(excluding begin and end self). 
-     * Return true if target found, false for timeout.
+     * Recvive data from uart and search first target. Return true if target found, false for timeout.
      */
-    bool recvFindAndFilter(String target, String begin, String end, String &data, uint32_t timeout = 1000);
+    bool recvFind(const char *target, uint32_t timeout = 1000);
     
     /*
-     * Receive a package from uart. 
+     * Receive a package from the queue of a link. 
      *
+     * @param mux_id - the link to read, -1 for the first link with data. 
      * @param buffer - the buffer storing data. 
      * @param buffer_size - guess what!
-     * @param data_len - the length of data actually received(maybe more than buffer_size, the remained data will be abandoned).
      * @param timeout - the duration waitting data comming.
-     * @param coming_mux_id - in single connection mode, should be NULL and not NULL in multiple. 
+     * @param coming_mux_id - where to store the link read, may be NULL. 
+     * @return the length of data read, what does not fit in buffer stays in the queue. 
      */
-    uint32_t recvPkg(uint8_t *buffer, uint32_t buffer_size, uint32_t *data_len, uint32_t timeout, uint8_t *coming_mux_id);
+    uint32_t recvPkg(int8_t mux_id, uint8_t *buffer, uint32_t buffer_size, uint32_t timeout, uint8_t *coming_mux_id);
     
     
-    bool eAT(void);
-    bool eATRST(void);
+    /*
+     * Wait for the command in flight to finish, then empty the buffer or UART RX. 
+     * Called before writing a command of kind cmd. 
+     */
+    void cmd_begin(ESP8266Cmd cmd);
+
+    /*
+     * Start and finish the statistics of a command. 
+     */
+#if ESP8266_STATS
+    void stats_begin(ESP8266Cmd cmd);
+    void stats_finish(ESP8266Status status);
+#else
+    void stats_begin(ESP8266Cmd) {}
+    void stats_finish(ESP8266Status) {}
+#endif
+
+    /*
+     * Wait for the response of the command just written, without blocking. 
+     * targets(in PROGMEM)[0 .. ok_count - 1] mean success, the others failure. 
+     * The whole response is appended to data unless it is NULL. 
+     */
+    ESP8266Handle cmd_expect(const char * const targets[], uint8_t count, uint8_t ok_count, uint32_t timeout = 1000);
+
+    /*
+     * An argument of a command of the table, a number or a text(text.data is not NULL). 
+     */
+    struct CmdArg {
+        CmdArg(uint32_t n): num(n) {}
+        CmdArg(const char *s): text(s), num(0) {}
+        CmdArg(const ESP8266Segment &s): text(s), num(0) {}
+
+        ESP8266Segment text;
+        uint32_t num;
+    };
+
+    /*
+     * Write the command of row id of the table(in PROGMEM), each "%" of its
+     * format replaced by the next of args. 
+     */
+    void cmd_write(uint8_t id, const CmdArg *args, uint8_t count);
+
+    /*
+     * Write the command of row id and wait for the response its row expects. 
+     */
+    ESP8266Handle cmd_exec(uint8_t id, const CmdArg *args = NULL, uint8_t count = 0);
+
+    /*
+     * Write an AT+CIPSEND of row id, wait for ">", then write segments and wait for "SEND OK". 
+     */
+    ESP8266Handle cmd_send(uint8_t id, const CmdArg *args, uint8_t count, const ESP8266Segment *segments, uint8_t segments_count);
+
+    /*
+     * Run the query of row id and cut out its answer, between the filter of
+     * the row and "\r\n\r\nOK", into buffer(terminated by '\0'). False if 
+     * the answer did not fit. 
+     */
+    bool cmd_query(uint8_t id, char *buffer, size_t size, const CmdArg *args = NULL, uint8_t count = 0);
+#if !ESP8266_NO_STRING
+    bool cmd_query(uint8_t id, String &data);
+#endif
+
+    /*
+     * Start keeping the answer of the command just written, see cmd_query(). 
+     */
+    void capture_begin(uint8_t id, char *buffer, size_t size);
+    void capture(char c);
+    bool capture_end(bool ok);
+
+    /*
+     * Write segments to ESP8266, flash ones through a small buffer. 
+     */
+    void tx_write(const ESP8266Segment *segments, uint8_t count);
+
+    /*
+     * Write data to ESP8266. 
+     */
+    size_t tx_data(const uint8_t *buffer, size_t size) { return m_uart_write(m_puart, buffer, size); }
+
+    /*
+     * Send data of producer in chunks. mux_id is -1 in single mode. 
+     */
+    bool send_stream(int8_t mux_id, ESP8266Producer producer, void *arg, uint32_t total, uint32_t *sent);
+
+    /*
+     * Send data of producer, whose length is unknown, by AT+CIPSENDEX: up to 
+     * ESP8266_SEND_CHUNK_SIZE bytes each, sent when "\0" is written. A 
+     * backslash in the data would be taken for the start of "\0", so data 
+     * from a backslash on goes by AT+CIPSEND up to ESP8266_SEND_BUFFER_SIZE. 
+     */
+    bool send_stream_ex(int8_t mux_id, ESP8266Producer producer, void *arg, uint32_t *sent);
+
+    /*
+     * Send AT+CIPSEND(AT+CIPSENDEX if ex) for len bytes and wait for ">". 
+     */
+    bool send_chunk(int8_t mux_id, uint32_t len, bool ex = false);
+
+    /*
+     * Make the command call the callback when it finishes. 
+     */
+    ESP8266Handle cmd_notify(ESP8266Handle handle);
+
+    /*
+     * Feed one byte of response to the command in flight. 
+     */
+    void cmd_feed(char c);
+
+    void cmd_arm(uint8_t ok_count, uint32_t timeout);
+    void cmd_found(int8_t found);
+    void cmd_finish(ESP8266Status status);
+
+    /*
+     * Keep the table of getLinkInfo() up to date: link_open() and link_close() 
+     * right after AT+CIPSTART and AT+CIPCLOSE are sent, link_result() when they 
+     * finish. 
+     */
+    void link_open(uint8_t mux_id, const char *type, const ESP8266Segment &addr, uint32_t port);
+    void link_close(uint8_t mux_id);
+    void link_result(ESP8266Status status);
+    void links_clear(void);
+
+    /*
+     * The DNS cache: dns_resolve() puts a host name into it(blocking), 
+     * dns_addr() gives the cached address of addr as text in ip(16 bytes), or 
+     * addr itself, and dns_forget() drops an address which failed. 
+     */
+    void dns_resolve(const ESP8266Segment &addr);
+    ESP8266Segment dns_addr(const ESP8266Segment &addr, char *ip);
+    void dns_forget(const uint8_t *ip);
+
+    ESP8266Handle eAT(void);
+    ESP8266Handle eATRST(void);
+    bool eATGMR(char *version, size_t size);
+    bool eATCWLAP(char *list, size_t size);
+    bool eATCWLIF(char *list, size_t size);
+    bool eATCIPSTATUS(char *list, size_t size);
+    bool eATCIFSR(char *list, size_t size);
+#if !ESP8266_NO_STRING
     bool eATGMR(String &version);
-    
-    bool qATCWMODE(uint8_t *mode);
-    bool sATCWMODE(uint8_t mode);
-    bool sATCWJAP(String ssid, String pwd);
-    bool qATCWJAP(void);
     bool eATCWLAP(String &list);
-    bool eATCWQAP(void);
-    bool sATCWSAP(String ssid, String pwd, uint8_t chl, uint8_t ecn);
     bool eATCWLIF(String &list);
-    
     bool eATCIPSTATUS(String &list);
-    bool sATCIPSTARTSingle(String type, String addr, uint32_t port);
-    void sATCIPSENDSingleNoRcv(const uint8_t *buffer, uint32_t len);
-    bool sATCIPSTARTMultiple(uint8_t mux_id, String type, String addr, uint32_t port);
-    bool sATCIPSENDSingle(const uint8_t *buffer, uint32_t len);
-    bool sATCIPSENDMultiple(uint8_t mux_id, const uint8_t *buffer, uint32_t len);
-    bool sATCIPCLOSEMulitple(uint8_t mux_id);
-    bool eATCIPCLOSESingle(void);
     bool eATCIFSR(String &list);
-    bool sATCIPMUX(uint8_t mode);
-    bool sATCIPSERVER(uint8_t mode, uint32_t port = 333);
-    bool sATCIPSTO(uint32_t timeout);
+#endif
+    
+    bool qATCWMODE(uint8_t *mode);
+    ESP8266Handle sATCWMODE(uint8_t mode);
+    ESP8266Handle sATCWMODECUR(uint8_t mode);
+
+    /*
+     * Switch the operation mode, without restart() if the firmware allows. 
+     */
+    bool set_mode(uint8_t mode);
+    ESP8266Handle sATCWJAP(const ESP8266Segment &ssid, const ESP8266Segment &pwd);
+    ESP8266Handle qATCWJAP(void);
+    ESP8266Handle eATCWQAP(void);
+    ESP8266Handle sATCWSAP(const ESP8266Segment &ssid, const ESP8266Segment &pwd, uint8_t chl, uint8_t ecn);
+    
+    ESP8266Handle sATCIPSTARTSingle(const char *type, const ESP8266Segment &addr, uint32_t port);
+    void sATCIPSENDSingleNoRcv(const ESP8266Segment *segments, uint8_t count);
+    ESP8266Handle sATCIPSTARTMultiple(uint8_t mux_id, const char *type, const ESP8266Segment &addr, uint32_t port);
+    ESP8266Handle sATCIPSENDSingle(const ESP8266Segment *segments, uint8_t count);
+    ESP8266Handle sATCIPSENDMultiple(uint8_t mux_id, const ESP8266Segment *segments, uint8_t count);
+    ESP8266Handle sATCIPCLOSEMulitple(uint8_t mux_id);
+    ESP8266Handle eATCIPCLOSESingle(void);
+    ESP8266Handle sATCIPMUX(uint8_t mode);
+    ESP8266Handle sATCIPSERVER(uint8_t mode, uint32_t port = 333);
+    ESP8266Handle sATCIPSTO(uint32_t timeout);
+    ESP8266Handle sATCIPMODE(uint8_t mode);
+    ESP8266Handle eATCIPSENDPassthrough(void);
+    ESP8266Handle sATUARTCUR(uint32_t baud);
+
+    /*
+     * Open the UART at baud and check that ESP8266 answers. 
+     */
+    bool baud_probe(uint32_t baud);
+
+    /*
+     * Move ESP8266 and the UART to baud. 
+     */
+    bool baud_switch(uint32_t baud);
+
+    /*
+     * Wait for "ready" or an answer to "AT" until timeout has passed since start. 
+     */
+    bool boot_wait(unsigned long start, uint32_t timeout);
+
+    /* The RX and TX loops, made for the type of the transport */
+    typedef void (*UartFill)(ESP8266 *wifi);
+    typedef size_t (*UartWrite)(Stream *uart, const uint8_t *buffer, size_t size);
+
+    /*
+     * The constructor all others come to, with what depends on the transport. 
+     */
+    ESP8266(Stream &uart, ESP8266UartBegin begin, UartFill fill, UartWrite write, 
+        uint32_t baud_max, uint32_t baud);
+
+    template <class Transport>
+    static void uart_begin(Stream *uart, uint32_t baud)
+    {
+        static_cast<Transport *>(uart)->begin(baud);
+    }
+
+    /*
+     * The transport called by the type it was given as rather than through 
+     * Stream, so that the calls of the RX and TX loops are not virtual and can 
+     * be inlined. A plain Stream is called through Stream, as is a transport 
+     * wrapped for the stats or the trace. 
+     */
+    template <class Transport>
+    static int uart_available(Transport *uart) { return uart->Transport::available(); }
+    static int uart_available(Stream *uart) { return uart->available(); }
+
+    template <class Transport>
+    static int uart_read(Transport *uart) { return uart->Transport::read(); }
+    static int uart_read(Stream *uart) { return uart->read(); }
+
+    template <class Transport>
+    static size_t uart_put(Transport *uart, const uint8_t *buffer, size_t size)
+    {
+        return uart->Transport::write(buffer, size);
+    }
+    static size_t uart_put(Stream *uart, const uint8_t *buffer, size_t size) { return uart->write(buffer, size); }
+
+    /* See rx_fill() */
+    template <class Transport>
+    static void uart_fill_as(ESP8266 *wifi)
+    {
+        Transport *uart = static_cast<Transport *>(wifi->m_puart);
+        int n = uart_available(uart);
+
+        /* Ask the UART again only once what it had is taken */
+        while (n > 0) {
+            if (wifi->m_rx.space() == 0) {
+                /* Leave it in the UART, counted once however long it waits there */
+                if (!wifi->m_rx_full) {
+                    wifi->m_rx_full = true;
+                    wifi->m_rx_fills++;
+                }
+                break;
+            }
+            wifi->m_rx_full = false;
+            wifi->m_rx.write(uart_read(uart));
+            if (--n == 0) {
+                n = uart_available(uart);
+            }
+        }
+    }
+
+    /* See tx_data() */
+    template <class Transport>
+    static size_t uart_write_as(Stream *uart, const uint8_t *buffer, size_t size)
+    {
+        return uart_put(static_cast<Transport *>(uart), buffer, size);
+    }
+
+    /* HardwareSerial takes 115200, a software UART is not so fast */
+    static uint32_t baud_max(HardwareSerial *) { return 115200; }
+    static uint32_t baud_max(Stream *) { return 57600; }
+
+    /* Set the baud rate of m_puart */
+    void uart_baud(uint32_t baud) { m_uart_begin(m_uart, baud); }
     
     /*
      * +IPD,len:data
      * +IPD,id,len:data
      */
     
-#ifdef ESP8266_USE_SOFTWARE_SERIAL
-    SoftwareSerial *m_puart; /* The UART to communicate with ESP8266 */
-#else
-    HardwareSerial *m_puart; /* The UART to communicate with ESP8266 */
+    Stream *m_puart; /* The UART to communicate with ESP8266 */
+    Stream *m_uart;                 /* the transport itself, m_puart may count bytes on the way */
+    ESP8266UartBegin m_uart_begin;  /* sets the baud rate of m_uart */
+    UartFill m_uart_fill;           /* rx_fill() for the type of m_puart */
+    UartWrite m_uart_write;         /* tx_data() for the type of m_puart */
+    ESP8266RingBuffer<ESP8266_RX_BUFFER_SIZE> m_rx; /* All bytes from m_puart go through it */
+    bool m_rx_full;                 /* m_rx was found full with more in the UART */
+    uint32_t m_rx_fills;            /* times that happened, see getRxOverflowCount() */
+
+    /* The command in flight */
+    ESP8266Handle m_cmd_handle;     /* 0 if none */
+    ESP8266Handle m_cmd_last;       /* the last handle given out */
+    ESP8266Handle m_cmd_done;       /* the last command finished */
+    ESP8266Status m_cmd_result;     /* and its status */
+    ESP8266Matcher m_cmd_matcher;
+    uint8_t m_cmd_ok_count;
+    unsigned long m_cmd_start;
+    uint32_t m_cmd_timeout;
+    const ESP8266Segment *m_cmd_payload;   /* written after ">" */
+    uint8_t m_cmd_payload_count;
+    ESP8266Segment m_cmd_segment;   /* the payload of beginSend(buffer, len) */
+    bool m_cmd_notify;
+    bool m_cmd_notify_pending;      /* the callback is due */
+
+    /* The answer of the query in flight, see cmd_query() */
+    const char *m_capture_filter;   /* in PROGMEM, the answer comes after it, NULL if no query */
+    uint8_t m_capture_state;        /* chars of the filter matched, CAPTURE_ON once all */
+    uint8_t m_capture_tail;         /* chars of "\r\n\r\nOK" matched */
+    char *m_capture_buffer;
+    size_t m_capture_size;
+    size_t m_capture_len;           /* may go past m_capture_size, the rest is lost */
+    /* Kept whatever ESP8266_NO_STRING is, so the layout does not depend on it */
+    String *m_capture_data;         /* used instead of m_capture_buffer if not NULL */
+
+    /* The AP search in flight, see scanAP() */
+    ESP8266APParser *m_ap_parser;   /* NULL if none */
+    ESP8266APHandler m_ap_handler;
+    void *m_ap_arg;
+    uint16_t m_ap_mask;             /* the fields of AT+CWLAP, set by setAPListOptions() */
+
+    ESP8266Callback m_callback;
+    void *m_callback_arg;
+
+    /* Unsolicited result codes and +IPD */
+    ESP8266IPDParser m_ipd;
+    int8_t m_ipd_link;              /* the link of the data being received, -1 if none */
+    uint32_t m_ipd_remain;          /* bytes of it still to come */
+    char m_line[ESP8266_LINE_SIZE]; /* the line being received */
+    uint8_t m_line_len;
+    uint8_t m_line_ipd;             /* where "+IPD," may start in m_line */
+    bool m_line_long;               /* too long for m_line, fed to the command as it comes */
+    ESP8266RingBuffer<ESP8266_LINK_BUFFER_SIZE> m_link[ESP8266_MAX_LINKS];
+    uint8_t m_link_next;            /* the first link to look at for any link */
+    ESP8266LinkInfo m_link_info[ESP8266_MAX_LINKS];
+    int8_t m_link_pending;          /* the link of the AT+CIPSTART or AT+CIPCLOSE in flight, -1 if none */
+    bool m_link_closing;            /* it is AT+CIPCLOSE */
+    uint16_t m_server_port;         /* the local port of links accepted by the server */
+    ESP8266LinkParser *m_link_parser;   /* the AT+CIPSTATUS of syncLinks() in flight, NULL if none */
+    uint8_t m_link_seen;            /* bit mux_id set for each link it listed */
+
+#if ESP8266_DNS_CACHE_SIZE
+    struct DNSEntry {
+        ESP8266HostKey key;         /* of the host name, empty if free */
+        uint8_t ip[4];
+        unsigned long time;         /* when it was resolved */
+    } m_dns[ESP8266_DNS_CACHE_SIZE];
+#endif
+    ESP8266EventHandler m_event_handler;
+    void *m_event_arg;
+
+    /* Transparent transmission */
+    bool m_passthrough;             /* all bytes received are data of the single link */
+    bool m_passthrough_prompt;      /* the command in flight turns it on at ">" */
+    unsigned long m_passthrough_tx; /* when data was last written */
+
+    uint32_t m_baud;                /* the baud rate of m_puart */
+    uint32_t m_baud_max;            /* what m_puart can take, for ESP8266_BAUD_MAX of 0 */
+    uint32_t m_baud_default;        /* the rate of ESP8266 after reset, 0 if not detected */
+    uint8_t m_baud_errors;          /* commands timed out since checkBaudrate() */
+
+    bool m_ready;                   /* "ready" received */
+    uint32_t m_boot_time;           /* of the last restart(), in milliseconds */
+
+    bool m_no_cwmode_cur;           /* the firmware has no AT+CWMODE_CUR */
+
+#if ESP8266_STATS
+    ESP8266StatsStream m_stats_uart;    /* m_puart */
+    ESP8266Stats m_stats;
+    int8_t m_stats_cmd;             /* the command counted, -1 if none */
+    unsigned long m_stats_start;
+    uint32_t m_stats_tx;            /* bytes when it started */
+    uint32_t m_stats_rx;
+#endif
+
+#if ESP8266_TRACE_SIZE
+    ESP8266TraceStream m_trace_uart;    /* m_puart */
 #endif
 };
 
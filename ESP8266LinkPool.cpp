@@ -0,0 +1,178 @@
+/**
+ * @file ESP8266LinkPool.cpp
+ * @brief The implementation of class ESP8266LinkPool.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "ESP8266LinkPool.h"
+
+ESP8266LinkPool::ESP8266LinkPool(ESP8266 &wifi): m_wifi(&wifi), m_reused(0), m_opened(0)
+{
+    uint8_t i;
+
+    for (i = 0; i < ESP8266_MAX_LINKS; i++) {
+        m_slots[i].busy = false;
+        m_slots[i].used = 0;
+    }
+    for (i = 0; i < ESP8266_LINK_POOL_ENDPOINTS; i++) {
+        m_endpoints[i].failures = 0;
+    }
+}
+
+int8_t ESP8266LinkPool::acquire(const ESP8266Segment &host, uint32_t port)
+{
+    ESP8266HostKey key(host);
+    int8_t free_id = -1;
+    int8_t idle_id = -1;
+    uint8_t i;
+
+    for (i = 0; i < ESP8266_MAX_LINKS; i++) {
+        Slot &slot = m_slots[i];
+
+        if (slot.key.len && !m_wifi->isConnected(i)) {
+            /* Closed by the other end, or by a timeout */
+            slot.key = ESP8266HostKey();
+        }
+        if (!slot.key.len) {
+            if (free_id < 0 && !m_wifi->isConnected(i)) {
+                free_id = i;
+            }
+            continue;
+        }
+        if (slot.busy) {
+            continue;
+        }
+        if (slot.key == key && slot.port == port) {
+            slot.busy = true;
+            slot.used = millis();
+            m_reused++;
+            return i;
+        }
+        if (idle_id < 0 || (long)(slot.used - m_slots[idle_id].used) < 0) {
+            idle_id = i;
+        }
+    }
+
+    if (free_id < 0) {
+        if (idle_id < 0) {
+            return -1;
+        }
+        /* Make room, the link used least recently goes */
+        if (!close(idle_id)) {
+            /* Still connected to its endpoint, "ALREADY CONNECT" would pass */
+            return -1;
+        }
+        free_id = idle_id;
+    }
+    if (!m_wifi->createTCP(free_id, host, port)) {
+        failure(key, port, true);
+        return -1;
+    }
+    failure(key, port, false);
+    m_slots[free_id].key = key;
+    m_slots[free_id].port = port;
+    m_slots[free_id].busy = true;
+    m_slots[free_id].used = millis();
+    m_opened++;
+    return free_id;
+}
+
+void ESP8266LinkPool::release(uint8_t mux_id)
+{
+    if (mux_id < ESP8266_MAX_LINKS && m_slots[mux_id].key.len) {
+        m_slots[mux_id].busy = false;
+        m_slots[mux_id].used = millis();
+    }
+}
+
+bool ESP8266LinkPool::close(uint8_t mux_id)
+{
+    if (mux_id >= ESP8266_MAX_LINKS || !m_slots[mux_id].key.len) {
+        return false;
+    }
+    if (!m_wifi->releaseTCP(mux_id) && m_wifi->isConnected(mux_id)) {
+        return false;
+    }
+    m_slots[mux_id].key = ESP8266HostKey();
+    return true;
+}
+
+void ESP8266LinkPool::expire(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < ESP8266_MAX_LINKS; i++) {
+        if (m_slots[i].key.len && !m_slots[i].busy 
+            && millis() - m_slots[i].used >= ESP8266_LINK_POOL_IDLE_TIME) {
+            close(i);
+        }
+    }
+}
+
+void ESP8266LinkPool::closeAll(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < ESP8266_MAX_LINKS; i++) {
+        close(i);
+    }
+}
+
+uint8_t ESP8266LinkPool::failures(const ESP8266Segment &host, uint32_t port)
+{
+    ESP8266HostKey key(host);
+    uint8_t i;
+
+    for (i = 0; i < ESP8266_LINK_POOL_ENDPOINTS; i++) {
+        if (m_endpoints[i].failures && m_endpoints[i].key == key && m_endpoints[i].port == port) {
+            return m_endpoints[i].failures;
+        }
+    }
+    return 0;
+}
+
+void ESP8266LinkPool::failure(const ESP8266HostKey &key, uint16_t port, bool failed)
+{
+    Endpoint *entry = NULL;
+    uint8_t i;
+
+    for (i = 0; i < ESP8266_LINK_POOL_ENDPOINTS; i++) {
+        Endpoint &e = m_endpoints[i];
+
+        if (e.failures && e.key == key && e.port == port) {
+            entry = &e;
+            break;
+        }
+        /* Otherwise a free entry, or the one which failed longest ago */
+        if (!entry || (entry->failures && (!e.failures || (long)(e.last - entry->last) < 0))) {
+            entry = &e;
+        }
+    }
+    if (!failed) {
+        if (i < ESP8266_LINK_POOL_ENDPOINTS) {
+            entry->failures = 0;
+        }
+        return;
+    }
+    if (i == ESP8266_LINK_POOL_ENDPOINTS) {
+        entry->key = key;
+        entry->port = port;
+        entry->failures = 0;
+    }
+    if (entry->failures < 255) {
+        entry->failures++;
+    }
+    entry->last = millis();
+}
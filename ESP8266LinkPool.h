@@ -0,0 +1,132 @@
+/**
+ * @file ESP8266LinkPool.h
+ * @brief The definition of class ESP8266LinkPool.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __ESP8266LINKPOOL_H__
+#define __ESP8266LINKPOOL_H__
+
+#include "ESP8266.h"
+
+/*
+ * How long(milliseconds) a released link may stay idle before expire() closes it.
+ */
+#ifndef ESP8266_LINK_POOL_IDLE_TIME
+#define ESP8266_LINK_POOL_IDLE_TIME     (60000)
+#endif
+
+/*
+ * The number of endpoints whose connection failures are counted.
+ */
+#ifndef ESP8266_LINK_POOL_ENDPOINTS
+#define ESP8266_LINK_POOL_ENDPOINTS     (4)
+#endif
+
+/**
+ * TCP links of multiple mode kept open and reused across exchanges. 
+ *
+ *     ESP8266LinkPool pool(wifi);
+ *     int8_t mux_id = pool.acquire(F("api.example.com"), 80);
+ *     if (mux_id >= 0) {
+ *         wifi.send(mux_id, request, len);
+ *         wifi.recv(mux_id, buffer, sizeof(buffer));
+ *         pool.release(mux_id);
+ *     }
+ *
+ * A link to the same host and port is reused while it is open, so the TCP 
+ * handshake is paid once. When all five links are taken, the idle link used 
+ * least recently is closed to make room. Links opened by other means(or 
+ * accepted by the server) are left alone. Endpoints are told apart by the 
+ * length and two hashes of the host(ESP8266HostKey), which keeps the pool small. 
+ *
+ * @note MUX must be enabled(ESP8266::enableMUX()). 
+ */
+class ESP8266LinkPool {
+ public:
+    ESP8266LinkPool(ESP8266 &wifi);
+
+    /**
+     * Get an open link to host:port for an exchange, until release(). 
+     *
+     * @param host - the name or IP address of the server.
+     * @param port - the port of the server.
+     * @return the mux_id of the link, -1 if none could be opened. 
+     */
+    int8_t acquire(const ESP8266Segment &host, uint32_t port);
+
+    /**
+     * Be done with a link for now. It stays open for the next acquire() of 
+     * its endpoint. 
+     */
+    void release(uint8_t mux_id);
+
+    /**
+     * Close a link of the pool, e.g. after a broken exchange. 
+     *
+     * @retval true - the link is closed and out of the pool. 
+     * @retval false - not a link of the pool, or AT+CIPCLOSE failed and it is 
+     *  still open; it then stays in the pool. 
+     */
+    bool close(uint8_t mux_id);
+
+    /**
+     * Close the links released more than ESP8266_LINK_POOL_IDLE_TIME ago. 
+     * To be called from time to time, e.g. from loop(). 
+     */
+    void expire(void);
+
+    /**
+     * Close all links of the pool. 
+     */
+    void closeAll(void);
+
+    /**
+     * Get the number of connection failures to host:port in a row, 0 once a 
+     * connection succeeds. 
+     */
+    uint8_t failures(const ESP8266Segment &host, uint32_t port);
+
+    /**
+     * Get the number of acquire() served by an open link, and by a new one. 
+     */
+    uint32_t reused(void) const { return m_reused; }
+    uint32_t opened(void) const { return m_opened; }
+
+ private:
+    /* Forget the failures of an endpoint, or count one more */
+    void failure(const ESP8266HostKey &key, uint16_t port, bool failed);
+
+    ESP8266 *m_wifi;
+
+    struct Slot {
+        ESP8266HostKey key;         /* of the host, empty if the link is not in the pool */
+        uint16_t port;
+        bool busy;                  /* acquired, not released yet */
+        unsigned long used;         /* when it was last acquired or released */
+    } m_slots[ESP8266_MAX_LINKS];
+
+    struct Endpoint {
+        ESP8266HostKey key;
+        uint16_t port;
+        uint8_t failures;           /* 0 if the entry is free */
+        unsigned long last;         /* when the last one happened */
+    } m_endpoints[ESP8266_LINK_POOL_ENDPOINTS];
+
+    uint32_t m_reused;
+    uint32_t m_opened;
+};
+
+#endif /* #ifndef __ESP8266LINKPOOL_H__ */
@@ -0,0 +1,196 @@
+/**
+ * @file ESP8266Log.h
+ * @brief Leveled logging and the trace of the UART.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __ESP8266LOG_H__
+#define __ESP8266LOG_H__
+
+#include "Arduino.h"
+
+#define ESP8266_LOG_NONE            (0)
+#define ESP8266_LOG_ERROR           (1)
+#define ESP8266_LOG_WARN            (2)
+#define ESP8266_LOG_INFO            (3)
+#define ESP8266_LOG_DEBUG           (4)
+
+/*
+ * The most detailed messages printed. The calls for more detailed ones
+ * are left out of the build.
+ */
+#ifndef ESP8266_LOG_LEVEL
+#define ESP8266_LOG_LEVEL           (ESP8266_LOG_WARN)
+#endif
+
+/*
+ * Where messages are printed.
+ */
+#ifndef ESP8266_LOG_OUTPUT
+#define ESP8266_LOG_OUTPUT          Serial
+#endif
+
+/*
+ * The number of bytes of UART traffic kept by the trace, 0 for no trace
+ * (see ESP8266::dumpTrace()).
+ */
+#ifndef ESP8266_TRACE_SIZE
+#define ESP8266_TRACE_SIZE          (0)
+#endif
+
+inline void ESP8266LogPrefix(uint8_t level)
+{
+    static const char levels[] PROGMEM = "EWID";
+
+    ESP8266_LOG_OUTPUT.print(F("[ESP8266 "));
+    ESP8266_LOG_OUTPUT.print((char)pgm_read_byte(levels + level - 1));
+    ESP8266_LOG_OUTPUT.print(F("] "));
+}
+
+inline void ESP8266Log(uint8_t level, const __FlashStringHelper *message)
+{
+    ESP8266LogPrefix(level);
+    ESP8266_LOG_OUTPUT.println(message);
+}
+
+template <class T>
+inline void ESP8266Log(uint8_t level, const __FlashStringHelper *message, const T &value)
+{
+    ESP8266LogPrefix(level);
+    ESP8266_LOG_OUTPUT.print(message);
+    ESP8266_LOG_OUTPUT.println(value);
+}
+
+/*
+ * logError("message") or logError("message: ", value). The message is
+ * kept in flash.
+ */
+#if ESP8266_LOG_LEVEL >= ESP8266_LOG_ERROR
+#define logError(message, ...)  ESP8266Log(ESP8266_LOG_ERROR, F(message), ##__VA_ARGS__)
+#else
+#define logError(message, ...)  do {} while (0)
+#endif
+
+#if ESP8266_LOG_LEVEL >= ESP8266_LOG_WARN
+#define logWarn(message, ...)   ESP8266Log(ESP8266_LOG_WARN, F(message), ##__VA_ARGS__)
+#else
+#define logWarn(message, ...)   do {} while (0)
+#endif
+
+#if ESP8266_LOG_LEVEL >= ESP8266_LOG_INFO
+#define logInfo(message, ...)   ESP8266Log(ESP8266_LOG_INFO, F(message), ##__VA_ARGS__)
+#else
+#define logInfo(message, ...)   do {} while (0)
+#endif
+
+#if ESP8266_LOG_LEVEL >= ESP8266_LOG_DEBUG
+#define logDebug(message, ...)  ESP8266Log(ESP8266_LOG_DEBUG, F(message), ##__VA_ARGS__)
+#else
+#define logDebug(message, ...)  do {} while (0)
+#endif
+
+#if ESP8266_TRACE_SIZE
+
+/**
+ * A byte which went through the UART.
+ */
+struct ESP8266TraceEntry {
+    uint16_t time;                  /**< millis(), modulo 65536 */
+    uint8_t tx;                     /**< 1 if written to ESP8266, 0 if read */
+    uint8_t c;
+};
+
+/**
+ * Record the bytes going through a Stream, the last ESP8266_TRACE_SIZE of them.
+ *
+ * Nothing is printed on the way, so the trace does not slow the UART down.
+ */
+class ESP8266TraceStream : public Stream {
+ public:
+    ESP8266TraceStream(Stream &stream): m_stream(&stream), m_head(0), m_count(0) {}
+
+    void attach(Stream &stream) { m_stream = &stream; }
+
+    int available(void) { return m_stream->available(); }
+    int peek(void) { return m_stream->peek(); }
+    void flush(void) { m_stream->flush(); }
+
+    int read(void)
+    {
+        int c = m_stream->read();
+        if (c != -1) {
+            record(0, c);
+        }
+        return c;
+    }
+
+    size_t write(uint8_t c)
+    {
+        record(1, c);
+        return m_stream->write(c);
+    }
+
+    size_t write(const uint8_t *buffer, size_t size)
+    {
+        size_t i;
+        for (i = 0; i < size; i++) {
+            record(1, buffer[i]);
+        }
+        return m_stream->write(buffer, size);
+    }
+
+    using Print::write;
+
+    /**
+     * Get the number of entries kept.
+     */
+    uint16_t count(void) const { return m_count; }
+
+    /**
+     * Get an entry, 0 being the oldest.
+     */
+    const ESP8266TraceEntry &entry(uint16_t i) const
+    {
+        i += m_head;
+        return m_entries[i >= ESP8266_TRACE_SIZE ? i - ESP8266_TRACE_SIZE : i];
+    }
+
+    void clear(void) { m_head = m_count = 0; }
+
+ private:
+    void record(uint8_t tx, uint8_t c)
+    {
+        uint16_t i = m_head + m_count;
+        ESP8266TraceEntry *e = &m_entries[i >= ESP8266_TRACE_SIZE ? i - ESP8266_TRACE_SIZE : i];
+
+        e->time = millis();
+        e->tx = tx;
+        e->c = c;
+        if (m_count < ESP8266_TRACE_SIZE) {
+            m_count++;
+        } else if (++m_head == ESP8266_TRACE_SIZE) {
+            m_head = 0;
+        }
+    }
+
+    Stream *m_stream;
+    ESP8266TraceEntry m_entries[ESP8266_TRACE_SIZE];
+    uint16_t m_head;
+    uint16_t m_count;
+};
+
+#endif /* #if ESP8266_TRACE_SIZE */
+
+#endif /* #ifndef __ESP8266LOG_H__ */
@@ -0,0 +1,434 @@
+/**
+ * @file ESP8266Mail.cpp
+ * @brief The implementation of the streaming mail parser.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "ESP8266Mail.h"
+
+static int8_t hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+static int8_t base64_value(char c)
+{
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A';
+    }
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 26;
+    }
+    if (c >= '0' && c <= '9') {
+        return c - '0' + 52;
+    }
+    if (c == '+') {
+        return 62;
+    }
+    if (c == '/') {
+        return 63;
+    }
+    return -1;
+}
+
+static bool is_blank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+/* Where the parameter name(with "=") starts in value, NULL if absent */
+static const char *find_param(const char *value, const char *name)
+{
+    uint8_t len = strlen(name);
+    for (; *value; value++) {
+        if (strncasecmp(value, name, len) == 0) {
+            return value + len;
+        }
+    }
+    return NULL;
+}
+
+ESP8266MailParser::ESP8266MailParser(void): m_sink(NULL), m_state(STATE_DONE), m_failed(false)
+{
+}
+
+void ESP8266MailParser::begin(ESP8266MailSink &sink)
+{
+    m_sink = &sink;
+    m_state = STATE_HEADERS;
+    m_part = 0;
+    m_last_part = 0;
+    m_status = true;
+    m_failed = false;
+    m_bol = true;
+    m_dot = false;
+    m_header_len = 0;
+    m_header_long = false;
+    m_truncated = 0;
+    m_line_len = 0;
+    m_line_long = false;
+    m_crlf = false;
+    m_depth = 0;
+    m_multipart = false;
+    m_encoding = ENCODING_NONE;
+    decode_flush();
+    m_out_len = 0;
+}
+
+uint32_t ESP8266MailParser::feed(const uint8_t *data, uint32_t len)
+{
+    uint32_t i;
+    for (i = 0; i < len && m_state != STATE_DONE; i++) {
+        feed((char)data[i]);
+    }
+    return i;
+}
+
+void ESP8266MailParser::feed(char c)
+{
+    if (m_state == STATE_DONE || c == '\r') {
+        return;
+    }
+
+    if (m_dot) {
+        m_dot = false;
+        if (c == '\n') {
+            finish(true);
+            return;
+        }
+        /* Any other dot at the beginning of a line was added by the server */
+    } else if (m_bol && c == '.') {
+        m_dot = true;
+        return;
+    }
+
+    if (c == '\n') {
+        line_end();
+        m_bol = true;
+    } else {
+        line_char(c);
+        m_bol = false;
+    }
+}
+
+void ESP8266MailParser::line_char(char c)
+{
+    uint8_t i;
+
+    if (m_state == STATE_HEADERS) {
+        header_char(c);
+        return;
+    }
+    if (m_line_long) {
+        if (m_state == STATE_BODY) {
+            decode(c);
+        }
+        return;
+    }
+    if (m_line_len < ESP8266_MAIL_LINE_SIZE) {
+        m_line[m_line_len++] = c;
+        return;
+    }
+
+    /* Too long for a boundary, so it is body from here on */
+    m_line_long = true;
+    if (m_state == STATE_BODY) {
+        if (m_crlf) {
+            decode('\r');
+            decode('\n');
+            m_crlf = false;
+        }
+        for (i = 0; i < m_line_len; i++) {
+            decode(m_line[i]);
+        }
+        decode(c);
+    }
+}
+
+void ESP8266MailParser::line_end(void)
+{
+    uint8_t i;
+
+    if (m_state == STATE_HEADERS) {
+        header_end();
+        return;
+    }
+    if (m_line_long || !boundary()) {
+        if (m_state == STATE_BODY) {
+            if (!m_line_long) {
+                if (m_crlf) {
+                    decode('\r');
+                    decode('\n');
+                }
+                for (i = 0; i < m_line_len; i++) {
+                    decode(m_line[i]);
+                }
+            }
+            if (m_encoding == ENCODING_QP && m_qp == 1) {
+                /* "=" at the end of the line is a soft line break */
+                m_qp = 0;
+                m_crlf = false;
+            } else {
+                m_crlf = true;
+            }
+            out_flush();
+        }
+    }
+    m_line_len = 0;
+    m_line_long = false;
+}
+
+bool ESP8266MailParser::boundary(void)
+{
+    uint8_t len, i;
+    int8_t k;
+    bool closing;
+
+    if (m_line_len < 2 || m_line[0] != '-' || m_line[1] != '-') {
+        return false;
+    }
+    /* An outer boundary also closes the inner levels */
+    for (k = m_depth - 1; k >= 0; k--) {
+        len = strlen(m_boundary[k]);
+        if (m_line_len < 2 + len || memcmp(m_line + 2, m_boundary[k], len) != 0) {
+            continue;
+        }
+        i = 2 + len;
+        closing = (m_line_len >= i + 2 && m_line[i] == '-' && m_line[i + 1] == '-');
+        if (closing) {
+            i += 2;
+        }
+        while (i < m_line_len && is_blank(m_line[i])) {
+            i++;
+        }
+        if (i < m_line_len) {
+            continue;
+        }
+
+        decode_flush();
+        out_flush();
+        m_crlf = false;
+        if (closing) {
+            m_depth = k;
+            m_state = STATE_SKIP;
+        } else {
+            m_depth = k + 1;
+            m_part = ++m_last_part;
+            m_state = STATE_HEADERS;
+            m_encoding = ENCODING_NONE;
+            m_multipart = false;
+            m_sink->part(m_part);
+        }
+        return true;
+    }
+    return false;
+}
+
+void ESP8266MailParser::header_char(char c)
+{
+    if (m_bol && !(is_blank(c) && m_header_len > 0)) {
+        /* Not folded, so the previous header is complete */
+        header_emit();
+    }
+    if (m_header_len < ESP8266_MAIL_HEADER_SIZE) {
+        m_header[m_header_len++] = c;
+    } else {
+        m_header_long = true;
+    }
+}
+
+void ESP8266MailParser::header_end(void)
+{
+    if (m_status) {
+        m_status = false;
+        if (m_header_len >= 4 && memcmp(m_header, "-ERR", 4) == 0) {
+            finish(false);
+            return;
+        }
+        if (m_header_len >= 3 && memcmp(m_header, "+OK", 3) == 0) {
+            m_header_len = 0;
+            return;
+        }
+    }
+    if (!m_bol) {
+        /* The header may go on in the next line */
+        return;
+    }
+
+    header_emit();
+    if (m_multipart) {
+        m_depth++;
+        m_state = STATE_SKIP;
+    } else {
+        m_state = STATE_BODY;
+    }
+}
+
+void ESP8266MailParser::header_emit(void)
+{
+    char *name = m_header;
+    char *value;
+    char *end;
+    const char *param;
+    uint8_t i;
+
+    if (m_header_len == 0) {
+        return;
+    }
+    m_header[m_header_len] = '\0';
+    if (m_header_long) {
+        m_truncated++;
+    }
+    m_header_len = 0;
+    m_header_long = false;
+
+    value = strchr(m_header, ':');
+    if (!value) {
+        return;
+    }
+    *value++ = '\0';
+    for (end = value - 1; end > name && is_blank(end[-1]); end--) {
+        end[-1] = '\0';
+    }
+    while (is_blank(*value)) {
+        value++;
+    }
+
+    if (strcasecmp(name, "Content-Type") == 0) {
+        param = find_param(value, "boundary=");
+        if (strncasecmp(value, "multipart/", 10) == 0 && param && m_depth < ESP8266_MAIL_MAX_DEPTH) {
+            if (*param == '"') {
+                param++;
+            }
+            for (i = 0; i < ESP8266_MAIL_BOUNDARY_SIZE && param[i]; i++) {
+                if (param[i] == '"' || param[i] == ';' || is_blank(param[i])) {
+                    break;
+                }
+                m_boundary[m_depth][i] = param[i];
+            }
+            m_boundary[m_depth][i] = '\0';
+            m_multipart = (i > 0);
+        }
+    } else if (strcasecmp(name, "Content-Transfer-Encoding") == 0) {
+        if (strncasecmp(value, "base64", 6) == 0) {
+            m_encoding = ENCODING_BASE64;
+        } else if (strncasecmp(value, "quoted-printable", 16) == 0) {
+            m_encoding = ENCODING_QP;
+        } else {
+            m_encoding = ENCODING_NONE;
+        }
+    }
+    m_sink->header(m_part, name, value);
+}
+
+void ESP8266MailParser::finish(bool ok)
+{
+    if (m_state == STATE_HEADERS) {
+        header_emit();
+    }
+    out_flush();
+    m_state = STATE_DONE;
+    m_failed = !ok;
+    m_sink->end(ok);
+}
+
+/*----------------------------------------------------------------------------*/
+/* Transfer encodings */
+
+void ESP8266MailParser::decode(char c)
+{
+    int8_t v;
+
+    switch (m_encoding) {
+    case ENCODING_BASE64:
+        v = base64_value(c);
+        if (v < 0) {
+            /* Line ends, padding and garbage */
+            return;
+        }
+        m_bits = (m_bits << 6) | v;
+        m_nbits += 6;
+        if (m_nbits >= 8) {
+            m_nbits -= 8;
+            out((uint8_t)(m_bits >> m_nbits));
+            m_bits &= (1 << m_nbits) - 1;
+        }
+        break;
+
+    case ENCODING_QP:
+        if (m_qp == 0) {
+            if (c == '=') {
+                m_qp = 1;
+            } else {
+                out(c);
+            }
+        } else {
+            v = hex_value(c);
+            if (v < 0) {
+                /* Not "=XX", keep it as it is */
+                out('=');
+                if (m_qp == 2) {
+                    out(m_qp_hi < 10 ? '0' + m_qp_hi : 'A' + m_qp_hi - 10);
+                }
+                out(c);
+                m_qp = 0;
+            } else if (m_qp == 1) {
+                m_qp_hi = v;
+                m_qp = 2;
+            } else {
+                out((m_qp_hi << 4) | v);
+                m_qp = 0;
+            }
+        }
+        break;
+
+    default:
+        out(c);
+        break;
+    }
+}
+
+void ESP8266MailParser::decode_flush(void)
+{
+    m_bits = 0;
+    m_nbits = 0;
+    m_qp = 0;
+    m_qp_hi = 0;
+}
+
+void ESP8266MailParser::out(uint8_t c)
+{
+    m_out[m_out_len++] = c;
+    if (m_out_len >= ESP8266_MAIL_CHUNK_SIZE) {
+        out_flush();
+    }
+}
+
+void ESP8266MailParser::out_flush(void)
+{
+    if (m_out_len > 0) {
+        m_sink->body(m_part, m_out, m_out_len);
+        m_out_len = 0;
+    }
+}
@@ -0,0 +1,202 @@
+/**
+ * @file ESP8266Mail.h
+ * @brief The definition of the streaming mail parser.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __ESP8266MAIL_H__
+#define __ESP8266MAIL_H__
+
+#include "Arduino.h"
+
+/*
+ * The longest header(name and unfolded value) passed whole to the sink.
+ */
+#ifndef ESP8266_MAIL_HEADER_SIZE
+#define ESP8266_MAIL_HEADER_SIZE    (128)
+#endif
+
+/*
+ * The longest MIME boundary kept(70 is the most RFC 2046 allows).
+ */
+#ifndef ESP8266_MAIL_BOUNDARY_SIZE
+#define ESP8266_MAIL_BOUNDARY_SIZE  (70)
+#endif
+
+/*
+ * How many multipart levels can be nested.
+ */
+#ifndef ESP8266_MAIL_MAX_DEPTH
+#define ESP8266_MAIL_MAX_DEPTH      (2)
+#endif
+
+/*
+ * The most decoded body bytes passed to the sink at once.
+ */
+#ifndef ESP8266_MAIL_CHUNK_SIZE
+#define ESP8266_MAIL_CHUNK_SIZE     (32)
+#endif
+
+/* Long enough for "--" boundary "--" */
+#define ESP8266_MAIL_LINE_SIZE      (ESP8266_MAIL_BOUNDARY_SIZE + 4)
+
+/**
+ * Receive what ESP8266MailParser finds in a message.
+ *
+ * Part 0 is the message itself, the parts of a multipart message are numbered
+ * from 1 in the order they come, whatever their nesting.
+ */
+class ESP8266MailSink {
+ public:
+    virtual ~ESP8266MailSink(void) {}
+
+    /**
+     * A header, unfolded.
+     *
+     * @param part - the part it belongs to.
+     * @param name - the name, as it is written.
+     * @param value - the value without the leading blanks, truncated to fit
+     *  ESP8266_MAIL_HEADER_SIZE.
+     */
+    virtual void header(uint8_t /* part */, const char * /* name */, const char * /* value */) {}
+
+    /**
+     * A new part of a multipart message starts, its headers follow.
+     */
+    virtual void part(uint8_t /* part */) {}
+
+    /**
+     * A piece of body, with the transfer encoding undone.
+     *
+     * Only parts which are not multipart themselves have a body.
+     */
+    virtual void body(uint8_t /* part */, const uint8_t * /* data */, uint16_t /* len */) {}
+
+    /**
+     * The message has ended.
+     *
+     * @param ok - false if the server answered "-ERR" instead of the message.
+     */
+    virtual void end(bool /* ok */) {}
+};
+
+/**
+ * Parse a message coming from POP3(RETR or TOP) one byte at a time.
+ *
+ * Headers are unfolded, multipart bodies are split at their boundaries and
+ * base64 or quoted-printable content is decoded on the fly, all in a fixed
+ * amount of memory whatever the size of the message. The "+OK" line before
+ * the message is skipped, dot-stuffing is undone and the message ends at the
+ * "." line.
+ */
+class ESP8266MailParser {
+ public:
+    ESP8266MailParser(void);
+
+    /**
+     * Start parsing a new message.
+     *
+     * @param sink - where the parts of the message go.
+     */
+    void begin(ESP8266MailSink &sink);
+
+    /**
+     * Feed bytes of the message.
+     */
+    void feed(char c);
+
+    /**
+     * Feed bytes of the message, stopping at its end.
+     *
+     * @return the number of bytes used, less than len if what follows the end
+     *  of the message was given too.
+     */
+    uint32_t feed(const uint8_t *data, uint32_t len);
+
+    /**
+     * Check whether the end of the message has been reached.
+     */
+    bool done(void) const { return m_state == STATE_DONE; }
+
+    /**
+     * Check whether the server answered "-ERR" instead of the message.
+     */
+    bool failed(void) const { return m_failed; }
+
+    /**
+     * Get how many headers were too long for ESP8266_MAIL_HEADER_SIZE.
+     */
+    uint16_t truncatedCount(void) const { return m_truncated; }
+
+ private:
+    enum State {
+        STATE_HEADERS,
+        STATE_BODY,
+        STATE_SKIP,     /* preamble and epilogue of multipart */
+        STATE_DONE
+    };
+    enum Encoding {
+        ENCODING_NONE,
+        ENCODING_BASE64,
+        ENCODING_QP
+    };
+
+    void line_char(char c);
+    void line_end(void);
+    void header_char(char c);
+    void header_end(void);
+    void header_emit(void);
+    bool boundary(void);
+    void finish(bool ok);
+
+    void decode(char c);
+    void decode_flush(void);
+    void out(uint8_t c);
+    void out_flush(void);
+
+    ESP8266MailSink *m_sink;
+    uint8_t m_state;
+    uint8_t m_part;
+    uint8_t m_last_part;
+    bool m_status;                  /* at the "+OK" line */
+    bool m_failed;
+    bool m_bol;                     /* at the beginning of a line */
+    bool m_dot;                     /* the line started with a "." */
+
+    char m_header[ESP8266_MAIL_HEADER_SIZE + 1];
+    uint8_t m_header_len;
+    bool m_header_long;
+    uint16_t m_truncated;
+
+    char m_line[ESP8266_MAIL_LINE_SIZE];
+    uint8_t m_line_len;
+    bool m_line_long;               /* too long for a boundary, decoded as it comes */
+    bool m_crlf;                    /* a line end is due before the next body line */
+
+    char m_boundary[ESP8266_MAIL_MAX_DEPTH][ESP8266_MAIL_BOUNDARY_SIZE + 1];
+    uint8_t m_depth;
+    bool m_multipart;               /* the headers so far declare a multipart */
+    uint8_t m_encoding;
+
+    uint16_t m_bits;                /* base64 bits not output yet */
+    uint8_t m_nbits;
+    uint8_t m_qp;                   /* chars of "=XX" seen */
+    uint8_t m_qp_hi;
+
+    uint8_t m_out[ESP8266_MAIL_CHUNK_SIZE];
+    uint8_t m_out_len;
+};
+
+#endif /* #ifndef __ESP8266MAIL_H__ */
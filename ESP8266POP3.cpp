@@ -0,0 +1,339 @@
+/**
+ * @file ESP8266POP3.cpp
+ * @brief The implementation of class ESP8266POP3.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "ESP8266POP3.h"
+
+/* "TOP 4294967295 4294967295\r\n" */
+#define COMMAND_SIZE    (28)
+
+static uint8_t put_number(char *buffer, uint32_t n)
+{
+    char digits[10];
+    uint8_t len = 0, i;
+
+    do {
+        digits[len++] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    for (i = 0; i < len; i++) {
+        buffer[i] = digits[len - 1 - i];
+    }
+    return len;
+}
+
+/* Write "command[ arg1[ arg2]]\r\n" into line */
+static void format_command(char *line, const char *command, uint32_t arg1, uint32_t arg2, uint8_t args)
+{
+    uint8_t len = strlen(command);
+
+    memcpy(line, command, len);
+    if (args > 0) {
+        line[len++] = ' ';
+        len += put_number(line + len, arg1);
+    }
+    if (args > 1) {
+        line[len++] = ' ';
+        len += put_number(line + len, arg2);
+    }
+    memcpy(line + len, "\r\n", 3);
+}
+
+static bool is_ok(const char *line)
+{
+    return strncmp(line, "+OK", 3) == 0;
+}
+
+ESP8266POP3::ESP8266POP3(ESP8266 &wifi): m_wifi(&wifi), m_pipelining(false), m_buf_pos(0), m_buf_len(0)
+{
+    m_line[0] = '\0';
+}
+
+bool ESP8266POP3::connect(const ESP8266Segment &host, uint32_t port)
+{
+    m_pipelining = false;
+    m_buf_pos = 0;
+    m_buf_len = 0;
+    if (!m_wifi->createTCP(host, port) || !status()) {
+        return false;
+    }
+
+    /* Servers without CAPA answer -ERR, which is fine */
+    if (!command("CAPA")) {
+        return false;
+    }
+    if (!read_line()) {
+        return false;
+    }
+    if (is_ok(m_line)) {
+        while (read_line()) {
+            if (strcmp(m_line, ".") == 0) {
+                return true;
+            }
+            if (strcasecmp(m_line, "PIPELINING") == 0) {
+                m_pipelining = true;
+            }
+        }
+        return false;
+    }
+    return true;
+}
+
+bool ESP8266POP3::login(const char *user, const char *pass)
+{
+    return command("USER", user) && status() && command("PASS", pass) && status();
+}
+
+bool ESP8266POP3::stat(uint32_t *count, uint32_t *size)
+{
+    char *end;
+
+    if (!command("STAT") || !status()) {
+        return false;
+    }
+    /* +OK count size */
+    if (count) {
+        *count = strtoul(m_line + 3, &end, 10);
+    } else {
+        strtoul(m_line + 3, &end, 10);
+    }
+    if (size) {
+        *size = strtoul(end, NULL, 10);
+    }
+    return true;
+}
+
+bool ESP8266POP3::list(uint32_t msg, uint32_t *size)
+{
+    char *end;
+
+    if (!command("LIST", msg, 0, 1) || !status()) {
+        return false;
+    }
+    /* +OK msg size */
+    strtoul(m_line + 3, &end, 10);
+    if (size) {
+        *size = strtoul(end, NULL, 10);
+    }
+    return true;
+}
+
+bool ESP8266POP3::list(ESP8266POP3Handler handler, void *arg)
+{
+    return command("LIST") && status() && read_lines(handler, arg);
+}
+
+bool ESP8266POP3::uidl(uint32_t msg, char *uid, size_t size)
+{
+    char *value;
+
+    if (!command("UIDL", msg, 0, 1) || !status()) {
+        return false;
+    }
+    /* +OK msg uid */
+    strtoul(m_line + 3, &value, 10);
+    while (*value == ' ') {
+        value++;
+    }
+    if (uid && size > 0) {
+        strncpy(uid, value, size - 1);
+        uid[size - 1] = '\0';
+    }
+    return true;
+}
+
+bool ESP8266POP3::uidl(ESP8266POP3Handler handler, void *arg)
+{
+    return command("UIDL") && status() && read_lines(handler, arg);
+}
+
+bool ESP8266POP3::retr(uint32_t msg, ESP8266MailSink &sink)
+{
+    return command("RETR", msg, 0, 1) && read_mail(sink) > 0;
+}
+
+bool ESP8266POP3::top(uint32_t msg, uint32_t lines, ESP8266MailSink &sink)
+{
+    return command("TOP", msg, lines, 2) && read_mail(sink) > 0;
+}
+
+bool ESP8266POP3::dele(uint32_t msg)
+{
+    return command("DELE", msg, 0, 1) && status();
+}
+
+bool ESP8266POP3::rset(void)
+{
+    return command("RSET") && status();
+}
+
+bool ESP8266POP3::fetch(uint32_t first, uint32_t count, ESP8266MailSink &sink, bool remove)
+{
+    char lines[ESP8266_POP3_PIPELINE * 2][COMMAND_SIZE];
+    ESP8266Segment segments[ESP8266_POP3_PIPELINE * 2];
+    uint32_t msg, end = first + count;
+    uint8_t depth = m_pipelining ? ESP8266_POP3_PIPELINE : 1;
+    uint8_t batch, n, i;
+    bool ok = true;
+
+    for (msg = first; msg < end; msg += batch) {
+        batch = end - msg < depth ? end - msg : depth;
+
+        /*
+         * All commands of the batch in one AT+CIPSEND. Without PIPELINING
+         * the server may not read ahead, so DELE waits for the RETR
+         * response below.
+         */
+        for (i = 0, n = 0; i < batch; i++) {
+            format_command(lines[n], "RETR", msg + i, 0, 1);
+            segments[n] = ESP8266Segment(lines[n]);
+            n++;
+            if (remove && m_pipelining) {
+                format_command(lines[n], "DELE", msg + i, 0, 1);
+                segments[n] = ESP8266Segment(lines[n]);
+                n++;
+            }
+        }
+        if (!m_wifi->send(segments, n)) {
+            return false;
+        }
+
+        /* The responses come in the same order */
+        for (i = 0; i < batch; i++) {
+            switch (read_mail(sink)) {
+            case 1:
+                break;
+            case 0:
+                ok = false;
+                break;
+            default:
+                return false;
+            }
+            if (remove) {
+                if (!m_pipelining && !command("DELE", msg + i, 0, 1)) {
+                    return false;
+                }
+                if (!read_line()) {
+                    return false;
+                }
+                ok = ok && is_ok(m_line);
+            }
+        }
+    }
+    return ok;
+}
+
+bool ESP8266POP3::quit(void)
+{
+    bool ok = command("QUIT") && status();
+    m_wifi->releaseTCP();
+    return ok;
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool ESP8266POP3::command(const char *command, uint32_t arg1, uint32_t arg2, uint8_t args)
+{
+    char line[COMMAND_SIZE];
+    format_command(line, command, arg1, arg2, args);
+    return m_wifi->send((const uint8_t *)line, strlen(line));
+}
+
+bool ESP8266POP3::command(const char *command, const char *arg)
+{
+    ESP8266Segment segments[] = {command, " ", arg, "\r\n"};
+    return m_wifi->send(segments, 4);
+}
+
+bool ESP8266POP3::status(void)
+{
+    return read_line() && is_ok(m_line);
+}
+
+bool ESP8266POP3::fill(void)
+{
+    if (m_buf_pos == m_buf_len) {
+        m_buf_pos = 0;
+        m_buf_len = m_wifi->recv(m_buf, sizeof(m_buf), ESP8266_POP3_TIMEOUT);
+    }
+    return m_buf_len > 0;
+}
+
+int ESP8266POP3::read(void)
+{
+    if (!fill()) {
+        return -1;
+    }
+    return m_buf[m_buf_pos++];
+}
+
+bool ESP8266POP3::read_line(void)
+{
+    uint8_t len = 0;
+    int c;
+
+    while ((c = read()) != -1) {
+        if (c == '\n') {
+            m_line[len] = '\0';
+            return true;
+        }
+        if (c != '\r' && len < ESP8266_POP3_LINE_SIZE) {
+            m_line[len++] = c;
+        }
+    }
+    m_line[0] = '\0';
+    return false;
+}
+
+bool ESP8266POP3::read_lines(ESP8266POP3Handler handler, void *arg)
+{
+    const char *line;
+    char *value;
+    uint32_t msg;
+
+    while (read_line()) {
+        line = m_line;
+        if (line[0] == '.') {
+            if (line[1] == '\0') {
+                return true;
+            }
+            line++;
+        }
+        msg = strtoul(line, &value, 10);
+        while (*value == ' ') {
+            value++;
+        }
+        if (handler) {
+            handler(msg, value, arg);
+        }
+    }
+    return false;
+}
+
+int8_t ESP8266POP3::read_mail(ESP8266MailSink &sink)
+{
+    ESP8266MailParser parser;
+
+    parser.begin(sink);
+    while (!parser.done()) {
+        if (!fill()) {
+            return -1;
+        }
+        m_buf_pos += parser.feed(m_buf + m_buf_pos, m_buf_len - m_buf_pos);
+    }
+    return parser.failed() ? 0 : 1;
+}
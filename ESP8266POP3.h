@@ -0,0 +1,191 @@
+/**
+ * @file ESP8266POP3.h
+ * @brief The definition of class ESP8266POP3.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __ESP8266POP3_H__
+#define __ESP8266POP3_H__
+
+#include "ESP8266.h"
+#include "ESP8266Mail.h"
+
+/*
+ * The longest response line kept(status, LIST and UIDL lines).
+ */
+#ifndef ESP8266_POP3_LINE_SIZE
+#define ESP8266_POP3_LINE_SIZE      (80)
+#endif
+
+/*
+ * The most messages fetch() asks for at once when the server has PIPELINING.
+ */
+#ifndef ESP8266_POP3_PIPELINE
+#define ESP8266_POP3_PIPELINE       (4)
+#endif
+
+/*
+ * How long(milliseconds) to wait for the server before giving up.
+ */
+#ifndef ESP8266_POP3_TIMEOUT
+#define ESP8266_POP3_TIMEOUT        (10000)
+#endif
+
+/**
+ * Called for each line of LIST or UIDL.
+ *
+ * @param msg - the number of the message.
+ * @param value - its size for LIST, its unique id for UIDL.
+ * @param arg - the argument given to list() or uidl().
+ */
+typedef void (*ESP8266POP3Handler)(uint32_t msg, const char *value, void *arg);
+
+/**
+ * A POP3 client on the TCP link of single mode.
+ *
+ *     ESP8266POP3 pop(wifi);
+ *     uint32_t count, size;
+ *     if (pop.connect("pop.example.com") && pop.login(USER, PASS) && pop.stat(&count, &size)) {
+ *         pop.fetch(1, count, sink, true);
+ *         pop.quit();
+ *     }
+ *
+ * Messages are parsed by ESP8266MailParser as they come and passed to an
+ * ESP8266MailSink, so their size does not matter.
+ */
+class ESP8266POP3 {
+ public:
+    ESP8266POP3(ESP8266 &wifi);
+
+    /**
+     * Connect to the server, read its greeting and its capabilities(CAPA).
+     *
+     * @param host - the name or IP address of the server.
+     * @param port - the port of the server.
+     * @retval true - success.
+     * @retval false - failure.
+     */
+    bool connect(const ESP8266Segment &host, uint32_t port = 110);
+
+    /**
+     * Log in with USER and PASS.
+     */
+    bool login(const char *user, const char *pass);
+
+    /**
+     * Get the number of messages and their total size(STAT).
+     */
+    bool stat(uint32_t *count, uint32_t *size);
+
+    /**
+     * Get the size of a message(LIST msg).
+     */
+    bool list(uint32_t msg, uint32_t *size);
+
+    /**
+     * Get the size of every message(LIST), one call of handler each.
+     */
+    bool list(ESP8266POP3Handler handler, void *arg = NULL);
+
+    /**
+     * Get the unique id of a message(UIDL msg).
+     *
+     * @param uid - where to put the id, truncated to fit size.
+     */
+    bool uidl(uint32_t msg, char *uid, size_t size);
+
+    /**
+     * Get the unique id of every message(UIDL), one call of handler each.
+     */
+    bool uidl(ESP8266POP3Handler handler, void *arg = NULL);
+
+    /**
+     * Retrieve a message(RETR).
+     *
+     * @param sink - where the parsed message goes.
+     */
+    bool retr(uint32_t msg, ESP8266MailSink &sink);
+
+    /**
+     * Retrieve the headers and the first lines of the body of a message(TOP).
+     */
+    bool top(uint32_t msg, uint32_t lines, ESP8266MailSink &sink);
+
+    /**
+     * Mark a message to be removed at quit()(DELE).
+     */
+    bool dele(uint32_t msg);
+
+    /**
+     * Unmark all messages marked by dele()(RSET).
+     */
+    bool rset(void);
+
+    /**
+     * Retrieve messages first to first + count - 1, and mark each one to be
+     * removed if remove is true.
+     *
+     * If the server has PIPELINING, up to ESP8266_POP3_PIPELINE messages are
+     * asked for in one go, so the round trip is paid once for all of them.
+     * sink.end() is called once for each message, in order.
+     *
+     * @note With PIPELINING, DELE is sent along with RETR, before the message
+     *  has come; without it, DELE waits for the message. Use rset() if
+     *  something goes wrong before quit().
+     * @retval true - all messages were received(and removed).
+     * @retval false - failure.
+     */
+    bool fetch(uint32_t first, uint32_t count, ESP8266MailSink &sink, bool remove = false);
+
+    /**
+     * Remove the marked messages and close the connection(QUIT).
+     */
+    bool quit(void);
+
+    /**
+     * Check whether the server has PIPELINING.
+     */
+    bool pipelining(void) const { return m_pipelining; }
+
+ private:
+    /* Send "command[ arg1[ arg2]]\r\n" to the server */
+    bool command(const char *command, uint32_t arg1 = 0, uint32_t arg2 = 0, uint8_t args = 0);
+    bool command(const char *command, const char *arg);
+
+    /* Read a status line, true for "+OK" */
+    bool status(void);
+
+    /* Read a line into m_line, without the line end */
+    bool read_line(void);
+    int read(void);
+
+    /* Receive more if all received has been used */
+    bool fill(void);
+
+    /* Read the lines of a multi-line response up to "." */
+    bool read_lines(ESP8266POP3Handler handler, void *arg);
+
+    /* Read a message into sink: 1 if received, 0 for "-ERR", -1 if the server went silent */
+    int8_t read_mail(ESP8266MailSink &sink);
+
+    ESP8266 *m_wifi;
+    bool m_pipelining;
+    char m_line[ESP8266_POP3_LINE_SIZE + 1];
+    uint8_t m_buf[32];              /* received, not used yet */
+    uint8_t m_buf_pos;
+    uint8_t m_buf_len;
+};
+
+#endif /* #ifndef __ESP8266POP3_H__ */
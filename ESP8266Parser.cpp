@@ -0,0 +1,460 @@
+/**
+ * @file ESP8266Parser.cpp
+ * @brief The implementation of the incremental parsers for ESP8266.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "ESP8266Parser.h"
+
+/*----------------------------------------------------------------------------*/
+/* +IPD,<id>,<len>:<data> */
+/* +IPD,<len>:<data> */
+
+#define IPD_PREFIX          "+IPD,"
+#define IPD_PREFIX_LEN      (5)
+#define IPD_MAX_DIGITS      (5)
+#define IPD_MAX_ID          (4)
+
+#define STATE_FIRST         (IPD_PREFIX_LEN)        /* <id> or <len> */
+#define STATE_SECOND        (IPD_PREFIX_LEN + 1)    /* <len> after <id> */
+
+ESP8266IPDParser::ESP8266IPDParser(void)
+{
+    reset();
+    m_id = -1;
+    m_len = 0;
+}
+
+void ESP8266IPDParser::reset(void)
+{
+    m_state = 0;
+    m_digits = 0;
+    m_num = 0;
+}
+
+bool ESP8266IPDParser::restart(char c)
+{
+    reset();
+    /* "+IPD," can only overlap itself at its first char */
+    if (c == '+') {
+        m_state = 1;
+    }
+    return false;
+}
+
+bool ESP8266IPDParser::feed(char c)
+{
+    if (m_state < IPD_PREFIX_LEN) {
+        if (c == IPD_PREFIX[m_state]) {
+            m_state++;
+            return false;
+        }
+        return restart(c);
+    }
+
+    if (c >= '0' && c <= '9') {
+        if (m_digits >= IPD_MAX_DIGITS) {
+            return restart(c);
+        }
+        m_num = m_num * 10 + (c - '0');
+        m_digits++;
+        return false;
+    }
+
+    if (m_digits == 0) {
+        return restart(c);
+    }
+
+    if (c == ',' && m_state == STATE_FIRST) {
+        if (m_num > IPD_MAX_ID) {
+            return restart(c);
+        }
+        m_id = (int8_t)m_num;
+        m_state = STATE_SECOND;
+        m_digits = 0;
+        m_num = 0;
+        return false;
+    }
+
+    if (c == ':' && m_num > 0) {
+        if (m_state == STATE_FIRST) {
+            m_id = -1;
+        }
+        m_len = m_num;
+        reset();
+        return true;
+    }
+
+    return restart(c);
+}
+
+/*----------------------------------------------------------------------------*/
+
+ESP8266Matcher::ESP8266Matcher(void): m_progmem(false), m_count(0)
+{
+    reset();
+}
+
+bool ESP8266Matcher::begin(const char *target)
+{
+    return begin(&target, 1);
+}
+
+bool ESP8266Matcher::begin(const char * const targets[], uint8_t count)
+{
+    m_count = 0;
+    reset();
+    if (count > ESP8266_MATCHER_MAX_TARGETS) {
+        return false;
+    }
+    memcpy(m_text, targets, count * sizeof(targets[0]));
+    m_progmem = false;
+    m_count = count;
+    return build();
+}
+
+bool ESP8266Matcher::begin_P(const char * const targets[], uint8_t count)
+{
+    m_count = 0;
+    reset();
+    if (count > ESP8266_MATCHER_MAX_TARGETS) {
+        return false;
+    }
+    memcpy_P(m_text, targets, count * sizeof(targets[0]));
+    m_progmem = true;
+    m_count = count;
+    return build();
+}
+
+bool ESP8266Matcher::build(void)
+{
+    uint16_t base = 0;
+    uint8_t i, q, k, len;
+
+    for (i = 0; i < m_count; i++) {
+        len = m_progmem ? strlen_P(m_text[i]) : strlen(m_text[i]);
+        if (len == 0 || base + len > ESP8266_MATCHER_TABLE_SIZE) {
+            m_count = 0;
+            return false;
+        }
+        m_len[i] = len;
+        m_base[i] = base;
+
+        /* m_fail[base + q] - the longest proper border of t[0..q] */
+        m_fail[base] = 0;
+        k = 0;
+        for (q = 1; q < len; q++) {
+            while (k > 0 && text(i, q) != text(i, k)) {
+                k = m_fail[base + k - 1];
+            }
+            if (text(i, q) == text(i, k)) {
+                k++;
+            }
+            m_fail[base + q] = k;
+        }
+        base += len;
+    }
+    return true;
+}
+
+void ESP8266Matcher::reset(void)
+{
+    memset(m_state, 0, sizeof(m_state));
+    m_fed = 0;
+    m_offset = 0;
+    m_found = -1;
+}
+
+int8_t ESP8266Matcher::feed(char c)
+{
+    int8_t ret = -1;
+    uint8_t i, q;
+
+    m_fed++;
+    for (i = 0; i < m_count; i++) {
+        q = m_state[i];
+        while (q > 0 && text(i, q) != c) {
+            q = m_fail[m_base[i] + q - 1];
+        }
+        if (text(i, q) == c) {
+            q++;
+        }
+        if (q == m_len[i]) {
+            if (ret < 0) {
+                ret = i;
+            }
+            q = m_fail[m_base[i] + q - 1];
+        }
+        m_state[i] = q;
+    }
+
+    if (ret >= 0 && m_found < 0) {
+        m_found = ret;
+        m_offset = m_fed - m_len[ret];
+    }
+    return ret;
+}
+
+/*----------------------------------------------------------------------------*/
+/* +CWLAP:(<ecn>,"<ssid>",<rssi>,"<mac>",<ch>,...) */
+
+#define CWLAP_PREFIX        "+CWLAP:("
+#define CWLAP_PREFIX_LEN    (8)
+#define STATE_FIELDS        (CWLAP_PREFIX_LEN)
+#define KIND_NONE           (16)    /* past the bits of the mask */
+
+ESP8266APParser::ESP8266APParser(uint16_t mask): m_mask(mask)
+{
+    reset();
+    memset(&m_ap, 0, sizeof(m_ap));
+}
+
+void ESP8266APParser::reset(void)
+{
+    m_state = 0;
+}
+
+bool ESP8266APParser::feed(char c)
+{
+    if (m_state < CWLAP_PREFIX_LEN) {
+        if (c == CWLAP_PREFIX[m_state]) {
+            m_state++;
+        } else {
+            m_state = (c == '+') ? 1 : 0;
+        }
+        if (m_state == STATE_FIELDS) {
+            memset(&m_ap, 0, sizeof(m_ap));
+            m_quoted = false;
+            m_escape = false;
+            field_begin(0);
+        }
+        return false;
+    }
+
+    if (m_quoted) {
+        if (m_escape) {
+            m_escape = false;
+            field_char(c);
+        } else if (c == '\\') {
+            m_escape = true;
+        } else if (c == '"') {
+            m_quoted = false;
+        } else {
+            field_char(c);
+        }
+        return false;
+    }
+    switch (c) {
+    case '"':
+        m_quoted = true;
+        break;
+    case ',':
+        field_end();
+        field_begin(m_kind + 1);
+        break;
+    case ')':
+        field_end();
+        m_state = 0;
+        return true;
+    case '\r':
+    case '\n':
+        /* Cut short */
+        m_state = 0;
+        break;
+    default:
+        field_char(c);
+        break;
+    }
+    return false;
+}
+
+void ESP8266APParser::field_begin(uint8_t kind)
+{
+    while (kind < KIND_NONE && !(m_mask & (1 << kind))) {
+        kind++;
+    }
+    m_kind = kind;
+    m_negative = false;
+    m_len = 0;
+    m_num = 0;
+}
+
+void ESP8266APParser::field_char(char c)
+{
+    uint8_t nibble;
+
+    switch (m_kind < KIND_NONE ? 1 << m_kind : 0) {
+    case ESP8266_AP_SSID:
+        if (m_len < sizeof(m_ap.ssid) - 1) {
+            m_ap.ssid[m_len++] = c;
+        }
+        break;
+    case ESP8266_AP_MAC:
+        if (c >= '0' && c <= '9') {
+            nibble = c - '0';
+        } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+            nibble = (c | 0x20) - 'a' + 10;
+        } else {
+            break;
+        }
+        if (m_len < 2 * sizeof(m_ap.mac)) {
+            m_ap.mac[m_len / 2] = (m_ap.mac[m_len / 2] << 4) | nibble;
+            m_len++;
+        }
+        break;
+    default:
+        if (c == '-') {
+            m_negative = true;
+        } else if (c >= '0' && c <= '9' && m_num < 1000) {
+            m_num = m_num * 10 + (c - '0');
+        }
+        break;
+    }
+}
+
+void ESP8266APParser::field_end(void)
+{
+    switch (m_kind < KIND_NONE ? 1 << m_kind : 0) {
+    case ESP8266_AP_ECN:
+        m_ap.ecn = m_num;
+        break;
+    case ESP8266_AP_RSSI:
+        m_ap.rssi = m_negative ? -m_num : m_num;
+        break;
+    case ESP8266_AP_CHANNEL:
+        m_ap.channel = m_num;
+        break;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/* +CIPSTATUS:<id>,"<type>","<ip>",<remote port>,<local port>,<server> */
+
+#define CIPSTATUS_PREFIX        "+CIPSTATUS:"
+#define CIPSTATUS_PREFIX_LEN    (11)
+
+enum {
+    FIELD_ID = 0,
+    FIELD_TYPE,
+    FIELD_IP,
+    FIELD_REMOTE_PORT,
+    FIELD_LOCAL_PORT,
+    FIELD_SERVER,
+};
+
+ESP8266LinkParser::ESP8266LinkParser(void)
+{
+    reset();
+    m_id = 0;
+    memset(&m_info, 0, sizeof(m_info));
+}
+
+void ESP8266LinkParser::reset(void)
+{
+    m_state = 0;
+}
+
+bool ESP8266LinkParser::feed(char c)
+{
+    if (m_state < CIPSTATUS_PREFIX_LEN) {
+        if (c == CIPSTATUS_PREFIX[m_state]) {
+            m_state++;
+        } else {
+            m_state = (c == '+') ? 1 : 0;
+        }
+        if (m_state == CIPSTATUS_PREFIX_LEN) {
+            memset(&m_info, 0, sizeof(m_info));
+            m_info.state = ESP8266_LINK_CONNECTED;
+            m_quoted = false;
+            m_field = FIELD_ID;
+            m_len = 0;
+            m_octet = 0;
+            m_num = 0;
+        }
+        return false;
+    }
+
+    if (m_quoted) {
+        if (c == '"') {
+            m_quoted = false;
+        } else {
+            field_char(c);
+        }
+        return false;
+    }
+    switch (c) {
+    case '"':
+        m_quoted = true;
+        break;
+    case ',':
+        field_end();
+        m_field++;
+        m_len = 0;
+        m_num = 0;
+        break;
+    case '\r':
+    case '\n':
+        field_end();
+        m_state = 0;
+        /* Older firmware stops after the local port */
+        return m_field >= FIELD_LOCAL_PORT;
+    default:
+        field_char(c);
+        break;
+    }
+    return false;
+}
+
+void ESP8266LinkParser::field_char(char c)
+{
+    if (m_field == FIELD_TYPE) {
+        if (m_len++ == 0) {
+            m_info.type = (c == 'U') ? ESP8266_LINK_UDP : (c == 'S') ? ESP8266_LINK_SSL : ESP8266_LINK_TCP;
+        }
+    } else if (m_field == FIELD_IP && c == '.' && m_octet < 3) {
+        m_info.ip[m_octet++] = m_num;
+        m_num = 0;
+    } else if (c >= '0' && c <= '9' && m_num < 6554) {
+        m_num = m_num * 10 + (c - '0');
+    } else if (m_field == FIELD_IP) {
+        /* A host name */
+        m_octet = 4;
+    }
+}
+
+void ESP8266LinkParser::field_end(void)
+{
+    switch (m_field) {
+    case FIELD_ID:
+        m_id = m_num;
+        break;
+    case FIELD_IP:
+        if (m_octet == 3) {
+            m_info.ip[3] = m_num;
+        } else {
+            memset(m_info.ip, 0, sizeof(m_info.ip));
+        }
+        break;
+    case FIELD_REMOTE_PORT:
+        m_info.remote_port = m_num;
+        break;
+    case FIELD_LOCAL_PORT:
+        m_info.local_port = m_num;
+        break;
+    case FIELD_SERVER:
+        m_info.server = (m_num == 1);
+        break;
+    }
+}
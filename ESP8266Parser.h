@@ -0,0 +1,313 @@
+/**
+ * @file ESP8266Parser.h
+ * @brief Incremental parsers for the byte stream coming from ESP8266.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __ESP8266PARSER_H__
+#define __ESP8266PARSER_H__
+
+#include "Arduino.h"
+
+/**
+ * Recognise the header of an incoming package, one byte at a time.
+ *
+ * Both "+IPD,<id>,<len>:" (multiple mode) and "+IPD,<len>:" (single mode) are
+ * accepted. Each byte costs O(1) and no String is kept, so the parser can sit
+ * directly on the UART. Malformed headers are dropped silently and scanning
+ * goes on from the offending byte.
+ */
+class ESP8266IPDParser {
+ public:
+    ESP8266IPDParser(void);
+
+    /**
+     * Forget any partially matched header.
+     */
+    void reset(void);
+
+    /**
+     * Feed one byte from ESP8266.
+     *
+     * @param c - the byte received.
+     * @retval true - c was the ':' closing a valid header, the next length() bytes are data.
+     * @retval false - no complete header yet.
+     */
+    bool feed(char c);
+
+    /**
+     * The identifier of the last complete header(0 - 4), or -1 in single mode.
+     */
+    int8_t id(void) const { return m_id; }
+
+    /**
+     * The length of data announced by the last complete header.
+     */
+    uint32_t length(void) const { return m_len; }
+
+ private:
+    bool restart(char c);
+
+    uint8_t m_state;    /* chars of "+IPD," matched, then STATE_FIRST/STATE_SECOND */
+    uint8_t m_digits;   /* digits in the number being read */
+    uint32_t m_num;     /* the number being read */
+    int8_t m_id;
+    uint32_t m_len;
+};
+
+/*
+ * The most targets one ESP8266Matcher can look for at the same time. 
+ */
+#ifndef ESP8266_MATCHER_MAX_TARGETS
+#define ESP8266_MATCHER_MAX_TARGETS     (8)
+#endif
+
+/*
+ * The total length of all targets of one ESP8266Matcher. 
+ */
+#ifndef ESP8266_MATCHER_TABLE_SIZE
+#define ESP8266_MATCHER_TABLE_SIZE      (64)
+#endif
+
+/**
+ * Look for several targets in a stream at once, one byte at a time.
+ *
+ * The failure tables(KMP) of all targets are built once by begin(), after
+ * which every byte costs O(1) per target and no memory is allocated. The
+ * matcher reports which target was found first and where it starts, so
+ * the response does not need to be kept nor searched again.
+ *
+ * The targets themselves are not copied and must outlive the matcher. They
+ * may be kept in flash, see begin_P().
+ */
+class ESP8266Matcher {
+ public:
+    ESP8266Matcher(void);
+
+    /**
+     * Set the targets to look for and reset the matcher. 
+     *
+     * @param targets - the array of targets. 
+     * @param count - the number of targets(no more than ESP8266_MATCHER_MAX_TARGETS). 
+     * @retval true - success.
+     * @retval false - too many or too long targets, nothing will be found. 
+     */
+    bool begin(const char * const targets[], uint8_t count);
+
+    /**
+     * Set a single target to look for and reset the matcher. 
+     */
+    bool begin(const char *target);
+
+    /**
+     * Set targets kept in flash and reset the matcher. 
+     *
+     * @param targets - the array of targets, the array and the strings in PROGMEM. 
+     * @param count - the number of targets(no more than ESP8266_MATCHER_MAX_TARGETS). 
+     */
+    bool begin_P(const char * const targets[], uint8_t count);
+
+    /**
+     * Restart matching from scratch with the same targets. 
+     */
+    void reset(void);
+
+    /**
+     * Feed one byte of the stream. 
+     *
+     * @param c - the byte received. 
+     * @return the index of the target completed by c, -1 if none. 
+     */
+    int8_t feed(char c);
+
+    /**
+     * The index of the first target found since reset, -1 if none. 
+     */
+    int8_t found(void) const { return m_found; }
+
+    /**
+     * The position of the first target found in the bytes fed since reset. 
+     */
+    uint32_t offset(void) const { return m_offset; }
+
+    /**
+     * The number of bytes fed since reset. 
+     */
+    uint32_t fed(void) const { return m_fed; }
+
+ private:
+    bool build(void);
+    char text(uint8_t i, uint8_t q) const
+    {
+        return m_progmem ? pgm_read_byte(m_text[i] + q) : m_text[i][q];
+    }
+
+    const char *m_text[ESP8266_MATCHER_MAX_TARGETS];
+    bool m_progmem;                 /* m_text points to flash */
+    uint8_t m_count;
+    uint8_t m_len[ESP8266_MATCHER_MAX_TARGETS];
+    uint8_t m_base[ESP8266_MATCHER_MAX_TARGETS];   /* index of its failure table in m_fail */
+    uint8_t m_state[ESP8266_MATCHER_MAX_TARGETS];  /* chars of the target matched so far */
+    uint8_t m_fail[ESP8266_MATCHER_TABLE_SIZE];
+    uint32_t m_fed;
+    uint32_t m_offset;
+    int8_t m_found;
+};
+
+/*
+ * The fields of AT+CWLAP, as bits of the mask of AT+CWLAPOPT. 
+ */
+#define ESP8266_AP_ECN          (1 << 0)
+#define ESP8266_AP_SSID         (1 << 1)
+#define ESP8266_AP_RSSI         (1 << 2)
+#define ESP8266_AP_MAC          (1 << 3)
+#define ESP8266_AP_CHANNEL      (1 << 4)
+#define ESP8266_AP_ALL          (0xFFFF)
+
+/**
+ * An access point found by AT+CWLAP. Fields left out by AT+CWLAPOPT are 0. 
+ */
+struct ESP8266AP {
+    char ssid[33];      /**< terminated by '\0' */
+    uint8_t mac[6];
+    int8_t rssi;        /**< dBm */
+    uint8_t ecn;        /**< 0 - OPEN, 1 - WEP, 2 - WPA_PSK, 3 - WPA2_PSK, 4 - WPA_WPA2_PSK */
+    uint8_t channel;
+};
+
+/**
+ * Parse "+CWLAP:(ecn,"ssid",rssi,"mac",ch,...)" lines one byte at a time. 
+ *
+ * The fields come in the order of the bits of the mask given to AT+CWLAPOPT, 
+ * those the parser does not know are skipped. SSIDs may hold ',', ')' and 
+ * '\"'. 
+ */
+class ESP8266APParser {
+ public:
+    /**
+     * @param mask - the fields the lines have, ESP8266_AP_ALL for all of them. 
+     */
+    ESP8266APParser(uint16_t mask = ESP8266_AP_ALL);
+
+    /**
+     * Forget any partially parsed line. 
+     */
+    void reset(void);
+
+    /**
+     * Feed one byte from ESP8266. 
+     *
+     * @retval true - c was the ')' closing a line, see ap(). 
+     * @retval false - no complete line yet. 
+     */
+    bool feed(char c);
+
+    /**
+     * The access point of the last complete line. 
+     */
+    const ESP8266AP &ap(void) const { return m_ap; }
+
+ private:
+    void field_begin(uint8_t kind);
+    void field_char(char c);
+    void field_end(void);
+
+    uint16_t m_mask;
+    uint8_t m_state;    /* chars of "+CWLAP:(" matched, then STATE_FIELDS */
+    uint8_t m_kind;     /* the field being read, as the number of its bit in m_mask */
+    bool m_quoted;
+    bool m_escape;      /* after '\\' in quotes */
+    bool m_negative;
+    uint8_t m_len;      /* chars of the SSID or hex digits of the MAC so far */
+    int16_t m_num;
+    ESP8266AP m_ap;
+};
+
+/**
+ * The state of a link, see ESP8266::getLinkInfo(). 
+ */
+enum ESP8266LinkState {
+    ESP8266_LINK_CLOSED = 0,
+    ESP8266_LINK_CONNECTING,    /**< AT+CIPSTART sent, no result yet */
+    ESP8266_LINK_CONNECTED,
+};
+
+/**
+ * The type of a link. 
+ */
+enum ESP8266LinkType {
+    ESP8266_LINK_TCP = 0,
+    ESP8266_LINK_UDP,
+    ESP8266_LINK_SSL,
+};
+
+/**
+ * What is known of a link. Fields not known yet are 0. 
+ */
+struct ESP8266LinkInfo {
+    uint8_t state;          /**< ESP8266LinkState */
+    uint8_t type;           /**< ESP8266LinkType */
+    bool server;            /**< accepted by the TCP server rather than created */
+    uint8_t ip[4];          /**< the remote IP address */
+    uint16_t remote_port;
+    uint16_t local_port;
+};
+
+/**
+ * Parse "+CIPSTATUS:<id>,"<type>","<ip>",<remote port>,<local port>,<server>" 
+ * lines one byte at a time. 
+ */
+class ESP8266LinkParser {
+ public:
+    ESP8266LinkParser(void);
+
+    /**
+     * Forget any partially parsed line. 
+     */
+    void reset(void);
+
+    /**
+     * Feed one byte from ESP8266. 
+     *
+     * @retval true - c was the line end closing a line, see id() and info(). 
+     * @retval false - no complete line yet. 
+     */
+    bool feed(char c);
+
+    /**
+     * The mux_id of the last complete line. 
+     */
+    uint8_t id(void) const { return m_id; }
+
+    /**
+     * The link of the last complete line, in state ESP8266_LINK_CONNECTED. 
+     */
+    const ESP8266LinkInfo &info(void) const { return m_info; }
+
+ private:
+    void field_char(char c);
+    void field_end(void);
+
+    uint8_t m_state;    /* chars of "+CIPSTATUS:" matched, then the fields */
+    uint8_t m_field;    /* the field being read */
+    bool m_quoted;
+    uint8_t m_len;      /* chars of the field so far */
+    uint8_t m_octet;    /* of the IP address, 4 if it is not one */
+    uint16_t m_num;
+    uint8_t m_id;
+    ESP8266LinkInfo m_info;
+};
+
+#endif /* #ifndef __ESP8266PARSER_H__ */
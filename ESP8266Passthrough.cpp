@@ -0,0 +1,71 @@
+/**
+ * @file ESP8266Passthrough.cpp
+ * @brief The implementation of class ESP8266Passthrough.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "ESP8266Passthrough.h"
+
+ESP8266Passthrough::ESP8266Passthrough(ESP8266 &wifi): m_wifi(&wifi)
+{
+}
+
+bool ESP8266Passthrough::begin(void)
+{
+    return m_wifi->enterPassthrough();
+}
+
+bool ESP8266Passthrough::end(void)
+{
+    return m_wifi->exitPassthrough();
+}
+
+int ESP8266Passthrough::available(void)
+{
+    m_wifi->rx_process(ESP8266_SINGLE_LINK);
+    return m_wifi->m_link[ESP8266_SINGLE_LINK].available();
+}
+
+int ESP8266Passthrough::read(void)
+{
+    m_wifi->rx_process(ESP8266_SINGLE_LINK);
+    return m_wifi->m_link[ESP8266_SINGLE_LINK].read();
+}
+
+int ESP8266Passthrough::peek(void)
+{
+    m_wifi->rx_process(ESP8266_SINGLE_LINK);
+    return m_wifi->m_link[ESP8266_SINGLE_LINK].peek();
+}
+
+void ESP8266Passthrough::flush(void)
+{
+    m_wifi->m_puart->flush();
+}
+
+size_t ESP8266Passthrough::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t ESP8266Passthrough::write(const uint8_t *buffer, size_t size)
+{
+    if (!m_wifi->m_passthrough) {
+        return 0;
+    }
+    size = m_wifi->tx_data(buffer, size);
+    m_wifi->m_passthrough_tx = millis();
+    return size;
+}
@@ -0,0 +1,75 @@
+/**
+ * @file ESP8266Passthrough.h
+ * @brief The definition of class ESP8266Passthrough.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __ESP8266PASSTHROUGH_H__
+#define __ESP8266PASSTHROUGH_H__
+
+#include "ESP8266.h"
+
+/**
+ * The link of single mode as a Stream, in transparent transmission. 
+ *
+ * Writing costs no AT+CIPSEND round trip: the bytes go straight to the UART and 
+ * ESP8266 sends them on by itself. Received bytes are read from the queue of 
+ * the link. 
+ *
+ *     wifi.createTCP(HOST_NAME, HOST_PORT);
+ *     ESP8266Passthrough link(wifi);
+ *     if (link.begin()) {
+ *         link.print(value);
+ *         ...
+ *         link.end();
+ *     }
+ */
+class ESP8266Passthrough : public Stream {
+ public:
+    ESP8266Passthrough(ESP8266 &wifi);
+
+    /**
+     * Enter transparent transmission. 
+     *
+     * @see bool ESP8266::enterPassthrough(void);
+     */
+    bool begin(void);
+
+    /**
+     * Leave transparent transmission, blocking for the guard times of "+++". 
+     *
+     * @see bool ESP8266::exitPassthrough(void);
+     */
+    bool end(void);
+
+    virtual int available(void);
+    virtual int read(void);
+    virtual int peek(void);
+    virtual void flush(void);
+
+    /**
+     * Write data to the link. 
+     *
+     * @return the number of bytes written, 0 when not in transparent transmission. 
+     */
+    virtual size_t write(uint8_t c);
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+
+ private:
+    ESP8266 *m_wifi;
+};
+
+#endif /* #ifndef __ESP8266PASSTHROUGH_H__ */
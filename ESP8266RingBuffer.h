@@ -0,0 +1,184 @@
+/**
+ * @file ESP8266RingBuffer.h
+ * @brief The definition of class template ESP8266RingBuffer.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __ESP8266RINGBUFFER_H__
+#define __ESP8266RINGBUFFER_H__
+
+#include "Arduino.h"
+
+/**
+ * A byte FIFO of fixed capacity N, with no heap memory involved.
+ *
+ * Bytes can be looked at with peek() before they are consumed. The highest
+ * fill level and the number of bytes refused for lack of space are kept,
+ * so N can be sized for the actual traffic.
+ */
+template <uint16_t N>
+class ESP8266RingBuffer {
+ public:
+    ESP8266RingBuffer(void): m_head(0), m_count(0), m_high_water(0), m_overflows(0) {}
+
+    /**
+     * The number of bytes the buffer can hold.
+     */
+    uint16_t capacity(void) const { return N; }
+
+    /**
+     * The number of bytes stored.
+     */
+    uint16_t available(void) const { return m_count; }
+
+    /**
+     * The number of bytes which can still be written.
+     */
+    uint16_t space(void) const { return N - m_count; }
+
+    /**
+     * Append one byte.
+     *
+     * @retval true - success.
+     * @retval false - the buffer is full, the byte is refused and counted as an overflow.
+     */
+    bool write(uint8_t c)
+    {
+        if (m_count >= N) {
+            m_overflows++;
+            return false;
+        }
+        m_buf[index(m_count)] = c;
+        m_count++;
+        if (m_count > m_high_water) {
+            m_high_water = m_count;
+        }
+        return true;
+    }
+
+    /**
+     * Look at a byte without consuming it.
+     *
+     * @param offset - the position from the oldest byte(default: 0).
+     * @return the byte, -1 if there are not so many bytes.
+     */
+    int peek(uint16_t offset = 0) const
+    {
+        if (offset >= m_count) {
+            return -1;
+        }
+        return m_buf[index(offset)];
+    }
+
+    /**
+     * Consume the oldest byte.
+     *
+     * @return the byte, -1 if empty.
+     */
+    int read(void)
+    {
+        if (m_count == 0) {
+            return -1;
+        }
+        uint8_t c = m_buf[m_head];
+        consume(1);
+        return c;
+    }
+
+    /**
+     * Consume up to len bytes into buffer.
+     *
+     * @return the number of bytes copied.
+     */
+    uint16_t read(uint8_t *buffer, uint16_t len)
+    {
+        uint16_t first;
+        if (len > m_count) {
+            len = m_count;
+        }
+        first = N - m_head;
+        if (first > len) {
+            first = len;
+        }
+        memcpy(buffer, m_buf + m_head, first);
+        memcpy(buffer + first, m_buf, len - first);
+        consume(len);
+        return len;
+    }
+
+    /**
+     * Drop up to n of the oldest bytes.
+     *
+     * @return the number of bytes dropped.
+     */
+    uint16_t consume(uint16_t n)
+    {
+        if (n > m_count) {
+            n = m_count;
+        }
+        m_head = index(n);
+        m_count -= n;
+        return n;
+    }
+
+    /**
+     * Drop all bytes.
+     */
+    void clear(void)
+    {
+        m_head = 0;
+        m_count = 0;
+    }
+
+    /**
+     * Drop all bytes, counted as overflows.
+     */
+    void discard(void)
+    {
+        m_overflows += m_count;
+        clear();
+    }
+
+    /**
+     * The highest number of bytes stored at once since resetStats().
+     */
+    uint16_t highWaterMark(void) const { return m_high_water; }
+
+    /**
+     * The number of bytes refused because the buffer was full since resetStats().
+     */
+    uint32_t overflowCount(void) const { return m_overflows; }
+
+    void resetStats(void)
+    {
+        m_high_water = m_count;
+        m_overflows = 0;
+    }
+
+ private:
+    uint16_t index(uint16_t offset) const
+    {
+        uint16_t i = m_head + offset;
+        return i >= N ? i - N : i;
+    }
+
+    uint8_t m_buf[N];
+    uint16_t m_head;
+    uint16_t m_count;
+    uint16_t m_high_water;
+    uint32_t m_overflows;
+};
+
+#endif /* #ifndef __ESP8266RINGBUFFER_H__ */
@@ -0,0 +1,422 @@
+/**
+ * @file ESP8266SMTP.cpp
+ * @brief The implementation of class ESP8266SMTP.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "ESP8266SMTP.h"
+
+#define AUTH_PLAIN      (0x01)
+#define AUTH_LOGIN      (0x02)
+
+static const char base64_chars[] PROGMEM =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* Encode data in base64 bit by bit, so that pieces can be given one after another */
+class Base64Writer {
+ public:
+    Base64Writer(char *out, size_t size): m_out(out), m_size(size), m_len(0), m_bits(0), m_nbits(0)
+    {
+        m_out[0] = '\0';
+    }
+
+    bool put(const uint8_t *data, size_t len)
+    {
+        size_t i;
+
+        for (i = 0; i < len; i++) {
+            m_bits = (m_bits << 8) | data[i];
+            m_nbits += 8;
+            while (m_nbits >= 6) {
+                m_nbits -= 6;
+                if (!put_char(pgm_read_byte(base64_chars + ((m_bits >> m_nbits) & 0x3F)))) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool put(const char *str)
+    {
+        return put((const uint8_t *)str, strlen(str));
+    }
+
+    /* Output the bits left and the padding */
+    bool end(void)
+    {
+        if (m_nbits > 0) {
+            if (!put_char(pgm_read_byte(base64_chars + ((m_bits << (6 - m_nbits)) & 0x3F)))) {
+                return false;
+            }
+            while (m_len % 4 != 0) {
+                if (!put_char('=')) {
+                    return false;
+                }
+            }
+            m_nbits = 0;
+        }
+        return true;
+    }
+
+ private:
+    bool put_char(char c)
+    {
+        if (m_len + 1 >= m_size) {
+            return false;
+        }
+        m_out[m_len++] = c;
+        m_out[m_len] = '\0';
+        return true;
+    }
+
+    char *m_out;
+    size_t m_size;
+    size_t m_len;
+    uint16_t m_bits;
+    uint8_t m_nbits;
+};
+
+/* Dot-stuff a message given by an ESP8266Producer and end it with the "." line */
+class DotStuffer {
+ public:
+    DotStuffer(ESP8266Producer producer, void *arg):
+        m_producer(producer), m_arg(arg), m_pos(0), m_len(0), m_bol(true), m_stuffed(false), m_tail(NULL)
+    {
+    }
+
+    static uint32_t produce(uint8_t *buffer, uint32_t size, void *arg)
+    {
+        return ((DotStuffer *)arg)->read(buffer, size);
+    }
+
+ private:
+    uint32_t read(uint8_t *buffer, uint32_t size)
+    {
+        uint32_t len = 0;
+        uint8_t c;
+
+        while (len < size) {
+            if (m_tail) {
+                if (*m_tail == '\0') {
+                    break;
+                }
+                buffer[len++] = *m_tail++;
+                continue;
+            }
+            if (m_pos == m_len) {
+                m_pos = 0;
+                m_len = m_producer(m_in, sizeof(m_in), m_arg);
+                if (m_len == 0) {
+                    m_tail = m_bol ? ".\r\n" : "\r\n.\r\n";
+                    continue;
+                }
+            }
+            c = m_in[m_pos];
+            if (m_bol && c == '.' && !m_stuffed) {
+                /* The "." is doubled, the original one goes next */
+                buffer[len++] = '.';
+                m_stuffed = true;
+                continue;
+            }
+            buffer[len++] = c;
+            m_pos++;
+            m_stuffed = false;
+            m_bol = (c == '\n');
+        }
+        return len;
+    }
+
+    ESP8266Producer m_producer;
+    void *m_arg;
+    uint8_t m_in[16];
+    uint8_t m_pos;
+    uint8_t m_len;
+    bool m_bol;
+    bool m_stuffed;
+    const char *m_tail;             /* the rest of the "." line once the message is over */
+};
+
+static bool is_positive(uint16_t code)
+{
+    return code >= 200 && code < 300;
+}
+
+ESP8266SMTP::ESP8266SMTP(ESP8266 &wifi):
+    m_wifi(&wifi), m_pipelining(false), m_auth(0), m_code(0), m_buf_pos(0), m_buf_len(0)
+{
+    m_line[0] = '\0';
+}
+
+bool ESP8266SMTP::connect(const ESP8266Segment &host, uint32_t port, const char *domain)
+{
+    m_pipelining = false;
+    m_auth = 0;
+    m_buf_pos = 0;
+    m_buf_len = 0;
+    if (!m_wifi->createTCP(host, port) || reply() != 220) {
+        return false;
+    }
+    if (!command("EHLO ", domain)) {
+        return false;
+    }
+    if (extensions()) {
+        return true;
+    }
+    if (m_code >= 500 && m_code < 600) {
+        /* An old server, without extensions */
+        return command("HELO ", domain) && reply() == 250;
+    }
+    return false;
+}
+
+bool ESP8266SMTP::login(const char *user, const char *pass)
+{
+    if (!(m_auth & AUTH_PLAIN) && (m_auth & AUTH_LOGIN)) {
+        return auth_login(user, pass);
+    }
+    return auth_plain(user, pass);
+}
+
+bool ESP8266SMTP::sendMail(const char *from, const char *to, ESP8266Producer producer, void *arg)
+{
+    return sendMail(from, &to, 1, producer, arg);
+}
+
+bool ESP8266SMTP::sendMail(const char *from, const char *const to[], uint8_t count, ESP8266Producer producer, void *arg)
+{
+    ESP8266Segment segments[3 * ESP8266_SMTP_MAX_RCPT + 4];
+    DotStuffer stuffer(producer, arg);
+    bool mail_ok;
+    uint8_t accepted = 0;
+    uint8_t n = 0, i;
+
+    if (count == 0 || count > ESP8266_SMTP_MAX_RCPT) {
+        return false;
+    }
+
+    if (m_pipelining) {
+        /* The whole envelope and DATA in one AT+CIPSEND */
+        segments[n++] = F("MAIL FROM:<");
+        segments[n++] = from;
+        segments[n++] = F(">\r\n");
+        for (i = 0; i < count; i++) {
+            segments[n++] = F("RCPT TO:<");
+            segments[n++] = to[i];
+            segments[n++] = F(">\r\n");
+        }
+        segments[n++] = F("DATA\r\n");
+        if (!m_wifi->send(segments, n)) {
+            return false;
+        }
+
+        /* The replies come in the same order */
+        mail_ok = is_positive(reply());
+        for (i = 0; i < count; i++) {
+            if (is_positive(reply())) {
+                accepted++;
+            } else if (m_code == 0) {
+                return false;
+            }
+        }
+        if (reply() != 354) {
+            if (m_code != 0) {
+                reset();
+            }
+            return false;
+        }
+        if (!mail_ok || accepted == 0) {
+            /* DATA was taken though nobody would get the message, send none */
+            m_wifi->send((const uint8_t *)".\r\n", 3);
+            reply();
+            reset();
+            return false;
+        }
+    } else {
+        if (!command("MAIL FROM:<", from, ">") || !is_positive(reply())) {
+            return false;
+        }
+        for (i = 0; i < count; i++) {
+            if (!command("RCPT TO:<", to[i], ">")) {
+                return false;
+            }
+            if (is_positive(reply())) {
+                accepted++;
+            } else if (m_code == 0) {
+                return false;
+            }
+        }
+        if (accepted == 0) {
+            reset();
+            return false;
+        }
+        if (!command("DATA") || reply() != 354) {
+            if (m_code != 0) {
+                reset();
+            }
+            return false;
+        }
+    }
+
+    if (!m_wifi->sendStream(DotStuffer::produce, &stuffer)) {
+        return false;
+    }
+    return reply() == 250;
+}
+
+bool ESP8266SMTP::quit(void)
+{
+    bool ok = command("QUIT") && reply() == 221;
+    m_wifi->releaseTCP();
+    return ok;
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool ESP8266SMTP::command(const char *command, const char *arg, const char *suffix)
+{
+    ESP8266Segment segments[4];
+    uint8_t n = 0;
+
+    segments[n++] = command;
+    if (arg) {
+        segments[n++] = arg;
+    }
+    if (suffix) {
+        segments[n++] = suffix;
+    }
+    segments[n++] = "\r\n";
+    return m_wifi->send(segments, n);
+}
+
+uint16_t ESP8266SMTP::reply(void)
+{
+    /* "code-text" goes on, "code text" is the last line */
+    do {
+        if (!read_line()) {
+            m_code = 0;
+            return 0;
+        }
+    } while (m_line[3] == '-');
+    m_code = strtoul(m_line, NULL, 10);
+    return m_code;
+}
+
+bool ESP8266SMTP::extensions(void)
+{
+    const char *keyword;
+    char *word;
+    bool last;
+
+    do {
+        if (!read_line()) {
+            m_code = 0;
+            return false;
+        }
+        last = (m_line[3] != '-');
+        keyword = m_line + 4;
+        if (strncmp(m_line, "250", 3) != 0) {
+            continue;
+        }
+        if (strcasecmp(keyword, "PIPELINING") == 0) {
+            m_pipelining = true;
+        } else if (strncasecmp(keyword, "AUTH", 4) == 0 && (keyword[4] == ' ' || keyword[4] == '=')) {
+            /* "AUTH LOGIN PLAIN", or "AUTH=LOGIN PLAIN" of old servers */
+            for (word = strtok(m_line + 9, " "); word; word = strtok(NULL, " ")) {
+                if (strcasecmp(word, "PLAIN") == 0) {
+                    m_auth |= AUTH_PLAIN;
+                } else if (strcasecmp(word, "LOGIN") == 0) {
+                    m_auth |= AUTH_LOGIN;
+                }
+            }
+        }
+    } while (!last);
+    m_code = strtoul(m_line, NULL, 10);
+    return m_code == 250;
+}
+
+bool ESP8266SMTP::auth_plain(const char *user, const char *pass)
+{
+    char credentials[ESP8266_SMTP_AUTH_SIZE + 1];
+    Base64Writer base64(credentials, sizeof(credentials));
+    const uint8_t zero = 0;
+
+    /* "\0user\0password" */
+    if (!base64.put(&zero, 1) || !base64.put(user) || !base64.put(&zero, 1)
+        || !base64.put(pass) || !base64.end()) {
+        return false;
+    }
+    return command("AUTH PLAIN ", credentials) && reply() == 235;
+}
+
+bool ESP8266SMTP::auth_login(const char *user, const char *pass)
+{
+    char credentials[ESP8266_SMTP_AUTH_SIZE + 1];
+    Base64Writer name(credentials, sizeof(credentials));
+
+    if (!name.put(user) || !name.end()) {
+        return false;
+    }
+    if (!command("AUTH LOGIN") || reply() != 334 || !command(credentials) || reply() != 334) {
+        return false;
+    }
+
+    Base64Writer password(credentials, sizeof(credentials));
+    if (!password.put(pass) || !password.end()) {
+        return false;
+    }
+    return command(credentials) && reply() == 235;
+}
+
+void ESP8266SMTP::reset(void)
+{
+    if (command("RSET")) {
+        reply();
+    }
+}
+
+int ESP8266SMTP::read(void)
+{
+    if (m_buf_pos == m_buf_len) {
+        m_buf_pos = 0;
+        m_buf_len = m_wifi->recv(m_buf, sizeof(m_buf), ESP8266_SMTP_TIMEOUT);
+        if (m_buf_len == 0) {
+            return -1;
+        }
+    }
+    return m_buf[m_buf_pos++];
+}
+
+bool ESP8266SMTP::read_line(void)
+{
+    uint8_t len = 0;
+    int c;
+
+    while ((c = read()) != -1) {
+        if (c == '\n') {
+            m_line[len] = '\0';
+            /* Shorter than "250" is not a reply line */
+            while (len < 4) {
+                m_line[len++] = '\0';
+            }
+            return true;
+        }
+        if (c != '\r' && len < ESP8266_SMTP_LINE_SIZE) {
+            m_line[len++] = c;
+        }
+    }
+    m_line[0] = '\0';
+    return false;
+}
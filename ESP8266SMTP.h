@@ -0,0 +1,156 @@
+/**
+ * @file ESP8266SMTP.h
+ * @brief The definition of class ESP8266SMTP.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __ESP8266SMTP_H__
+#define __ESP8266SMTP_H__
+
+#include "ESP8266.h"
+
+/*
+ * The longest reply line kept, longer ones are truncated.
+ */
+#ifndef ESP8266_SMTP_LINE_SIZE
+#define ESP8266_SMTP_LINE_SIZE      (80)
+#endif
+
+/*
+ * The most recipients of one message.
+ */
+#ifndef ESP8266_SMTP_MAX_RCPT
+#define ESP8266_SMTP_MAX_RCPT       (4)
+#endif
+
+/*
+ * The longest base64 credentials of AUTH, "\0user\0password" of PLAIN included.
+ */
+#ifndef ESP8266_SMTP_AUTH_SIZE
+#define ESP8266_SMTP_AUTH_SIZE      (96)
+#endif
+
+/*
+ * How long(milliseconds) to wait for the server before giving up.
+ */
+#ifndef ESP8266_SMTP_TIMEOUT
+#define ESP8266_SMTP_TIMEOUT        (10000)
+#endif
+
+/**
+ * An SMTP client on the TCP link of single mode.
+ *
+ *     ESP8266SMTP smtp(wifi);
+ *     const char *to[] = {"alice@example.com", "bob@example.com"};
+ *     if (smtp.connect("smtp.example.com") && smtp.login(USER, PASS)) {
+ *         smtp.sendMail("me@example.com", to, 2, write_message, &state);
+ *         smtp.quit();
+ *     }
+ *
+ * The message(headers, blank line and body) is given piece by piece by an
+ * ESP8266Producer, dot-stuffed on the way and ended with the "." line, so it
+ * never has to be held in memory as a whole.
+ */
+class ESP8266SMTP {
+ public:
+    ESP8266SMTP(ESP8266 &wifi);
+
+    /**
+     * Connect to the server, read its greeting and its extensions(EHLO).
+     *
+     * Servers which do not know EHLO are greeted with HELO.
+     *
+     * @param host - the name or IP address of the server.
+     * @param port - the port of the server.
+     * @param domain - the name the client gives itself.
+     * @retval true - success.
+     * @retval false - failure.
+     */
+    bool connect(const ESP8266Segment &host, uint32_t port = 25, const char *domain = "esp8266");
+
+    /**
+     * Authenticate with AUTH PLAIN, or AUTH LOGIN if that is all the server has.
+     */
+    bool login(const char *user, const char *pass);
+
+    /**
+     * Send a message to several recipients.
+     *
+     * If the server has PIPELINING, MAIL FROM, all RCPT TO and DATA go in one
+     * AT+CIPSEND and their replies are read afterwards. The message is then
+     * sent with ESP8266::sendStream(), ESP8266_SEND_BUFFER_SIZE bytes at a time.
+     *
+     * @param from - the address of the sender, without "<>".
+     * @param to - the addresses of the recipients.
+     * @param count - the number of recipients, up to ESP8266_SMTP_MAX_RCPT.
+     * @param producer - gives the message until it returns 0. Lines end with "\r\n"
+     *  and are not dot-stuffed.
+     * @param arg - passed to producer.
+     * @retval true - the server has taken the message. Recipients it refused are
+     *  left out, the message goes to the others.
+     * @retval false - failure, see getReplyCode().
+     */
+    bool sendMail(const char *from, const char *const to[], uint8_t count, ESP8266Producer producer, void *arg = NULL);
+
+    /**
+     * Send a message to one recipient.
+     */
+    bool sendMail(const char *from, const char *to, ESP8266Producer producer, void *arg = NULL);
+
+    /**
+     * Close the session(QUIT) and the connection.
+     */
+    bool quit(void);
+
+    /**
+     * Check whether the server has PIPELINING.
+     */
+    bool pipelining(void) const { return m_pipelining; }
+
+    /**
+     * Get the code of the last reply, 0 if the server did not answer in time.
+     */
+    uint16_t getReplyCode(void) const { return m_code; }
+
+ private:
+    /* Send "command[arg][suffix]\r\n" to the server */
+    bool command(const char *command, const char *arg = NULL, const char *suffix = NULL);
+
+    /* Read a reply, all its lines, and keep its code */
+    uint16_t reply(void);
+
+    /* Read EHLO lines, noting the extensions */
+    bool extensions(void);
+
+    bool auth_plain(const char *user, const char *pass);
+    bool auth_login(const char *user, const char *pass);
+
+    /* Abort the transaction after a failure */
+    void reset(void);
+
+    bool read_line(void);
+    int read(void);
+
+    ESP8266 *m_wifi;
+    bool m_pipelining;
+    uint8_t m_auth;                 /* AUTH mechanisms of the server */
+    uint16_t m_code;
+    char m_line[ESP8266_SMTP_LINE_SIZE + 1];
+    uint8_t m_buf[32];              /* received, not used yet */
+    uint8_t m_buf_pos;
+    uint8_t m_buf_len;
+};
+
+#endif /* #ifndef __ESP8266SMTP_H__ */
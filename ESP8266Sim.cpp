@@ -0,0 +1,856 @@
+/**
+ * @file ESP8266Sim.cpp
+ * @brief The implementation of class ESP8266Sim.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "ESP8266Sim.h"
+
+/* Whether str starts with prefix, and what follows it */
+static bool starts_with(const char *str, const char *prefix, const char **rest)
+{
+    size_t len = strlen(prefix);
+
+    if (strncmp(str, prefix, len) != 0) {
+        return false;
+    }
+    *rest = str + len;
+    return true;
+}
+
+/* Copy the next "quoted" string of str into buffer, truncated to fit size */
+static const char *parse_quoted(const char *str, char *buffer, size_t size)
+{
+    size_t len = 0;
+
+    str = strchr(str, '"');
+    if (str == NULL) {
+        return NULL;
+    }
+    for (str++; *str && *str != '"'; str++) {
+        if (len + 1 < size) {
+            buffer[len++] = *str;
+        }
+    }
+    buffer[len] = '\0';
+    return *str == '"' ? str + 1 : NULL;
+}
+
+ESP8266Sim::ESP8266Sim(uint32_t baud):
+    m_defer(false), m_ready(0), m_next(0), m_timing(true), m_latency(0), m_boot(300),
+    m_booting(false), m_boot_start(0),
+    m_baud(baud), m_baud_default(baud), m_baud_local(baud), m_baud_pending(0),
+    m_line_len(0), m_echo(true), m_error_rate(0), m_random(1),
+    m_handler(NULL), m_handler_arg(NULL), m_ap_count(0), m_cwlap_sort(false), m_cwlap_mask(ESP8266_AP_ALL),
+    m_mode(1), m_mux(false), m_cipmode(false), m_server(0),
+    m_send_link(-1), m_send_remain(0), m_send_len(0), m_send_buf_len(0), m_send_ex(false), m_send_slash(false),
+    m_passthrough(false), m_plus(0), m_last_write(0),
+    m_commands(0), m_errors(0), m_bytes_sent(0), m_bytes_received(0)
+{
+    uint8_t i;
+
+    m_joined[0] = '\0';
+    for (i = 0; i < ESP8266_MAX_LINKS; i++) {
+        m_links[i].connected = false;
+    }
+}
+
+void ESP8266Sim::begin(uint32_t baud)
+{
+    m_baud_local = baud;
+}
+
+int ESP8266Sim::available(void)
+{
+    release();
+    return m_ready;
+}
+
+int ESP8266Sim::read(void)
+{
+    release();
+    if (m_ready == 0) {
+        return -1;
+    }
+    m_ready--;
+    return m_out.read();
+}
+
+int ESP8266Sim::peek(void)
+{
+    release();
+    return m_ready > 0 ? m_out.peek() : -1;
+}
+
+void ESP8266Sim::flush(void)
+{
+    /* Written bytes are taken at once */
+}
+
+size_t ESP8266Sim::write(uint8_t c)
+{
+    release();
+    if (m_baud_local != m_baud || m_booting) {
+        /* Garbage to ESP8266 */
+        return 1;
+    }
+    if (m_passthrough) {
+        passthrough(c);
+    } else if (m_send_remain > 0) {
+        data(c);
+    } else if (c == '\n') {
+        if (m_line_len > 0 && m_line[m_line_len - 1] == '\r') {
+            m_line_len--;
+        }
+        m_line[m_line_len] = '\0';
+        if (m_line_len > 0) {
+            command();
+        }
+        m_line_len = 0;
+    } else if (m_line_len < ESP8266_SIM_LINE_SIZE) {
+        m_line[m_line_len++] = c;
+    }
+    m_last_write = millis();
+    return 1;
+}
+
+size_t ESP8266Sim::write(const uint8_t *buffer, size_t size)
+{
+    size_t n;
+
+    for (n = 0; n < size; n++) {
+        ESP8266Sim::write(buffer[n]);
+    }
+    return size;
+}
+
+void ESP8266Sim::setLatency(uint32_t latency, uint32_t boot)
+{
+    m_latency = latency;
+    m_boot = boot;
+}
+
+void ESP8266Sim::setTiming(bool on)
+{
+    m_timing = on;
+}
+
+void ESP8266Sim::setErrorRate(uint8_t percent, uint32_t seed)
+{
+    m_error_rate = percent;
+    m_random = seed ? seed : 1;
+}
+
+void ESP8266Sim::setHandler(ESP8266SimHandler handler, void *arg)
+{
+    m_handler = handler;
+    m_handler_arg = arg;
+}
+
+bool ESP8266Sim::addAP(const char *ssid, int8_t rssi, uint8_t ecn, uint8_t channel)
+{
+    AP *ap;
+
+    if (m_ap_count >= ESP8266_SIM_MAX_APS) {
+        return false;
+    }
+    ap = &m_aps[m_ap_count++];
+    strncpy(ap->ssid, ssid, sizeof(ap->ssid) - 1);
+    ap->ssid[sizeof(ap->ssid) - 1] = '\0';
+    ap->rssi = rssi;
+    ap->ecn = ecn;
+    ap->channel = channel;
+    return true;
+}
+
+bool ESP8266Sim::receive(uint8_t link, const uint8_t *data, uint32_t len)
+{
+    if (link >= ESP8266_MAX_LINKS || !m_links[link].connected) {
+        return false;
+    }
+    /* Data during AT+CIPSEND comes after "SEND OK" */
+    m_defer = (m_send_remain > 0);
+    if (target().space() < len + 20) {
+        m_defer = false;
+        return false;
+    }
+    if (!m_defer) {
+        hold(m_latency);
+    }
+    if (!m_passthrough) {
+        out(F("\r\n+IPD,"));
+        out_link(link);
+        out_number(len);
+        out(F(":"));
+    }
+    out(data, len);
+    m_defer = false;
+    m_bytes_received += len;
+    return true;
+}
+
+bool ESP8266Sim::accept(uint8_t link)
+{
+    if (!m_mux || m_server == 0 || link >= ESP8266_MAX_LINKS || m_links[link].connected) {
+        return false;
+    }
+    m_links[link].connected = true;
+    m_links[link].udp = false;
+    m_links[link].server = true;
+    strcpy(m_links[link].host, "192.168.4.2");
+    m_links[link].port = 50000 + link;
+    m_links[link].local_port = m_server;
+    hold(m_latency);
+    out_link(link);
+    out(F("CONNECT\r\n"));
+    return true;
+}
+
+void ESP8266Sim::close(uint8_t link)
+{
+    if (link >= ESP8266_MAX_LINKS || !m_links[link].connected) {
+        return;
+    }
+    m_links[link].connected = false;
+    if (m_passthrough) {
+        m_passthrough = false;
+        m_plus = 0;
+    }
+    hold(m_latency);
+    out_link(link);
+    out(F("CLOSED\r\n"));
+}
+
+bool ESP8266Sim::connected(uint8_t link) const
+{
+    return link < ESP8266_MAX_LINKS && m_links[link].connected;
+}
+
+void ESP8266Sim::resetStats(void)
+{
+    m_commands = 0;
+    m_errors = 0;
+    m_bytes_sent = 0;
+    m_bytes_received = 0;
+    m_out.resetStats();
+}
+
+/*----------------------------------------------------------------------------*/
+
+void ESP8266Sim::command(void)
+{
+    const char *cmd, *args;
+
+    m_commands++;
+    if (m_echo) {
+        out(m_line);
+        out(F("\r\r\n"));
+    }
+    hold(m_latency);
+    if (!starts_with(m_line, "AT", &cmd) || fail()) {
+        error();
+        return;
+    }
+
+    if (*cmd == '\0') {
+        ok();
+    } else if (strcmp(cmd, "E0") == 0 || strcmp(cmd, "E1") == 0) {
+        m_echo = (cmd[1] == '1');
+        ok();
+    } else if (strcmp(cmd, "+RST") == 0) {
+        ok();
+        boot();
+    } else if (strcmp(cmd, "+GMR") == 0) {
+        out(F("AT version:0.40.0.0(Aug  8 2015 14:45:58)\r\nSDK version:1.3.0\r\n"
+              "compile time:Aug  8 2015 17:19:38\r\n\r\nOK\r\n"));
+    } else if (strcmp(cmd, "+CWMODE?") == 0) {
+        out(F("+CWMODE:"));
+        out_number(m_mode);
+        out(F("\r\n\r\nOK\r\n"));
+    } else if (starts_with(cmd, "+CWMODE=", &args) || starts_with(cmd, "+CWMODE_CUR=", &args)
+               || starts_with(cmd, "+CWMODE_DEF=", &args)) {
+        if (*args < '1' || *args > '3') {
+            error();
+            return;
+        }
+        m_mode = *args - '0';
+        ok();
+    } else if (strcmp(cmd, "+CWJAP?") == 0) {
+        if (m_joined[0]) {
+            out(F("+CWJAP:\""));
+            out(m_joined);
+            out(F("\"\r\n\r\nOK\r\n"));
+        } else {
+            out(F("No AP\r\n\r\nOK\r\n"));
+        }
+    } else if (starts_with(cmd, "+CWJAP=", &args) || starts_with(cmd, "+CWJAP_CUR=", &args)
+               || starts_with(cmd, "+CWJAP_DEF=", &args)) {
+        command_cwjap(args);
+    } else if (starts_with(cmd, "+CWLAPOPT=", &args)) {
+        m_cwlap_sort = (*args == '1');
+        m_cwlap_mask = (args[1] == ',') ? strtoul(args + 2, NULL, 10) : ESP8266_AP_ALL;
+        ok();
+    } else if (strncmp(cmd, "+CWLAP", 6) == 0) {
+        command_cwlap();
+    } else if (strcmp(cmd, "+CWQAP") == 0) {
+        ok();
+        if (m_joined[0]) {
+            m_joined[0] = '\0';
+            out(F("WIFI DISCONNECT\r\n"));
+        }
+    } else if (strncmp(cmd, "+CWSAP", 6) == 0 || strcmp(cmd, "+CWLIF") == 0
+               || starts_with(cmd, "+CIPSTO=", &args)) {
+        ok();
+    } else if (strcmp(cmd, "+CIFSR") == 0) {
+        out(F("+CIFSR:STAIP,\""));
+        out(m_joined[0] ? F("192.168.1.50") : F("0.0.0.0"));
+        out(F("\"\r\n+CIFSR:STAMAC,\"18:fe:34:00:00:01\"\r\n\r\nOK\r\n"));
+    } else if (starts_with(cmd, "+CIPMUX=", &args)) {
+        m_mux = (*args == '1');
+        ok();
+    } else if (starts_with(cmd, "+CIPMODE=", &args)) {
+        if (m_mux && *args == '1') {
+            error();
+            return;
+        }
+        m_cipmode = (*args == '1');
+        ok();
+    } else if (starts_with(cmd, "+CIPSERVER=", &args)) {
+        if (!m_mux) {
+            error();
+            return;
+        }
+        m_server = (*args == '1') ? (args[1] == ',' ? strtoul(args + 2, NULL, 10) : 333) : 0;
+        ok();
+    } else if (strcmp(cmd, "+CIPSTATUS") == 0) {
+        command_cipstatus();
+    } else if (starts_with(cmd, "+CIPDOMAIN=", &args)) {
+        command_cipdomain(args);
+    } else if (starts_with(cmd, "+CIPSTART=", &args)) {
+        command_cipstart(args);
+    } else if (strncmp(cmd, "+CIPSEND", 8) == 0) {
+        command_cipsend(cmd + 8);
+    } else if (strncmp(cmd, "+CIPCLOSE", 9) == 0) {
+        command_cipclose(cmd + 9);
+    } else if (starts_with(cmd, "+UART_CUR=", &args) || starts_with(cmd, "+UART_DEF=", &args)
+               || starts_with(cmd, "+UART=", &args) || starts_with(cmd, "+CIOBAUD=", &args)) {
+        command_baud(args);
+    } else {
+        error();
+    }
+}
+
+void ESP8266Sim::command_cwjap(const char *args)
+{
+    char ssid[sizeof(m_joined)];
+    uint8_t i;
+
+    if (parse_quoted(args, ssid, sizeof(ssid)) == NULL) {
+        error();
+        return;
+    }
+    for (i = 0; i < m_ap_count && strcmp(m_aps[i].ssid, ssid) != 0; i++) {
+    }
+    if (m_ap_count > 0 && i == m_ap_count) {
+        m_errors++;
+        out(F("+CWJAP:3\r\n\r\nFAIL\r\n"));
+        return;
+    }
+    strcpy(m_joined, ssid);
+    out(F("WIFI CONNECTED\r\nWIFI GOT IP\r\n\r\nOK\r\n"));
+}
+
+void ESP8266Sim::command_cwlap(void)
+{
+    uint8_t order[ESP8266_SIM_MAX_APS];
+    uint8_t i, j, k;
+    const char *sep;
+
+    for (i = 0; i < m_ap_count; i++) {
+        order[i] = i;
+    }
+    if (m_cwlap_sort) {
+        /* Strongest first */
+        for (i = 1; i < m_ap_count; i++) {
+            for (j = i; j > 0 && m_aps[order[j - 1]].rssi < m_aps[order[j]].rssi; j--) {
+                k = order[j];
+                order[j] = order[j - 1];
+                order[j - 1] = k;
+            }
+        }
+    }
+    for (k = 0; k < m_ap_count; k++) {
+        i = order[k];
+        sep = "";
+        out(F("+CWLAP:("));
+        if (m_cwlap_mask & ESP8266_AP_ECN) {
+            out(sep);
+            out_number(m_aps[i].ecn);
+            sep = ",";
+        }
+        if (m_cwlap_mask & ESP8266_AP_SSID) {
+            out(sep);
+            out(F("\""));
+            out(m_aps[i].ssid);
+            out(F("\""));
+            sep = ",";
+        }
+        if (m_cwlap_mask & ESP8266_AP_RSSI) {
+            out(sep);
+            if (m_aps[i].rssi < 0) {
+                out(F("-"));
+            }
+            out_number(m_aps[i].rssi < 0 ? -m_aps[i].rssi : m_aps[i].rssi);
+            sep = ",";
+        }
+        if (m_cwlap_mask & ESP8266_AP_MAC) {
+            out(sep);
+            out(F("\"18:fe:34:00:01:"));
+            out_number(10 + i);
+            out(F("\""));
+            sep = ",";
+        }
+        if (m_cwlap_mask & ESP8266_AP_CHANNEL) {
+            out(sep);
+            out_number(m_aps[i].channel);
+        }
+        out(F(")\r\n"));
+    }
+    ok();
+}
+
+void ESP8266Sim::command_cipstatus(void)
+{
+    uint8_t status = 5;
+    uint8_t i;
+
+    if (m_joined[0]) {
+        status = 2;
+        for (i = 0; i < ESP8266_MAX_LINKS; i++) {
+            if (m_links[i].connected) {
+                status = 3;
+            }
+        }
+    }
+    out(F("STATUS:"));
+    out_number(status);
+    out(F("\r\n"));
+    for (i = 0; i < ESP8266_MAX_LINKS; i++) {
+        if (!m_links[i].connected) {
+            continue;
+        }
+        out(F("+CIPSTATUS:"));
+        out_number(i);
+        out(m_links[i].udp ? F(",\"UDP\",\"") : F(",\"TCP\",\""));
+        out(m_links[i].host);
+        out(F("\","));
+        out_number(m_links[i].port);
+        out(F(","));
+        out_number(m_links[i].local_port);
+        out(m_links[i].server ? F(",1\r\n") : F(",0\r\n"));
+    }
+    ok();
+}
+
+int8_t ESP8266Sim::parse_link(const char **args)
+{
+    int8_t link;
+
+    if (!m_mux) {
+        return 0;
+    }
+    link = **args - '0';
+    if (link < 0 || link >= ESP8266_MAX_LINKS || (*args)[1] != ',') {
+        return -1;
+    }
+    *args += 2;
+    return link;
+}
+
+void ESP8266Sim::command_cipstart(const char *args)
+{
+    char type[4];
+    int8_t link = parse_link(&args);
+    Link *l;
+
+    if (link < 0 || (args = parse_quoted(args, type, sizeof(type))) == NULL) {
+        error();
+        return;
+    }
+    l = &m_links[link];
+    if ((args = parse_quoted(args, l->host, sizeof(l->host))) == NULL || *args != ',') {
+        error();
+        return;
+    }
+    if (l->connected) {
+        m_errors++;
+        out(F("ALREADY CONNECTED\r\n\r\nERROR\r\n"));
+        return;
+    }
+    if (!m_joined[0]) {
+        error();
+        return;
+    }
+    if (dns_fails(l->host)) {
+        m_errors++;
+        out(F("DNS Fail\r\n\r\nERROR\r\n"));
+        return;
+    }
+    l->connected = true;
+    l->udp = (strcmp(type, "UDP") == 0);
+    l->server = false;
+    l->port = strtoul(args + 1, NULL, 10);
+    l->local_port = 4096 + link;
+    out_link(link);
+    out(F("CONNECT\r\n\r\nOK\r\n"));
+}
+
+/* Host names under ".invalid" do not resolve */
+bool ESP8266Sim::dns_fails(const char *host)
+{
+    size_t len = strlen(host);
+    return len >= 8 && strcmp(host + len - 8, ".invalid") == 0;
+}
+
+void ESP8266Sim::command_cipdomain(const char *args)
+{
+    char host[ESP8266_SIM_HOST_SIZE + 1];
+    uint32_t h = 0;
+    const char *p;
+
+    if (parse_quoted(args, host, sizeof(host)) == NULL || !m_joined[0]) {
+        error();
+        return;
+    }
+    if (dns_fails(host)) {
+        m_errors++;
+        out(F("DNS Fail\r\n\r\nERROR\r\n"));
+        return;
+    }
+    /* The same address for the same name */
+    for (p = host; *p; p++) {
+        h = h * 31 + (uint8_t)*p;
+    }
+    out(F("+CIPDOMAIN:10."));
+    out_number((h >> 16) & 0xFF);
+    out(F("."));
+    out_number((h >> 8) & 0xFF);
+    out(F("."));
+    out_number(h & 0xFF);
+    out(F("\r\n\r\nOK\r\n"));
+}
+
+void ESP8266Sim::command_cipsend(const char *args)
+{
+    int8_t link;
+    uint32_t len;
+    bool ex;
+
+    if (*args == '\0') {
+        /* Transparent transmission */
+        if (!m_cipmode || !m_links[0].connected) {
+            error();
+            return;
+        }
+        out(F("\r\nOK\r\n\r\n>"));
+        m_passthrough = true;
+        m_plus = 0;
+        m_send_link = 0;
+        m_send_buf_len = 0;
+        return;
+    }
+    ex = (strncmp(args, "EX", 2) == 0);
+    if (ex) {
+        args += 2;
+    }
+    if (*args++ != '=' || (link = parse_link(&args)) < 0) {
+        error();
+        return;
+    }
+    len = strtoul(args, NULL, 10);
+    if (!m_links[link].connected || len == 0 || len > ESP8266_SEND_CHUNK_SIZE) {
+        m_errors++;
+        out(F("link is not valid\r\n\r\nERROR\r\n"));
+        return;
+    }
+    out(F("\r\nOK\r\n> "));
+    m_send_link = link;
+    m_send_remain = len;
+    m_send_len = len;
+    m_send_buf_len = 0;
+    m_send_ex = ex;
+    m_send_slash = false;
+}
+
+void ESP8266Sim::command_cipclose(const char *args)
+{
+    int8_t link = 0;
+    uint8_t i;
+
+    if (*args == '=') {
+        link = args[1] - '0';
+        if (!m_mux || link < 0 || link > ESP8266_MAX_LINKS) {
+            error();
+            return;
+        }
+    } else if (m_mux) {
+        error();
+        return;
+    }
+    if (link == ESP8266_MAX_LINKS) {
+        /* AT+CIPCLOSE=5 closes all */
+        for (i = 0; i < ESP8266_MAX_LINKS; i++) {
+            m_links[i].connected = false;
+        }
+        ok();
+        return;
+    }
+    if (!m_links[link].connected) {
+        m_errors++;
+        out(F("link is not valid\r\n\r\nERROR\r\n"));
+        return;
+    }
+    m_links[link].connected = false;
+    out_link(link);
+    out(F("CLOSED\r\n\r\nOK\r\n"));
+}
+
+void ESP8266Sim::command_baud(const char *args)
+{
+    uint32_t baud = strtoul(args, NULL, 10);
+
+    if (baud < 1200) {
+        error();
+        return;
+    }
+    ok();
+    /* "OK" still goes at the old rate */
+    m_baud_pending = baud;
+    if (strncmp(m_line, "AT+UART_CUR", 11) != 0) {
+        m_baud_default = baud;
+    }
+}
+
+void ESP8266Sim::data(uint8_t c)
+{
+    if (m_send_slash) {
+        /* "\0" ends the data of AT+CIPSENDEX before its length */
+        m_send_slash = false;
+        if (c == '0') {
+            /* Flushed first, so what the far end answers comes after "SEND OK" */
+            data_flush();
+            m_send_len -= m_send_remain;
+            m_send_remain = 0;
+            data_end();
+            return;
+        }
+        data_put('\\');
+    }
+    if (m_send_ex && c == '\\' && m_send_remain > 1) {
+        m_send_slash = true;
+        return;
+    }
+    data_put(c);
+    if (m_send_remain == 0) {
+        data_end();
+    }
+}
+
+void ESP8266Sim::data_put(uint8_t c)
+{
+    m_send_buf[m_send_buf_len++] = c;
+    m_bytes_sent++;
+    /* Flushed while still sending, so what the far end answers comes after "SEND OK" */
+    if (m_send_remain == 1 || m_send_buf_len == sizeof(m_send_buf)) {
+        data_flush();
+    }
+    m_send_remain--;
+}
+
+void ESP8266Sim::data_end(void)
+{
+    out(F("\r\nRecv "));
+    out_number(m_send_len);
+    out(F(" bytes\r\n\r\nSEND OK\r\n"));
+    m_send_link = -1;
+
+    /* Now what the far end answered meanwhile */
+    if (m_deferred.available() > 0) {
+        hold(m_latency);
+        while (m_deferred.available() > 0) {
+            m_out.write(m_deferred.read());
+        }
+    }
+}
+
+void ESP8266Sim::data_flush(void)
+{
+    if (m_send_buf_len > 0 && m_handler) {
+        m_handler(m_send_link, m_send_buf, m_send_buf_len, m_handler_arg);
+    }
+    m_send_buf_len = 0;
+}
+
+void ESP8266Sim::passthrough(uint8_t c)
+{
+    /* "+++" alone, with silence around it, leaves */
+    if (c == '+' && m_plus < 3 && (m_plus > 0 || millis() - m_last_write >= ESP8266_PASSTHROUGH_GUARD_TIME)) {
+        m_plus++;
+        return;
+    }
+    for (; m_plus > 0; m_plus--) {
+        forward('+');
+    }
+    forward(c);
+}
+
+void ESP8266Sim::forward(uint8_t c)
+{
+    m_send_buf[m_send_buf_len++] = c;
+    m_bytes_sent++;
+    if (m_send_buf_len == sizeof(m_send_buf)) {
+        data_flush();
+    }
+}
+
+void ESP8266Sim::out(const __FlashStringHelper *str)
+{
+    PGM_P p = (PGM_P)str;
+    uint8_t c;
+
+    while ((c = pgm_read_byte(p++)) != '\0') {
+        target().write(c);
+    }
+}
+
+void ESP8266Sim::out(const char *str)
+{
+    out((const uint8_t *)str, strlen(str));
+}
+
+void ESP8266Sim::out(const uint8_t *data, uint32_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        target().write(data[i]);
+    }
+}
+
+void ESP8266Sim::out_number(uint32_t n)
+{
+    char digits[11];
+    uint8_t i = sizeof(digits) - 1;
+
+    digits[i] = '\0';
+    do {
+        digits[--i] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    out(digits + i);
+}
+
+void ESP8266Sim::out_link(uint8_t link)
+{
+    if (m_mux) {
+        out_number(link);
+        out(F(","));
+    }
+}
+
+void ESP8266Sim::ok(void)
+{
+    out(F("\r\nOK\r\n"));
+}
+
+void ESP8266Sim::error(void)
+{
+    m_errors++;
+    out(F("\r\nERROR\r\n"));
+}
+
+void ESP8266Sim::hold(uint32_t ms)
+{
+    unsigned long now = micros();
+    unsigned long start = now + ms * 1000UL;
+
+    if (m_ready == m_out.available() && (long)(now - m_next) > 0) {
+        /* The line was idle */
+        m_next = now;
+    }
+    if ((long)(start - m_next) > 0) {
+        m_next = start;
+    }
+}
+
+void ESP8266Sim::release(void)
+{
+    unsigned long now = micros();
+
+    if (m_booting && millis() - m_boot_start >= m_boot) {
+        m_booting = false;
+        m_baud = m_baud_default;
+        hold(0);
+        out(F("\r\nready\r\n"));
+    }
+    if (m_baud_pending && m_out.available() == 0) {
+        m_baud = m_baud_pending;
+        m_baud_pending = 0;
+    }
+    if (m_passthrough) {
+        if (m_plus == 3 && millis() - m_last_write >= ESP8266_PASSTHROUGH_GUARD_TIME) {
+            m_passthrough = false;
+            m_plus = 0;
+            m_send_link = -1;
+        }
+        data_flush();
+    }
+
+    while (m_ready < m_out.available() && (!m_timing || (long)(now - m_next) >= 0)) {
+        m_ready++;
+        m_next += 10000000UL / m_baud;
+    }
+    if (m_baud_local != m_baud) {
+        /* Garbage to the local end */
+        m_out.consume(m_ready);
+        m_ready = 0;
+    }
+}
+
+void ESP8266Sim::boot(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < ESP8266_MAX_LINKS; i++) {
+        m_links[i].connected = false;
+    }
+    m_mux = false;
+    m_cipmode = false;
+    m_server = 0;
+    m_booting = true;
+    m_boot_start = millis();
+}
+
+bool ESP8266Sim::fail(void)
+{
+    if (m_error_rate == 0) {
+        return false;
+    }
+    /* xorshift32 */
+    m_random ^= m_random << 13;
+    m_random ^= m_random >> 17;
+    m_random ^= m_random << 5;
+    return m_random % 100 < m_error_rate;
+}
@@ -0,0 +1,294 @@
+/**
+ * @file ESP8266Sim.h
+ * @brief The definition of class ESP8266Sim.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __ESP8266SIM_H__
+#define __ESP8266SIM_H__
+
+#include "ESP8266.h"
+
+/*
+ * The capacity of the output of the simulated ESP8266, not read yet.
+ */
+#ifndef ESP8266_SIM_BUFFER_SIZE
+#define ESP8266_SIM_BUFFER_SIZE     (256)
+#endif
+
+/*
+ * The longest AT command taken.
+ */
+#ifndef ESP8266_SIM_LINE_SIZE
+#define ESP8266_SIM_LINE_SIZE       (96)
+#endif
+
+/*
+ * The most access points addAP() keeps for AT+CWLAP.
+ */
+#ifndef ESP8266_SIM_MAX_APS
+#define ESP8266_SIM_MAX_APS         (4)
+#endif
+
+/*
+ * The longest host name kept for AT+CIPSTATUS.
+ */
+#ifndef ESP8266_SIM_HOST_SIZE
+#define ESP8266_SIM_HOST_SIZE       (24)
+#endif
+
+/**
+ * Called with data sent on a link, by AT+CIPSEND or in transparent transmission.
+ *
+ * Data of one AT+CIPSEND may come in several calls. What ESP8266Sim::receive()
+ * is given meanwhile is answered after "SEND OK", as a real server would do.
+ *
+ * @param link - the link the data was sent on.
+ * @param data - the data.
+ * @param len - the length of data.
+ * @param arg - the argument given to setHandler().
+ */
+typedef void (*ESP8266SimHandler)(uint8_t link, const uint8_t *data, uint32_t len, void *arg);
+
+/**
+ * A simulated ESP8266 with the AT firmware, to be used as the transport of
+ * ESP8266 where there is no module, e.g. on a PC or in a test:
+ *
+ *     ESP8266Sim sim;
+ *     ESP8266 wifi(sim);
+ *
+ *     sim.setHandler(echo, &sim);     // echo calls sim.receive(link, data, len)
+ *     wifi.createTCP("example.com", 80);
+ *
+ * It answers the AT commands this library uses(AT+RST, AT+CWJAP, AT+CWLAP,
+ * AT+CIPSTART, AT+CIPSEND, AT+UART_CUR, ...) and delivers data of the far end
+ * with +IPD. Its output comes no faster than the baud rate allows and each
+ * reply can be delayed or replaced by "ERROR" at random, so the numbers taken
+ * against it(see the counters) tell how the library copes with a real link.
+ */
+class ESP8266Sim : public Stream {
+ public:
+    /**
+     * Constructor.
+     *
+     * @param baud - the baud rate the simulated ESP8266 starts with.
+     */
+    ESP8266Sim(uint32_t baud = 9600);
+
+    /**
+     * Set the baud rate of the local end. Nothing gets through while it is not
+     * the one of the simulated ESP8266.
+     */
+    void begin(uint32_t baud);
+
+    int available(void);
+    int read(void);
+    int peek(void);
+    void flush(void);
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+
+    /**
+     * Set the delay(milliseconds) before each reply and the boot time of AT+RST.
+     */
+    void setLatency(uint32_t latency, uint32_t boot = 300);
+
+    /**
+     * Turn the timing of the baud rate on(default) or off. Off, output is
+     * available at once.
+     */
+    void setTiming(bool on);
+
+    /**
+     * Answer commands with "ERROR" at random.
+     *
+     * @param percent - the share of commands which fail.
+     * @param seed - the seed of the random sequence, so that a run can be repeated.
+     */
+    void setErrorRate(uint8_t percent, uint32_t seed = 1);
+
+    /**
+     * Set the function called with data sent on links.
+     */
+    void setHandler(ESP8266SimHandler handler, void *arg = NULL);
+
+    /**
+     * Add an access point to the list of AT+CWLAP. Once there is one,
+     * AT+CWJAP joins only those in the list.
+     */
+    bool addAP(const char *ssid, int8_t rssi, uint8_t ecn = 3, uint8_t channel = 1);
+
+    /**
+     * Data sent by the far end of a link.
+     *
+     * @retval true - success.
+     * @retval false - the link is closed or the output is full.
+     */
+    bool receive(uint8_t link, const uint8_t *data, uint32_t len);
+
+    /**
+     * A client connects to the server started by AT+CIPSERVER on link.
+     */
+    bool accept(uint8_t link);
+
+    /**
+     * The far end closes a link.
+     */
+    void close(uint8_t link);
+
+    /**
+     * Check whether a link is connected.
+     */
+    bool connected(uint8_t link) const;
+
+    /**
+     * Get the number of AT commands taken.
+     */
+    uint32_t getCommandCount(void) const { return m_commands; }
+
+    /**
+     * Get the number of commands answered with "ERROR" or "FAIL".
+     */
+    uint32_t getErrorCount(void) const { return m_errors; }
+
+    /**
+     * Get the number of data bytes sent on links by the library.
+     */
+    uint32_t getBytesSent(void) const { return m_bytes_sent; }
+
+    /**
+     * Get the number of data bytes delivered to the library.
+     */
+    uint32_t getBytesReceived(void) const { return m_bytes_received; }
+
+    /**
+     * Get how many output bytes were lost because the output was full.
+     */
+    uint32_t getOverflowCount(void) const { return m_out.overflowCount(); }
+
+    /**
+     * Reset the counters.
+     */
+    void resetStats(void);
+
+ private:
+    void command(void);
+    void command_cwjap(const char *args);
+    void command_cwlap(void);
+    void command_cipstart(const char *args);
+    void command_cipsend(const char *args);
+    void command_cipclose(const char *args);
+    void command_cipstatus(void);
+    void command_cipdomain(const char *args);
+    bool dns_fails(const char *host);
+    void command_baud(const char *args);
+
+    /* The link given first in args of multiple mode, -1 if not valid */
+    int8_t parse_link(const char **args);
+
+    void data(uint8_t c);
+    void data_put(uint8_t c);
+    void data_flush(void);
+    void data_end(void);
+    void passthrough(uint8_t c);
+    void forward(uint8_t c);
+
+    /* Queue output, its first byte after the latency */
+    void out(const __FlashStringHelper *str);
+    void out(const char *str);
+    void out(const uint8_t *data, uint32_t len);
+    void out_number(uint32_t n);
+    void out_link(uint8_t link);
+    void ok(void);
+    void error(void);
+
+    /* Hold the output back for ms more */
+    void hold(uint32_t ms);
+    ESP8266RingBuffer<ESP8266_SIM_BUFFER_SIZE> &target(void) { return m_defer ? m_deferred : m_out; }
+
+    /* Let through what the baud rate allows, and what time has made due */
+    void release(void);
+    void boot(void);
+    bool fail(void);
+
+    ESP8266RingBuffer<ESP8266_SIM_BUFFER_SIZE> m_out;
+    ESP8266RingBuffer<ESP8266_SIM_BUFFER_SIZE> m_deferred;    /* received during AT+CIPSEND */
+    bool m_defer;                   /* out() goes to m_deferred */
+    uint16_t m_ready;               /* bytes of m_out the baud rate has let through */
+    unsigned long m_next;           /* when(micros) the next byte is through */
+    bool m_timing;
+    uint32_t m_latency;
+    uint32_t m_boot;
+    bool m_booting;
+    unsigned long m_boot_start;     /* millis */
+
+    uint32_t m_baud;                /* of the simulated ESP8266 */
+    uint32_t m_baud_default;
+    uint32_t m_baud_local;          /* of the local end */
+    uint32_t m_baud_pending;        /* set by AT+UART_CUR once "OK" is out, 0 if none */
+
+    char m_line[ESP8266_SIM_LINE_SIZE + 1];
+    uint8_t m_line_len;
+    bool m_echo;
+
+    uint8_t m_error_rate;
+    uint32_t m_random;
+
+    ESP8266SimHandler m_handler;
+    void *m_handler_arg;
+
+    struct AP {
+        char ssid[33];
+        int8_t rssi;
+        uint8_t ecn;
+        uint8_t channel;
+    } m_aps[ESP8266_SIM_MAX_APS];
+    uint8_t m_ap_count;
+    bool m_cwlap_sort;              /* AT+CWLAPOPT */
+    uint16_t m_cwlap_mask;
+    char m_joined[33];
+
+    struct Link {
+        bool connected;
+        bool udp;
+        bool server;                /* accepted by the server */
+        char host[ESP8266_SIM_HOST_SIZE + 1];
+        uint32_t port;
+        uint32_t local_port;
+    } m_links[ESP8266_MAX_LINKS];
+    uint8_t m_mode;                 /* AT+CWMODE */
+    bool m_mux;
+    bool m_cipmode;
+    uint32_t m_server;              /* the port of AT+CIPSERVER, 0 if none */
+
+    int8_t m_send_link;             /* of AT+CIPSEND, -1 if none */
+    uint32_t m_send_remain;         /* data of AT+CIPSEND still to come */
+    uint32_t m_send_len;
+    uint8_t m_send_buf[32];
+    uint8_t m_send_buf_len;
+    bool m_send_ex;                 /* AT+CIPSENDEX, ended early by "\0" */
+    bool m_send_slash;              /* a backslash held back to tell "\0" */
+    bool m_passthrough;
+    uint8_t m_plus;                 /* "+" of "+++" held back */
+    unsigned long m_last_write;     /* millis */
+
+    uint32_t m_commands;
+    uint32_t m_errors;
+    uint32_t m_bytes_sent;
+    uint32_t m_bytes_received;
+};
+
+#endif /* #ifndef __ESP8266SIM_H__ */
@@ -0,0 +1,159 @@
+/**
+ * @file ESP8266Stats.h
+ * @brief Optional statistics of the commands and of the UART.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __ESP8266STATS_H__
+#define __ESP8266STATS_H__
+
+#include "Arduino.h"
+
+/*
+ * Set to 1 to keep statistics(see ESP8266::getStats()). At 0, they take
+ * neither memory nor time.
+ */
+#ifndef ESP8266_STATS
+#define ESP8266_STATS               (0)
+#endif
+
+/*
+ * The number of latency buckets of each command. Bucket 0 holds latencies
+ * below 2 milliseconds, each next one up to 4 times more, the last one all
+ * the rest: < 2, < 8, < 32, < 128, < 512, < 2048, < 8192, >= 8192 ms.
+ */
+#ifndef ESP8266_STATS_BUCKETS
+#define ESP8266_STATS_BUCKETS       (8)
+#endif
+
+/**
+ * The kinds of AT command.
+ */
+enum ESP8266Cmd {
+    ESP8266_CMD_AT,                 /**< AT */
+    ESP8266_CMD_RST,                /**< AT+RST */
+    ESP8266_CMD_GMR,                /**< AT+GMR */
+    ESP8266_CMD_CWMODE,             /**< AT+CWMODE, AT+CWMODE_CUR */
+    ESP8266_CMD_CWJAP,              /**< AT+CWJAP */
+    ESP8266_CMD_CWLAP,              /**< AT+CWLAP */
+    ESP8266_CMD_CWLAPOPT,           /**< AT+CWLAPOPT */
+    ESP8266_CMD_CWQAP,              /**< AT+CWQAP */
+    ESP8266_CMD_CWSAP,              /**< AT+CWSAP */
+    ESP8266_CMD_CWLIF,              /**< AT+CWLIF */
+    ESP8266_CMD_CIPSTATUS,          /**< AT+CIPSTATUS */
+    ESP8266_CMD_CIPDOMAIN,          /**< AT+CIPDOMAIN */
+    ESP8266_CMD_CIPSTART,           /**< AT+CIPSTART */
+    ESP8266_CMD_CIPSEND,            /**< AT+CIPSEND, up to "SEND OK" when the data goes along */
+    ESP8266_CMD_CIPSEND_DATA,       /**< data after ">" of sendStream(), up to "SEND OK" */
+    ESP8266_CMD_CIPCLOSE,           /**< AT+CIPCLOSE */
+    ESP8266_CMD_CIFSR,              /**< AT+CIFSR */
+    ESP8266_CMD_CIPMUX,             /**< AT+CIPMUX */
+    ESP8266_CMD_CIPSERVER,          /**< AT+CIPSERVER */
+    ESP8266_CMD_CIPSTO,             /**< AT+CIPSTO */
+    ESP8266_CMD_CIPMODE,            /**< AT+CIPMODE */
+    ESP8266_CMD_UART,               /**< AT+UART_CUR */
+    ESP8266_CMD_COUNT
+};
+
+#if ESP8266_STATS
+
+/**
+ * What happened to one kind of AT command.
+ */
+struct ESP8266CmdStats {
+    uint16_t calls;
+    uint16_t ok;
+    uint16_t errors;
+    uint16_t timeouts;
+    uint32_t time;                  /**< the sum of latencies, in milliseconds */
+    uint32_t tx;                    /**< bytes written, with the data of AT+CIPSEND */
+    uint32_t rx;                    /**< bytes received while in flight */
+    uint16_t latency[ESP8266_STATS_BUCKETS];    /**< the number of calls per bucket */
+};
+
+/**
+ * A snapshot of all statistics, plain data to be sent as it is.
+ */
+struct ESP8266Stats {
+    ESP8266CmdStats cmd[ESP8266_CMD_COUNT];
+    uint32_t tx;                    /**< bytes written to the UART */
+    uint32_t rx;                    /**< bytes read from the UART */
+    uint32_t rx_overflows;          /**< times the RX buffer filled up, see ESP8266::getRxOverflowCount() */
+    uint32_t link_drops;            /**< see ESP8266::getLinkDropCount(), all links together */
+    uint32_t find_timeouts;         /**< recvFind() which gave up, e.g. in sendAndCheck() */
+};
+
+/**
+ * Get the latency bucket of ms.
+ */
+inline uint8_t ESP8266StatsBucket(uint32_t ms)
+{
+    uint8_t bucket = 0;
+
+    for (ms >>= 1; ms > 0 && bucket < ESP8266_STATS_BUCKETS - 1; ms >>= 2) {
+        bucket++;
+    }
+    return bucket;
+}
+
+/**
+ * Count the bytes going through a Stream.
+ */
+class ESP8266StatsStream : public Stream {
+ public:
+    ESP8266StatsStream(Stream &stream): m_stream(&stream), m_tx(0), m_rx(0) {}
+
+    int available(void) { return m_stream->available(); }
+    int peek(void) { return m_stream->peek(); }
+    void flush(void) { m_stream->flush(); }
+
+    int read(void)
+    {
+        int c = m_stream->read();
+        if (c != -1) {
+            m_rx++;
+        }
+        return c;
+    }
+
+    size_t write(uint8_t c)
+    {
+        size_t n = m_stream->write(c);
+        m_tx += n;
+        return n;
+    }
+
+    size_t write(const uint8_t *buffer, size_t size)
+    {
+        size_t n = m_stream->write(buffer, size);
+        m_tx += n;
+        return n;
+    }
+
+    using Print::write;
+
+    uint32_t tx(void) const { return m_tx; }
+    uint32_t rx(void) const { return m_rx; }
+    void reset(void) { m_tx = m_rx = 0; }
+
+ private:
+    Stream *m_stream;
+    uint32_t m_tx;
+    uint32_t m_rx;
+};
+
+#endif /* #if ESP8266_STATS */
+
+#endif /* #ifndef __ESP8266STATS_H__ */
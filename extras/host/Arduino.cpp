@@ -0,0 +1,241 @@
+/**
+ * @file Arduino.cpp
+ * @brief The part of the Arduino core the library uses, for a build on a PC.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "Arduino.h"
+
+#include <new>
+#include <time.h>
+
+HardwareSerial Serial;
+
+static uint32_t alloc_count = 0;
+static uint32_t alloc_bytes = 0;
+
+/*----------------------------------------------------------------------------*/
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+unsigned long millis(void)
+{
+    return (unsigned long)(now_us() / 1000);
+}
+
+unsigned long micros(void)
+{
+    return (unsigned long)now_us();
+}
+
+void delay(unsigned long ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000;
+    nanosleep(&ts, NULL);
+}
+
+void yield(void)
+{
+}
+
+/*----------------------------------------------------------------------------*/
+
+uint32_t hostAllocCount(void)
+{
+    return alloc_count;
+}
+
+uint32_t hostAllocBytes(void)
+{
+    return alloc_bytes;
+}
+
+void *operator new(size_t size)
+{
+    void *p = malloc(size ? size : 1);
+
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    alloc_count++;
+    alloc_bytes += size;
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+
+/*----------------------------------------------------------------------------*/
+
+String::String(const char *str): m_buffer(NULL), m_len(0), m_capacity(0)
+{
+    *this = str;
+}
+
+String::String(const __FlashStringHelper *str): m_buffer(NULL), m_len(0), m_capacity(0)
+{
+    *this = (const char *)str;
+}
+
+String::String(const String &other): m_buffer(NULL), m_len(0), m_capacity(0)
+{
+    *this = other;
+}
+
+String::~String()
+{
+    delete[] m_buffer;
+}
+
+String &String::operator=(const String &other)
+{
+    if (this != &other) {
+        m_len = 0;
+        concat(other.m_buffer, other.m_len);
+    }
+    return *this;
+}
+
+String &String::operator=(const char *str)
+{
+    m_len = 0;
+    concat(str ? str : "", str ? strlen(str) : 0);
+    return *this;
+}
+
+bool String::reserve(unsigned int size)
+{
+    char *buffer;
+
+    if (m_buffer && m_capacity >= size) {
+        return true;
+    }
+    buffer = new char[size + 1];
+    if (m_buffer) {
+        memcpy(buffer, m_buffer, m_len + 1);
+        delete[] m_buffer;
+    } else {
+        buffer[0] = '\0';
+    }
+    m_buffer = buffer;
+    m_capacity = size;
+    return true;
+}
+
+bool String::concat(const char *str, unsigned int len)
+{
+    /* Arduino's String grows to the exact length each time */
+    if (!reserve(m_len + len)) {
+        return false;
+    }
+    memcpy(m_buffer + m_len, str, len);
+    m_len += len;
+    m_buffer[m_len] = '\0';
+    return true;
+}
+
+void String::remove(unsigned int index)
+{
+    if (index < m_len) {
+        m_len = index;
+        m_buffer[m_len] = '\0';
+    }
+}
+
+void String::remove(unsigned int index, unsigned int count)
+{
+    if (index >= m_len) {
+        return;
+    }
+    if (count > m_len - index) {
+        count = m_len - index;
+    }
+    memmove(m_buffer + index, m_buffer + index + count, m_len - index - count + 1);
+    m_len -= count;
+}
+
+int String::indexOf(const char *str, unsigned int from) const
+{
+    const char *found;
+
+    if (from >= m_len) {
+        return -1;
+    }
+    found = strstr(m_buffer + from, str);
+    return found ? (int)(found - m_buffer) : -1;
+}
+
+/*----------------------------------------------------------------------------*/
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+
+    while (size--) {
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+size_t Print::print(long n, int base)
+{
+    char text[24];
+
+    if (base == HEX) {
+        snprintf(text, sizeof(text), "%lx", (unsigned long)n);
+    } else {
+        snprintf(text, sizeof(text), "%ld", n);
+    }
+    return write(text);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+    char text[24];
+
+    snprintf(text, sizeof(text), base == HEX ? "%lx" : "%lu", n);
+    return write(text);
+}
@@ -0,0 +1,150 @@
+/**
+ * @file Arduino.h
+ * @brief The part of the Arduino core the library uses, for a build on a PC.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __ARDUINO_HOST_H__
+#define __ARDUINO_HOST_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define DEC 10
+#define HEX 16
+
+/*
+ * Time, from a monotonic clock. delay() sleeps.
+ */
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void yield(void);
+
+/*
+ * Flash is ordinary memory here.
+ */
+#define PROGMEM
+#define PGM_P                   const char *
+#define PSTR(s)                 (s)
+#define pgm_read_byte(p)        (*(const uint8_t *)(p))
+#define pgm_read_word(p)        (*(const uint16_t *)(p))
+#define pgm_read_dword(p)       (*(const uint32_t *)(p))
+#define pgm_read_ptr(p)         (*(const void * const *)(p))
+#define memcpy_P                memcpy
+#define strlen_P                strlen
+#define strcmp_P                strcmp
+#define strncmp_P               strncmp
+#define strncpy_P               strncpy
+#define strstr_P                strstr
+
+class __FlashStringHelper;
+#define F(s)                    (reinterpret_cast<const __FlashStringHelper *>(PSTR(s)))
+
+/*
+ * The number of operator new calls so far, and of bytes they asked for.
+ */
+uint32_t hostAllocCount(void);
+uint32_t hostAllocBytes(void);
+
+/**
+ * String on the heap, growing as Arduino's does, so that allocations are 
+ * counted as they would be on a board. 
+ */
+class String {
+ public:
+    String(const char *str = "");
+    String(const __FlashStringHelper *str);
+    String(const String &other);
+    ~String();
+
+    String &operator=(const String &other);
+    String &operator=(const char *str);
+    String &operator+=(const String &other) { concat(other.m_buffer, other.m_len); return *this; }
+    String &operator+=(const char *str) { concat(str, strlen(str)); return *this; }
+    String &operator+=(char c) { concat(&c, 1); return *this; }
+    bool operator==(const String &other) const { return strcmp(m_buffer, other.m_buffer) == 0; }
+    bool operator==(const char *str) const { return strcmp(m_buffer, str) == 0; }
+    char operator[](unsigned int index) const { return index < m_len ? m_buffer[index] : 0; }
+
+    bool reserve(unsigned int size);
+    bool concat(const char *str, unsigned int len);
+    void remove(unsigned int index);
+    void remove(unsigned int index, unsigned int count);
+    int indexOf(const char *str, unsigned int from = 0) const;
+    unsigned int length(void) const { return m_len; }
+    const char *c_str(void) const { return m_buffer; }
+
+ private:
+    char *m_buffer;
+    unsigned int m_len;
+    unsigned int m_capacity;
+};
+
+class Print {
+ public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+    virtual void flush(void) {}
+
+    size_t print(const char *str) { return write(str); }
+    size_t print(const __FlashStringHelper *str) { return write((const char *)str); }
+    size_t print(const String &str) { return write(str.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t println(void) { return write("\r\n"); }
+    template <class T> size_t println(const T &value) { return print(value) + println(); }
+    template <class T> size_t println(const T &value, int base) { return print(value, base) + println(); }
+};
+
+class Stream : public Print {
+ public:
+    virtual int available(void) = 0;
+    virtual int read(void) = 0;
+    virtual int peek(void) = 0;
+};
+
+/**
+ * Serial writes to stdout and reads nothing. 
+ */
+class HardwareSerial : public Stream {
+ public:
+    void begin(unsigned long baud) { (void)baud; }
+    void end(void) {}
+    int available(void) { return 0; }
+    int read(void) { return -1; }
+    int peek(void) { return -1; }
+    size_t write(uint8_t c) { return fputc(c, stdout) == EOF ? 0 : 1; }
+    size_t write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, stdout); }
+    using Print::write;
+    operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif /* #ifndef __ARDUINO_HOST_H__ */
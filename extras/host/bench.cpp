@@ -0,0 +1,224 @@
+/**
+ * @file bench.cpp
+ * @brief Throughput and latency of the library against ESP8266Sim, on a PC.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "ESP8266Sim.h"
+
+/*
+ * Each benchmark runs twice: with the UART timing of ESP8266Sim off, which
+ * measures the time the library itself takes, and at 115200 baud, which
+ * shows how much of the link it makes use of. ESP8266Sim times only what it
+ * sends, so data written to it goes at the speed of the PC.
+ *
+ * "allocs" is the number of operator new per operation, "AT" the number of
+ * AT commands per operation.
+ *
+ * Usage: bench [scale], scale multiplying the number of operations.
+ */
+
+#define BENCH_BAUD          (115200)
+
+struct Result {
+    double per_second;              /* operations or bytes */
+    double us_per_op;
+    double allocs_per_op;
+    double extra_per_op;            /* AT commands per operation */
+};
+
+class Bench {
+ public:
+    Bench(bool timing): m_sim(BENCH_BAUD), m_wifi(m_sim, BENCH_BAUD)
+    {
+        m_sim.setTiming(timing);
+        m_sim.addAP("bench", -40);
+    }
+
+    bool connect(void)
+    {
+        return m_wifi.kick() && m_wifi.setOprToStation() && m_wifi.joinAP("bench", "pw")
+            && m_wifi.disableMUX() && m_wifi.createTCP("bench.example", 80);
+    }
+
+    Result commands(uint32_t count);
+    Result rx(uint32_t total);
+    Result send(uint32_t count, uint32_t len);
+    Result stream(uint32_t count, uint32_t len);
+    Result version(uint32_t count);
+
+ private:
+    void start(void)
+    {
+        m_allocs = hostAllocCount();
+        m_commands = m_sim.getCommandCount();
+        m_start = micros();
+    }
+
+    Result finish(uint32_t ops, uint32_t units)
+    {
+        Result r;
+        double us = (double)(micros() - m_start);
+
+        if (us < 1) {
+            us = 1;
+        }
+        r.per_second = units * 1e6 / us;
+        r.us_per_op = us / ops;
+        r.allocs_per_op = (double)(hostAllocCount() - m_allocs) / ops;
+        r.extra_per_op = (double)(m_sim.getCommandCount() - m_commands) / ops;
+        return r;
+    }
+
+    ESP8266Sim m_sim;
+    ESP8266 m_wifi;
+    uint32_t m_allocs;
+    uint32_t m_commands;
+    unsigned long m_start;
+};
+
+Result Bench::commands(uint32_t count)
+{
+    uint32_t i, ok = 0;
+
+    start();
+    for (i = 0; i < count; i++) {
+        ok += m_wifi.kick();
+    }
+    if (ok != count) {
+        printf("  %lu of %lu AT failed\n", (unsigned long)(count - ok), (unsigned long)count);
+    }
+    return finish(count, count);
+}
+
+Result Bench::rx(uint32_t total)
+{
+    uint8_t chunk[128];
+    uint8_t buffer[256];
+    uint32_t sent = 0, got = 0, n;
+    uint32_t reads = 0;
+
+    memset(chunk, 'x', sizeof(chunk));
+    start();
+    while (got < total) {
+        n = total - sent < sizeof(chunk) ? total - sent : sizeof(chunk);
+        if (n > 0 && m_sim.receive(0, chunk, n)) {
+            sent += n;
+        }
+        n = m_wifi.recv(buffer, sizeof(buffer), 10);
+        if (n == 0 && sent == total) {
+            printf("  %lu bytes lost\n", (unsigned long)(total - got));
+            break;
+        }
+        got += n;
+        reads++;
+    }
+    return finish(reads ? reads : 1, got);
+}
+
+Result Bench::send(uint32_t count, uint32_t len)
+{
+    uint8_t data[2048];
+    uint32_t i, ok = 0;
+
+    memset(data, 'y', sizeof(data));
+    start();
+    for (i = 0; i < count; i++) {
+        ok += m_wifi.send(data, len);
+    }
+    if (ok != count) {
+        printf("  %lu of %lu sends failed\n", (unsigned long)(count - ok), (unsigned long)count);
+    }
+    return finish(count, count);
+}
+
+/* Gives len bytes of 'z' in pieces of up to 100, the total not told */
+static uint32_t produce(uint8_t *buffer, uint32_t size, void *arg)
+{
+    uint32_t *left = (uint32_t *)arg;
+    uint32_t n = *left < size ? *left : size;
+
+    if (n > 100) {
+        n = 100;
+    }
+    memset(buffer, 'z', n);
+    *left -= n;
+    return n;
+}
+
+Result Bench::stream(uint32_t count, uint32_t len)
+{
+    uint32_t i, left, ok = 0;
+
+    start();
+    for (i = 0; i < count; i++) {
+        left = len;
+        ok += m_wifi.sendStream(produce, &left);
+    }
+    if (ok != count) {
+        printf("  %lu of %lu streams failed\n", (unsigned long)(count - ok), (unsigned long)count);
+    }
+    return finish(count, count * len);
+}
+
+Result Bench::version(uint32_t count)
+{
+    uint32_t i;
+
+    start();
+    for (i = 0; i < count; i++) {
+        m_wifi.getVersion();
+    }
+    return finish(count, count);
+}
+
+/*----------------------------------------------------------------------------*/
+
+static void report(const char *name, const char *unit, const Result &fast, const Result &baud)
+{
+    printf("%-26s %12.0f %-8s %10.1f %12.0f %-8s %10.1f %8.2f %7.2f\n", name,
+        fast.per_second, unit, fast.us_per_op, baud.per_second, unit, baud.us_per_op,
+        fast.allocs_per_op, fast.extra_per_op);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t scale = argc > 1 ? strtoul(argv[1], NULL, 10) : 1;
+    Bench fast(false), baud(true);
+
+    if (scale == 0) {
+        scale = 1;
+    }
+    if (!fast.connect() || !baud.connect()) {
+        printf("cannot connect to the simulated ESP8266\n");
+        return 1;
+    }
+
+    printf("%-26s %21s %10s %21s %10s %8s %7s\n", "", "no UART timing", "us/op",
+        "115200 baud", "us/op", "allocs", "AT");
+    report("AT(kick)", "cmd/s",
+        fast.commands(2000 * scale), baud.commands(200 * scale));
+    report("+IPD receive", "B/s",
+        fast.rx(1000000 * scale), baud.rx(50000 * scale));
+    report("send 64 bytes", "send/s",
+        fast.send(2000 * scale, 64), baud.send(200 * scale, 64));
+    report("send 1024 bytes", "send/s",
+        fast.send(500 * scale, 1024), baud.send(50 * scale, 1024));
+    report("sendStream 8 KB, no total", "B/s",
+        fast.stream(50 * scale, 8192), baud.stream(5 * scale, 8192));
+    report("getVersion() String", "cmd/s",
+        fast.version(1000 * scale), baud.version(100 * scale));
+    return 0;
+}
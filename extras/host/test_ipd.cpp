@@ -0,0 +1,289 @@
+/**
+ * @file test_ipd.cpp
+ * @brief Tests of ESP8266IPDParser and of +IPD in ESP8266, fed recorded byte streams.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "test.h"
+#include "ESP8266Sim.h"
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Feed stream to a parser in pieces of the given sizes(all of it at once if
+ * none), the parser carrying over from one piece to the next. Returns the
+ * number of headers found, with the id and length of the last one and the
+ * offset of its ':'.
+ */
+struct Found {
+    uint8_t count;
+    int8_t id;
+    uint32_t len;
+    size_t at;
+};
+
+static Found parse(const char *stream, const uint8_t *pieces = NULL, uint8_t count = 0)
+{
+    ESP8266IPDParser parser;
+    Found found = {0, 0, 0, 0};
+    size_t len = strlen(stream);
+    size_t pos = 0, end;
+    uint8_t piece = 0;
+
+    while (pos < len) {
+        end = (piece < count) ? pos + pieces[piece++] : len;
+        if (end > len) {
+            end = len;
+        }
+        for (; pos < end; pos++) {
+            if (parser.feed(stream[pos])) {
+                found.count++;
+                found.id = parser.id();
+                found.len = parser.length();
+                found.at = pos;
+            }
+        }
+    }
+    return found;
+}
+
+static void test_parser(void)
+{
+    static const uint8_t bytes[] = {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1};
+    static const uint8_t halves[] = {3, 4, 2, 5};
+    Found f;
+
+    /* Headers of both modes, after other output */
+    f = parse("AT+CIPSEND=3,5\r\r\nOK\r\n\r\n+IPD,3,12:hello world!");
+    CHECK(f.count == 1 && f.id == 3 && f.len == 12 && f.at == 32);
+    f = parse("\r\n+IPD,1460:");
+    CHECK(f.count == 1 && f.id == -1 && f.len == 1460);
+
+    /* The same header in fragments, whatever the cuts */
+    f = parse("+IPD,4,250:", bytes, sizeof(bytes));
+    CHECK(f.count == 1 && f.id == 4 && f.len == 250);
+    f = parse("\r\n+IPD,0,7:abcdefg", halves, sizeof(halves));
+    CHECK(f.count == 1 && f.id == 0 && f.len == 7 && f.at == 10);
+
+    /* "+" starting over inside the prefix */
+    f = parse("++IPD,7:");
+    CHECK(f.count == 1 && f.id == -1 && f.len == 7);
+    f = parse("+IP+IPD,42:");
+    CHECK(f.count == 1 && f.len == 42);
+
+    /* Malformed ids */
+    CHECK(parse("+IPD,5,3:").count == 0);
+    CHECK(parse("+IPD,9,3:").count == 0);
+    CHECK(parse("+IPD,a,3:").count == 0);
+    CHECK(parse("+IPD,-1,3:").count == 0);
+    CHECK(parse("+IPD,,3:").count == 0);
+    CHECK(parse("+IPD,1,,3:").count == 0);
+    CHECK(parse("+IPD,1,2,3:").count == 0);
+    CHECK(parse("+IPD,1,3\r\n").count == 0);
+    CHECK(parse("+ipd,1,3:").count == 0);
+
+    /* Zero and overlong lengths */
+    CHECK(parse("+IPD,0:").count == 0);
+    CHECK(parse("+IPD,2,0:").count == 0);
+    CHECK(parse("+IPD,2,00:").count == 0);
+    CHECK(parse("+IPD,123456:").count == 0);
+
+    /* A bad header does not hide the good one after it */
+    f = parse("+IPD,9,5:+IPD,1,2:");
+    CHECK(f.count == 1 && f.id == 1 && f.len == 2);
+    f = parse("+IPD,0:+IPD,3:");
+    CHECK(f.count == 1 && f.id == -1 && f.len == 3);
+
+    /* reset() forgets a header cut in two */
+    {
+        ESP8266IPDParser parser;
+        const char *head = "+IPD,2,";
+        const char *tail = "5:";
+
+        while (*head) {
+            parser.feed(*head++);
+        }
+        parser.reset();
+        CHECK(!parser.feed(*tail++) && !parser.feed(*tail++));
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * A transport which gives a recorded stream, a piece more each time all of
+ * the previous one has been read, as a UART would.
+ */
+class Recorded : public Stream {
+ public:
+    Recorded(): m_data(NULL), m_len(0), m_pos(0), m_ready(0), m_pieces(NULL), m_count(0), m_piece(0) {}
+
+    void play(const char *data, size_t len, const uint8_t *pieces, uint8_t count)
+    {
+        m_data = data;
+        m_len = len;
+        m_pos = m_ready = 0;
+        m_pieces = pieces;
+        m_count = count;
+        m_piece = 0;
+    }
+
+    void begin(uint32_t baud) { (void)baud; }
+    int available(void)
+    {
+        if (m_pos == m_ready && m_ready < m_len) {
+            m_ready += m_count ? m_pieces[m_piece++ % m_count] : m_len;
+            if (m_ready > m_len) {
+                m_ready = m_len;
+            }
+        }
+        return (int)(m_ready - m_pos);
+    }
+    int read(void) { return available() > 0 ? (uint8_t)m_data[m_pos++] : -1; }
+    int peek(void) { return available() > 0 ? (uint8_t)m_data[m_pos] : -1; }
+    size_t write(uint8_t c) { (void)c; return 1; }
+    using Print::write;
+
+ private:
+    const char *m_data;
+    size_t m_len;
+    size_t m_pos;
+    size_t m_ready;                 /* what has "arrived" so far */
+    const uint8_t *m_pieces;
+    uint8_t m_count;
+    uint8_t m_piece;
+};
+
+/* Play stream and read everything the links got, as "id:data;" by id */
+static String receive(ESP8266 &wifi, Recorded &uart, const char *stream, const uint8_t *pieces, uint8_t count)
+{
+    String links[ESP8266_MAX_LINKS];
+    String got;
+    uint8_t buffer[16];
+    uint8_t id;
+    uint32_t n, i;
+
+    uart.play(stream, strlen(stream), pieces, count);
+    while ((n = wifi.recv(&id, buffer, sizeof(buffer), 20)) > 0) {
+        for (i = 0; i < n; i++) {
+            links[id] += (char)buffer[i];
+        }
+    }
+    for (id = 0; id < ESP8266_MAX_LINKS; id++) {
+        if (links[id].length() == 0) {
+            continue;
+        }
+        if (got.length() > 0) {
+            got += ';';
+        }
+        got += (char)('0' + id);
+        got += ':';
+        got += links[id];
+    }
+    return got;
+}
+
+static void test_engine(void)
+{
+    static const uint8_t whole[] = {255};
+    static const uint8_t bytes[] = {1};
+    static const uint8_t odd[] = {3, 1, 4, 1, 5, 9, 2, 6};
+    static const uint8_t *const cuts[] = {whole, bytes, odd};
+    static const uint8_t sizes[] = {sizeof(whole), sizeof(bytes), sizeof(odd)};
+    static const char *const streams[][2] = {
+        /* what ESP8266 sent, what the links got */
+        {"\r\n+IPD,0,5:hello\r\n+IPD,1,3:abc\r\nOK\r\n", "0:hello;1:abc"},
+        {"+IPD,2,4:a\r\nb\r\n+IPD,2,2:cd", "2:a\r\nbcd"},
+        /* "+IPD" inside data is data */
+        {"+IPD,3,10:+IPD,1,2:x+IPD,4,1:y", "3:+IPD,1,2:x;4:y"},
+        /* Malformed and zero-length headers are noise */
+        {"+IPD,7,3:abc\r\n+IPD,0:\r\n+IPD,1,0:\r\n+IPD,1,2:ok", "1:ok"},
+        {"+IPD,1,x:abc\r\n+IPD,,2:zz\r\n+IPD,4,3:end", "4:end"},
+        /* A URC between two packages */
+        {"+IPD,0,1:a0,CLOSED\r\n+IPD,1,1:b", "0:a;1:b"},
+    };
+    Recorded uart;
+    ESP8266 wifi(uart);
+    uint8_t s, c;
+    String got;
+
+    for (s = 0; s < sizeof(streams) / sizeof(streams[0]); s++) {
+        for (c = 0; c < sizeof(cuts) / sizeof(cuts[0]); c++) {
+            got = receive(wifi, uart, streams[s][0], cuts[c], sizes[c]);
+            if (!(got == streams[s][1])) {
+                printf("stream %u cut %u: got \"%s\"\n", s, c, got.c_str());
+            }
+            CHECK(got == streams[s][1]);
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* The far end answers anything with REPLY_SIZE bytes, more than a link queue */
+#define REPLY_SIZE  (ESP8266_LINK_BUFFER_SIZE * 2 - 4)
+
+static void reply(uint8_t link, const uint8_t *data, uint32_t len, void *arg)
+{
+    uint8_t buffer[REPLY_SIZE];
+
+    (void)data;
+    (void)len;
+    memset(buffer, 'r', sizeof(buffer));
+    ((ESP8266Sim *)arg)->receive(link, buffer, sizeof(buffer));
+}
+
+/* Data for a full queue must not hold up the answers to commands */
+static void test_overflow(void)
+{
+    ESP8266Sim sim;
+    ESP8266 wifi(sim);
+    uint8_t buffer[10];
+    uint32_t n;
+
+    sim.setTiming(false);
+    sim.setLatency(0, 0);
+    sim.setHandler(reply, &sim);
+
+    CHECK(wifi.joinAP(F("home"), "pw"));
+    CHECK(wifi.createTCP(F("example.com"), 80));
+    CHECK(wifi.send((const uint8_t *)"GET", 3));
+    n = wifi.recv(buffer, sizeof(buffer), 1000);
+    CHECK(n == sizeof(buffer));
+    CHECK(wifi.releaseTCP());
+    CHECK(wifi.kick());
+    /* Nothing is lost unnoticed */
+    CHECK(n + wifi.available() + wifi.getLinkDropCount(ESP8266_SINGLE_LINK) == REPLY_SIZE);
+    CHECK(wifi.getLinkDropCount(ESP8266_SINGLE_LINK) > 0);
+
+    /* Nor must an unread link hold up another one */
+    CHECK(wifi.enableMUX());
+    CHECK(wifi.createTCP(1, F("a.example"), 80));
+    CHECK(wifi.createTCP(2, F("b.example"), 80));
+    CHECK(wifi.send(1, (const uint8_t *)"GET", 3));
+    CHECK(wifi.send(2, (const uint8_t *)"GET", 3));
+    CHECK(wifi.recv((uint8_t)2, buffer, sizeof(buffer), 1000) == sizeof(buffer));
+    CHECK(wifi.available(1) == ESP8266_LINK_BUFFER_SIZE);
+    CHECK(wifi.getLinkDropCount(1) == REPLY_SIZE - ESP8266_LINK_BUFFER_SIZE);
+    CHECK(wifi.kick());
+}
+
+int main(void)
+{
+    test_parser();
+    test_engine();
+    test_overflow();
+    return TEST_RESULT("test_ipd");
+}
@@ -0,0 +1,117 @@
+/**
+ * @file test_nostring.cpp
+ * @brief Test that the library allocates nothing when built with ESP8266_NO_STRING.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "test.h"
+#include "ESP8266Sim.h"
+#include "ESP8266LinkPool.h"
+
+#if !ESP8266_NO_STRING
+#error "build with ESP8266_NO_STRING=1, see the Makefile"
+#endif
+
+static ESP8266Sim sim;
+
+/* The far end sends back what it gets */
+static void echo(uint8_t link, const uint8_t *data, uint32_t len, void *arg)
+{
+    (void)arg;
+    sim.receive(link, data, len);
+}
+
+/* Gives 300 bytes with a backslash in the middle, the total not told */
+static uint32_t produce(uint8_t *buffer, uint32_t size, void *arg)
+{
+    uint32_t *left = (uint32_t *)arg;
+    uint32_t n = *left < size ? *left : size;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        buffer[i] = (*left - i == 150) ? '\\' : 's';
+    }
+    *left -= n;
+    return n;
+}
+
+static void test_hook(void)
+{
+    uint32_t before = hostAllocCount();
+    int *p = new int(1);
+
+    /* The count must see allocations for a count of 0 to mean anything */
+    CHECK(hostAllocCount() == before + 1);
+    delete p;
+}
+
+static void test_no_allocation(void)
+{
+    ESP8266 wifi(sim);
+    ESP8266LinkPool pool(wifi);
+    ESP8266AP aps[2];
+    char buffer[160];
+    uint8_t data[64];
+    uint8_t id;
+    uint32_t allocs = hostAllocCount();
+    uint32_t left = 300, sent = 0;
+    int8_t link;
+
+    sim.setHandler(echo);
+    sim.addAP("home", -40);
+    sim.addAP("cafe", -70);
+    sim.setLatency(2);
+
+    CHECK(wifi.kick());
+    CHECK(wifi.getVersion(buffer, sizeof(buffer)));
+    CHECK(wifi.setOprToStation());
+    CHECK(wifi.scanAP(aps, 2) == 2);
+    CHECK(wifi.getAPList(buffer, sizeof(buffer)));
+    CHECK(wifi.joinAP(F("home"), "pw"));
+    CHECK(wifi.getLocalIP(buffer, sizeof(buffer)));
+
+    /* Single mode */
+    CHECK(wifi.createTCP(F("example.com"), 80));
+    CHECK(wifi.send((const uint8_t *)"hello", 5));
+    CHECK(wifi.recv(data, sizeof(data), 1000) == 5);
+    CHECK(wifi.sendStream(produce, &left, 0, &sent) && sent == 300);
+    CHECK(wifi.getIPStatus(buffer, sizeof(buffer)));
+    CHECK(wifi.releaseTCP());
+
+    /* Multiple mode, through the link pool */
+    CHECK(wifi.enableMUX());
+    link = pool.acquire("a.example", 80);
+    CHECK(link >= 0);
+    if (link >= 0) {
+        CHECK(wifi.send(link, (const uint8_t *)"abc", 3));
+        CHECK(wifi.recv(&id, data, sizeof(data), 1000) == 3 && id == link);
+        pool.release(link);
+    }
+    CHECK(pool.acquire("a.example", 80) == link);
+    pool.closeAll();
+    CHECK(wifi.getConnectedLinks() == 0);
+
+    CHECK(hostAllocCount() == allocs);
+    if (hostAllocCount() != allocs) {
+        printf("%lu allocations\n", (unsigned long)(hostAllocCount() - allocs));
+    }
+}
+
+int main(void)
+{
+    test_hook();
+    test_no_allocation();
+    return TEST_RESULT("test_nostring");
+}
@@ -0,0 +1,106 @@
+/**
+ * @file test_sim.cpp
+ * @brief Tests of what ESP8266Sim writes on the wire.
+ *
+ * @par Copyright:
+ * Copyright (c) 2015 ITEAD Intelligent Systems Co., Ltd. \n\n
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "test.h"
+#include "ESP8266Sim.h"
+
+/* The far end sends back what it gets */
+static void echo(uint8_t link, const uint8_t *data, uint32_t len, void *arg)
+{
+    ((ESP8266Sim *)arg)->receive(link, data, len);
+}
+
+/* Write a command or data to sim and take all it answers */
+static String talk(ESP8266Sim &sim, const char *text)
+{
+    String got;
+    unsigned long start;
+
+    sim.write((const uint8_t *)text, strlen(text));
+    start = millis();
+    while (millis() - start < 20) {
+        while (sim.available() > 0) {
+            got += (char)sim.read();
+        }
+    }
+    return got;
+}
+
+/* The answer of the far end comes after "SEND OK", for any length of data */
+static void test_send_order(void)
+{
+    static const char *const sends[][2] = {
+        /* command, data */
+        {"AT+CIPSEND=5\r\n", "hello"},
+        {"AT+CIPSEND=40\r\n", "0123456789012345678901234567890123456789"},
+        {"AT+CIPSENDEX=100\r\n", "ab\\0"},
+        {"AT+CIPSENDEX=3\r\n", "a\\b"},
+    };
+    ESP8266Sim sim;
+    String got;
+    int ok, ipd;
+    uint8_t s;
+
+    sim.setTiming(false);
+    sim.setLatency(0, 0);
+    sim.setHandler(echo, &sim);
+    CHECK(talk(sim, "AT+CWJAP=\"home\",\"pw\"\r\n").indexOf("OK") >= 0);
+    CHECK(talk(sim, "AT+CIPSTART=\"TCP\",\"example.com\",80\r\n").indexOf("OK") >= 0);
+
+    for (s = 0; s < sizeof(sends) / sizeof(sends[0]); s++) {
+        CHECK(talk(sim, sends[s][0]).indexOf("> ") >= 0);
+        got = talk(sim, sends[s][1]);
+        ok = got.indexOf("SEND OK");
+        ipd = got.indexOf("+IPD,");
+        if (!(ok >= 0 && ipd > ok)) {
+            printf("send %u: got \"%s\"\n", s, got.c_str());
+        }
+        CHECK(ok >= 0 && ipd > ok);
+    }
+}
+
+/* Sets the baud rate of a transport known only as Stream */
+static void set_baud(Stream *uart, uint32_t baud)
+{
+    static_cast<ESP8266Sim *>(uart)->begin(baud);
+}
+
+/* ESP8266Sim given as Stream, with every call going through Stream */
+static void test_stream(void)
+{
+    ESP8266Sim sim;
+    Stream &uart = sim;
+    ESP8266 wifi(uart, set_baud);
+    uint8_t buffer[8];
+
+    sim.setTiming(false);
+    sim.setLatency(0, 0);
+    sim.setHandler(echo, &sim);
+    CHECK(wifi.kick());
+    CHECK(wifi.joinAP(F("home"), "pw"));
+    CHECK(wifi.createTCP(F("example.com"), 80));
+    CHECK(wifi.send((const uint8_t *)"hello", 5));
+    CHECK(wifi.recv(buffer, sizeof(buffer), 1000) == 5);
+}
+
+int main(void)
+{
+    test_send_order();
+    test_stream();
+    return TEST_RESULT("test_sim");
+}